@@ -0,0 +1,273 @@
+"""Run the extraction macros inside this Python process, and get DataFrames back
+
+convert_to_csv.py writes the file list to a temporary file, runs the macros in a `root`
+subprocess, and the csv they write then has to be parsed again. The functions here load
+the same macros into PyROOT once, call their table functions directly, and copy each
+column of the resulting table straight into a numpy array, without any text in
+between. For example, in a notebook:
+
+    from analysis.extraction import extract_fit_results
+    df = extract_fit_results(sorted(glob.glob("data/*/*best.fit")))
+
+The files are processed in the given order, so sort them first to match the rows of
+another table. The columns are the same as those of the csv files, and a cell the
+extraction left empty is NaN (or None for text). The table's metadata, like the
+extractor that filled it, is in the attrs of the DataFrame.
+
+NOTE: ROOT must be importable, so source setup_gluex.(c)sh first. Extracting .fit files
+also loads AmpTools with loadAmpTools.C, which is looked up in $AMPTOOLS/ROOT. The
+macros exit on invalid input, which now ends this process instead of the subprocess, so
+use convert_to_csv.py for input that hasn't been checked yet.
+"""
+
+import os
+from typing import List
+
+import numpy as np
+import pandas as pd
+
+SCRIPT_DIR = os.path.join(
+    os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "scripts"
+)
+
+# macros already loaded into this process, which can't be loaded twice
+_loaded_macros = set()
+
+
+def extract_fit_results(
+    files: List[str],
+    acceptance_corrected: bool = False,
+    amplitude_grammar: str = "",
+    union_schema: bool = False,
+    prefetch: int = 8,
+) -> pd.DataFrame:
+    """Extract AmpTools .fit files, like extract_fit_results.cc
+
+    Args:
+        files (List[str]): .fit files, one row each in this order
+        acceptance_corrected (bool, optional): correct the amplitude intensities for
+            acceptance. Defaults to False.
+        amplitude_grammar (str, optional): grammar of the amplitude names, see
+            scripts/amplitude_names.h. Defaults to "", the standard eJPmL format.
+        union_schema (bool, optional): have the columns of every file, instead of
+            those of the first file. Defaults to False.
+        prefetch (int, optional): number of files to read ahead into memory while a
+            file is parsed, 0 for none. Defaults to 8.
+
+    Returns:
+        pd.DataFrame: one row per valid .fit file
+    """
+    ROOT = _load_macro("extract_fit_results.cc", "loadAmpTools.C")
+    table = ROOT.fit_results_table(
+        _string_vector(files),
+        acceptance_corrected,
+        amplitude_grammar,
+        union_schema,
+        prefetch,
+    )
+    return table_to_dataframe(table)
+
+
+def extract_bin_info(
+    bins: List[str],
+    mass_branch: str = "M4Pi",
+    threads: int = 0,
+    sample: float = 1.0,
+    seed: int = 0,
+    histograms: str = "",
+    histogram_output: str = "",
+    moments: int = -1,
+    moment_angles: str = "cosTheta,phi",
+) -> pd.DataFrame:
+    """Extract the bin information of flat tree ROOT files, like extract_bin_info.cc
+
+    Args:
+        bins (List[str]): bin definitions, each a ROOT file or several whitespace
+            separated files and/or glob patterns, see scripts/bin_info.h
+        mass_branch (str, optional): invariant mass branch. Defaults to "M4Pi".
+        threads (int, optional): threads to read the files with, 0 for all cores.
+            Defaults to 0.
+        sample (float, optional): fraction of each file to read. Defaults to 1.0.
+        seed (int, optional): seed of the sampled clusters. Defaults to 0.
+        histograms (str, optional): fine histogram specs, like
+            "M4Pi:100:1.0:1.5". Defaults to "", which fills none.
+        histogram_output (str, optional): binary file to save the histograms to.
+            Required when passing histograms.
+        moments (int, optional): maximum L of the angular moments, -1 for none.
+            Defaults to -1.
+        moment_angles (str, optional): cos(theta) and phi branches of the moments.
+            Defaults to "cosTheta,phi".
+
+    Returns:
+        pd.DataFrame: one row per bin
+    """
+    if histograms and not histogram_output:
+        raise ValueError("histogram_output is needed to save the histograms")
+    ROOT = _load_macro("extract_bin_info.cc")
+    table = ROOT.bin_info_table(
+        _string_vector(bins),
+        mass_branch,
+        threads,
+        sample,
+        seed,
+        histograms,
+        histogram_output,
+        moments,
+        moment_angles,
+    )
+    return table_to_dataframe(table)
+
+
+def extract_bin_info_fsroot(
+    bins: List[str],
+    tree_name: str,
+    meson_index: str = "2,3,4,5",
+    sample: float = 1.0,
+    seed: int = 0,
+    threads: int = 0,
+    best_combo: str = "",
+) -> pd.DataFrame:
+    """Extract the bin information of FSRoot files, like extract_bin_info_fsroot.cc
+
+    Args:
+        bins (List[str]): bin definitions, see extract_bin_info
+        tree_name (str): FSRoot tree name
+        meson_index (str, optional): indices of the particles from the meson vertex.
+            Defaults to "2,3,4,5".
+        sample (float, optional): fraction of each file to read. Defaults to 1.0.
+        seed (int, optional): seed of the sampled clusters. Defaults to 0.
+        threads (int, optional): threads to read the files with, 0 for all cores.
+            Defaults to 0.
+        best_combo (str, optional): branch whose lowest value picks the combination
+            kept for each event. Defaults to "", which keeps all of them.
+
+    Returns:
+        pd.DataFrame: one row per bin
+    """
+    ROOT = _load_macro("extract_bin_info_fsroot.cc")
+    table = ROOT.fsroot_bin_info_table(
+        _string_vector(bins), tree_name, meson_index, sample, seed, threads, best_combo
+    )
+    return table_to_dataframe(table)
+
+
+def extract_joined_results(
+    fit_files: List[str],
+    bins: List[str],
+    acceptance_corrected: bool = False,
+    mass_branch: str = "M4Pi",
+    key_source: str = "directory",
+    threads: int = 0,
+    amplitude_grammar: str = "",
+    union_schema: bool = False,
+) -> pd.DataFrame:
+    """Extract .fit files and their data bins into one table, like
+    extract_joined_results.cc
+
+    Every fit is joined to the data bin with the same bin key, which comes from
+    directory names like "mass_1.100-1.125" (see scripts/bin_keys.h), so neither list
+    has to be sorted.
+
+    Args:
+        fit_files (List[str]): .fit files, in any order
+        bins (List[str]): bin definitions of flat tree ROOT files, in any order
+        acceptance_corrected (bool, optional): correct the amplitude intensities for
+            acceptance. Defaults to False.
+        mass_branch (str, optional): invariant mass branch. Defaults to "M4Pi".
+        key_source (str, optional): "directory" to key the bins by their directories
+            like the fits, or "edges" to match their measured edges to the fits'
+            directories. Defaults to "directory".
+        threads (int, optional): threads to read the ROOT files with, 0 for all
+            cores. Defaults to 0.
+        amplitude_grammar (str, optional): grammar of the amplitude names. Defaults
+            to "", the standard eJPmL format.
+        union_schema (bool, optional): have the columns of every .fit file. Defaults
+            to False.
+
+    Returns:
+        pd.DataFrame: one row per fit, with its bin key in "bin", the fit columns, and
+            the bin columns, whose files are in "bin_files"
+    """
+    ROOT = _load_macro("extract_joined_results.cc", "loadAmpTools.C")
+    table = ROOT.joined_results_table(
+        _string_vector(fit_files),
+        _string_vector(bins),
+        acceptance_corrected,
+        mass_branch,
+        key_source,
+        threads,
+        amplitude_grammar,
+        union_schema,
+    )
+    return table_to_dataframe(table)
+
+
+def table_to_dataframe(table) -> pd.DataFrame:
+    """Convert a ResultsTable (see scripts/results_table.h) into a DataFrame
+
+    Every numeric column is copied once, by the table itself, into a new numpy array.
+
+    Args:
+        table (ROOT.ResultsTable): table returned by one of the extraction functions
+
+    Returns:
+        pd.DataFrame: the table's columns in order, with null cells as NaN or None
+    """
+    import ROOT
+
+    n_rows = table.n_rows()
+    validity = np.empty(n_rows, dtype=np.uint8)
+    columns = {}
+    for column in table.column_order():
+        table.copy_validity(column, validity)
+        is_valid = validity.astype(bool)
+        column_type = table.column_type(column)
+        if column_type == ROOT.ColumnType.Text:
+            values = [
+                str(table.get_text(column, row)) if is_valid[row] else None
+                for row in range(n_rows)
+            ]
+        elif column_type == ROOT.ColumnType.Int64:
+            values = np.empty(n_rows, dtype=np.int64)
+            table.copy_ints(column, values)
+        else:
+            values = np.empty(n_rows, dtype=np.float64)
+            table.copy_floats(column, values)
+        if column_type != ROOT.ColumnType.Text and not is_valid.all():
+            values = np.where(is_valid, values, np.nan)
+        columns[str(table.column_name(column))] = values
+
+    df = pd.DataFrame(columns)
+    df.attrs.update(
+        {str(entry.first): str(entry.second) for entry in table.get_metadata()}
+    )
+    return df
+
+
+def _load_macro(macro: str, package: str = ""):
+    """Load a macro of the scripts directory once, and return the ROOT module"""
+    import ROOT  # only imported here, so the module can be imported without ROOT
+
+    if macro in _loaded_macros:
+        return ROOT
+    ROOT.gROOT.SetBatch(True)
+    if package:
+        amptools = os.environ.get("AMPTOOLS", "")
+        ROOT.gROOT.SetMacroPath(
+            f"{ROOT.gROOT.GetMacroPath()}:{amptools}:{amptools}/ROOT"
+        )
+        ROOT.gROOT.Macro(package)
+    if ROOT.gROOT.LoadMacro(os.path.join(SCRIPT_DIR, macro)) != 0:
+        raise RuntimeError(f"Could not load {macro}")
+    _loaded_macros.add(macro)
+    return ROOT
+
+
+def _string_vector(values: List[str]):
+    import ROOT
+
+    vector = ROOT.std.vector["std::string"]()
+    vector.reserve(len(values))
+    for value in values:
+        vector.push_back(value)
+    return vector
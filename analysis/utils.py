@@ -3,6 +3,8 @@
 
 import itertools
 import re
+import sqlite3
+import struct
 from typing import Dict
 
 import numpy as np
@@ -201,3 +203,210 @@ def convert_amp_name(input_string: str) -> str:
     l = r"\Sigma \ell" if amp_dict["l"] == "" else amp_dict["l"]
 
     return rf"${j}^{{{p}}}{l}_{{{m}}}^{{({e})}}$"
+
+
+def read_bin_histograms(path: str) -> Dict[str, dict]:
+    """Read the fine-binned histograms written by extract_bin_info.cc
+
+    The file holds the weighted histograms of every bin, filled when the bin info csv
+    was made (see scripts/bin_histograms.h for the layout). The arrays are read-only
+    views into the file buffer, so no copies are made.
+
+    Args:
+        path (str): path to the binary histogram file
+
+    Returns:
+        dict: keys = histogrammed branch names. values = dict with the bin "edges"
+            (length n_fine + 1), and the "sumw" and "sumw2" arrays of shape
+            (n_bins, n_fine + 2), whose first and last columns are the underflow and
+            overflow. The "bins" key holds the bin definitions, in csv row order
+    """
+    with open(path, "rb") as file:
+        buffer = file.read()
+    if buffer[:4] != b"PAPH":
+        raise ValueError(f"{path} is not a bin histogram file")
+    version, n_bins, n_hists = struct.unpack_from("<3I", buffer, 4)
+    if version != 1:
+        raise ValueError(f"Unsupported histogram file version {version}")
+    offset = 16
+
+    def read_string() -> str:
+        nonlocal offset
+        (length,) = struct.unpack_from("<I", buffer, offset)
+        offset += 4 + length
+        return buffer[offset - length : offset].decode()
+
+    bins = [read_string() for _ in range(n_bins)]
+    layout = []
+    for _ in range(n_hists):
+        branch = read_string()
+        n_fine, low, high = struct.unpack_from("<Idd", buffer, offset)
+        offset += 20
+        layout.append((branch, n_fine, low, high))
+
+    # every bin's block has the same size, so the data is a (n_bins, block) array
+    data = np.frombuffer(buffer, dtype="<f8", offset=offset).reshape(n_bins, -1)
+
+    result = {"bins": bins}
+    column = 0
+    for branch, n_fine, low, high in layout:
+        width = n_fine + 2
+        result[branch] = {
+            "edges": np.linspace(low, high, n_fine + 1),
+            "sumw": data[:, column : column + width],
+            "sumw2": data[:, column + width : column + 2 * width],
+        }
+        column += 2 * width
+
+    return result
+
+
+def read_results_table(path: str) -> pd.DataFrame:
+    """Read a columnar results file written by the extraction scripts
+
+    The extraction scripts write this format instead of a csv when the output name ends
+    in ".papt" (see scripts/results_table.h for the layout). The numeric columns are
+    read straight from the file buffer, and null cells become NaN, or None for text.
+
+    Args:
+        path (str): path to the .papt file
+
+    Returns:
+        pd.DataFrame: one column per table column, in the same order as the csv. The
+            table's metadata, like the extractor that wrote it, is in the attrs dict
+    """
+    with open(path, "rb") as file:
+        buffer = file.read()
+    if buffer[:4] != b"PAPT":
+        raise ValueError(f"{path} is not a results table file")
+    version, n_rows, n_columns, n_metadata = struct.unpack_from("<IQII", buffer, 4)
+    if version != 1:
+        raise ValueError(f"Unsupported results table version {version}")
+    offset = 24
+
+    def read_string() -> str:
+        nonlocal offset
+        (length,) = struct.unpack_from("<I", buffer, offset)
+        offset += 4 + length
+        return buffer[offset - length : offset].decode()
+
+    metadata = {}
+    for _ in range(n_metadata):
+        key = read_string()
+        metadata[key] = read_string()
+    layout = []
+    for _ in range(n_columns):
+        name = read_string()
+        (column_type,) = struct.unpack_from("<I", buffer, offset)
+        offset += 4
+        layout.append((name, column_type))
+
+    validity_size = (n_rows + 63) // 64 * 8
+    columns = {}
+    for name, column_type in layout:
+        validity = np.unpackbits(
+            np.frombuffer(buffer, np.uint8, validity_size, offset),
+            count=n_rows,
+            bitorder="little",
+        ).astype(bool)
+        offset += validity_size
+        if column_type == 2:
+            offsets = np.frombuffer(buffer, "<u8", n_rows + 1, offset).tolist()
+            offset += 8 * (n_rows + 1)
+            # the offsets count bytes, so every cell is decoded on its own
+            values = [
+                (
+                    buffer[offset + offsets[i] : offset + offsets[i + 1]].decode()
+                    if validity[i]
+                    else None
+                )
+                for i in range(n_rows)
+            ]
+            offset += (offsets[-1] + 7) // 8 * 8
+        else:
+            dtype = "<f8" if column_type == 0 else "<i8"
+            values = np.frombuffer(buffer, dtype, n_rows, offset)
+            offset += 8 * n_rows
+            if not validity.all():
+                values = np.where(validity, values, np.nan)
+        columns[name] = values
+
+    df = pd.DataFrame(columns)
+    df.attrs.update(metadata)
+    return df
+
+
+def read_campaign(path: str, campaign: str) -> pd.DataFrame:
+    """Read one campaign of a SQLite results database back into a DataFrame
+
+    The extraction scripts add a campaign to a database when the output name is like
+    "results.sqlite:NAME" (see scripts/results_table.h for the tables). The database
+    can hold many campaigns, and can also be queried with SQL directly.
+
+    Args:
+        path (str): path to the .sqlite or .db file
+        campaign (str): name of the campaign
+
+    Returns:
+        pd.DataFrame: one row per bin, with the same columns as the csv. Null cells
+            are NaN, or None for text. The campaign's metadata is in the attrs dict
+    """
+    with sqlite3.connect(f"file:{path}?mode=ro", uri=True) as connection:
+        found = connection.execute(
+            "SELECT id FROM campaigns WHERE name = ?", (campaign,)
+        ).fetchone()
+        if found is None:
+            raise ValueError(f"{path} has no campaign named {campaign}")
+        (campaign_id,) = found
+        metadata = dict(
+            connection.execute(
+                "SELECT key, value FROM metadata WHERE campaign_id = ?", (campaign_id,)
+            ).fetchall()
+        )
+        layout = connection.execute(
+            "SELECT id, name, type FROM columns WHERE campaign_id = ? ORDER BY position",
+            (campaign_id,),
+        ).fetchall()
+        bins = pd.read_sql_query(
+            "SELECT id, label FROM bins WHERE campaign_id = ? ORDER BY row",
+            connection,
+            params=(campaign_id,),
+        )
+        if bins.empty:
+            df = pd.DataFrame(columns=[name for _, name, _ in layout])
+            df.attrs.update(metadata)
+            return df
+        # the bins of a campaign are written in one transaction, so their ids are a
+        # range, which reads the cells in primary key order
+        cells = pd.read_sql_query(
+            "SELECT bin_id, column_id, value FROM cell_values "
+            "WHERE bin_id BETWEEN ? AND ?",
+            connection,
+            params=(int(bins["id"].min()), int(bins["id"].max())),
+        )
+
+    rows = pd.Index(bins["id"]).get_indexer(cells["bin_id"])
+    cells_by_column = {
+        column_id: (rows[group], cells["value"].to_numpy()[group])
+        for column_id, group in cells.groupby("column_id").indices.items()
+    }
+    columns = {}
+    for column_id, name, column_type in layout:
+        if name == "file":
+            columns[name] = bins["label"].to_numpy()
+            continue
+        column_rows, values = cells_by_column.get(
+            column_id, (np.empty(0, int), np.empty(0))
+        )
+        if column_type == 2:
+            column = np.full(len(bins), None, dtype=object)
+        elif column_type == 1 and len(column_rows) == len(bins):
+            column = np.empty(len(bins), dtype=np.int64)
+        else:
+            column = np.full(len(bins), np.nan)
+        column[column_rows] = values
+        columns[name] = column
+
+    df = pd.DataFrame(columns)
+    df.attrs.update(metadata)
+    return df
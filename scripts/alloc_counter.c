@@ -0,0 +1,78 @@
+/* Count the heap allocations of a process, for the allocation numbers of profiler.h
+
+Build it once and preload it into ROOT:
+    gcc -O2 -shared -fPIC -o alloc_counter.so scripts/alloc_counter.c
+    LD_PRELOAD=$PWD/alloc_counter.so PYAMPPLOTS_PROFILE=1 root -l -b -q ...
+Every malloc, calloc, realloc, and aligned allocation (which is what operator new ends
+up calling) is counted, then handed to glibc's own implementation. The counts of the
+whole process are kept along with the allocations of every thread, so that a phase only
+counts the allocations of the thread running it. profiler.h looks the counters up by
+name, so their names must not change.
+*/
+
+#include <errno.h>
+#include <stddef.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+unsigned long long alloc_counter_calls = 0;
+unsigned long long alloc_counter_bytes = 0;
+
+// initial-exec, since the shim is preloaded and its TLS must never allocate itself
+static __thread unsigned long long thread_calls __attribute__((tls_model("initial-exec")));
+
+// The number of allocations of the calling thread
+unsigned long long alloc_counter_thread_calls(void)
+{
+    return thread_calls;
+}
+
+static void count_allocation(size_t size)
+{
+    ++thread_calls;
+    __atomic_fetch_add(&alloc_counter_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_counter_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+    count_allocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    count_allocation(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_allocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    count_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    count_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    // alignment must be a power of two multiple of sizeof(void *)
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    count_allocation(size);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
@@ -0,0 +1,240 @@
+/* Configurable parsing of the quantum numbers in AmpTools amplitude names
+
+Rather than slicing amplitude names at fixed offsets, the eJPmL quantum numbers are
+read with a grammar, a pattern of literal characters and named fields like
+    {e:[pm]}{J:[0-9]+}{P:[pm]}{m:.}{L:[A-Z]}
+which matches names like "p1p0S" and "m10mpG". Each field is
+    {name:class}, {name:class+}, or {name:class*}
+where name is one of e, J, P, m, or L, and class is either a character set like [pm]
+or [0-9A-Z], or . for any character. A + reads one or more characters instead of one,
+and a * any number, including none.
+Characters outside of the braces must appear literally, so for example names like
+"J2_M1_refl+" could be read with
+    J{J:[0-9]+}_M{m:[-0-9]+}_refl{e:[+-]}
+Fields that are not in the grammar are left empty, and are the same for every amplitude.
+
+The default grammar is
+    {e:.}{J:[0-9]+}{P:.}{m:.}{L:.*}
+which takes any character for e, P, and m, and the rest of the name, if any, as L. Like
+the fixed offsets of earlier versions, it reads any name of at least 4 characters, as
+long as J starts with a digit, and J may also have more than one digit. A name that
+doesn't match the grammar stops the extraction with a message.
+
+The grammar is compiled once into a table of accepted characters per step. Repeated
+fields are greedy, and give characters back when the rest of the name doesn't match
+otherwise, so "p12S" is read as J=1 and P=2. Parsing a name only walks the table and
+returns views into the name, without allocating.
+
+The parsed values are interned in a QuantumCatalog, which gives every distinct value of
+a field a small id. The ids of the five fields are packed into one integer code (one
+byte per field), and the same catalog is used for every file, so the same waves get
+the same codes in every file.
+*/
+
+#ifndef AMPLITUDE_NAMES_H
+#define AMPLITUDE_NAMES_H
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// the quantum number fields of an amplitude name, in the order of their code bytes
+constexpr std::string_view QUANTUM_FIELDS = "eJPmL";
+constexpr size_t N_QUANTUM_FIELDS = QUANTUM_FIELDS.size();
+
+using QuantumCode = std::uint64_t;
+
+// the value of every quantum number field, as views into the amplitude name
+using AmplitudeParts = std::array<std::string_view, N_QUANTUM_FIELDS>;
+
+const std::string DEFAULT_AMPLITUDE_GRAMMAR = "{e:.}{J:[0-9]+}{P:.}{m:.}{L:.*}";
+
+class AmplitudeGrammar
+{
+public:
+    // Compile the pattern, exiting with a message if it is not valid
+    explicit AmplitudeGrammar(std::string_view pattern = DEFAULT_AMPLITUDE_GRAMMAR)
+        : pattern(pattern)
+    {
+        std::array<bool, N_QUANTUM_FIELDS> is_used = {};
+        for (size_t i = 0; i < pattern.size();)
+        {
+            Step step;
+            if (pattern[i] != '{')
+            {
+                step.accepts[static_cast<unsigned char>(pattern[i])] = true;
+                steps.push_back(step);
+                ++i;
+                continue;
+            }
+
+            size_t close = pattern.find('}', i);
+            if (close == std::string_view::npos)
+                fail("a '{' is never closed");
+            std::string_view body = pattern.substr(i + 1, close - i - 1);
+            size_t colon = body.find(':');
+            std::string_view name = body.substr(0, colon);
+            std::string_view set =
+                colon == std::string_view::npos ? "." : body.substr(colon + 1);
+            i = close + 1;
+
+            size_t field = QUANTUM_FIELDS.find(name);
+            if (name.size() != 1 || field == std::string_view::npos)
+                fail("'" + std::string(name) + "' is not one of e, J, P, m, or L");
+            if (is_used[field])
+                fail("the field " + std::string(name) + " appears twice");
+            is_used[field] = true;
+            step.field = field;
+
+            if (!set.empty() && (set.back() == '+' || set.back() == '*'))
+            {
+                step.repeat = true;
+                step.min_count = set.back() == '+' ? 1 : 0;
+                set.remove_suffix(1);
+            }
+            read_set(set, step.accepts);
+            steps.push_back(step);
+        }
+    }
+
+    // Split a name into its fields. Returns false if it doesn't match the grammar
+    bool parse(std::string_view name, AmplitudeParts &parts) const
+    {
+        parts = {};
+        return match(name, 0, 0, parts);
+    }
+
+    const std::string &get_pattern() const { return pattern; }
+
+private:
+    static const size_t NO_FIELD = N_QUANTUM_FIELDS;
+
+    // one character of the name, or the characters of a repeated field
+    struct Step
+    {
+        std::array<bool, 256> accepts = {};
+        bool repeat = false;
+        size_t min_count = 1;
+        size_t field = NO_FIELD;
+    };
+
+    std::string pattern;
+    std::vector<Step> steps;
+
+    // Match the steps from step on to the name from position on. A repeated field takes
+    // as many characters as it can, and gives them back one by one when the rest of the
+    // name doesn't match
+    bool match(
+        std::string_view name, size_t step, size_t position, AmplitudeParts &parts) const
+    {
+        if (step == steps.size())
+            return position == name.size();
+        const Step &current = steps[step];
+        size_t end = position;
+        size_t max_end = current.repeat ? name.size() : position + current.min_count;
+        while (end < name.size() && end < max_end &&
+               current.accepts[static_cast<unsigned char>(name[end])])
+        {
+            ++end;
+        }
+        for (; end >= position + current.min_count; --end)
+        {
+            if (current.field != NO_FIELD)
+                parts[current.field] = name.substr(position, end - position);
+            if (match(name, step + 1, end, parts))
+                return true;
+            if (end == position)
+                break;
+        }
+        return false;
+    }
+
+    void fail(const std::string &reason) const
+    {
+        std::cout << "Invalid amplitude grammar \"" << pattern << "\": " << reason << "\n";
+        exit(1);
+    }
+
+    // read a "." or "[...]" character set, where "a-z" is a range
+    void read_set(std::string_view set, std::array<bool, 256> &accepts) const
+    {
+        if (set == ".")
+        {
+            accepts.fill(true);
+            return;
+        }
+        if (set.size() < 3 || set.front() != '[' || set.back() != ']')
+            fail("the character set '" + std::string(set) + "' is not . or [...]");
+        set = set.substr(1, set.size() - 2);
+        for (size_t i = 0; i < set.size(); ++i)
+        {
+            unsigned char first = set[i], last = set[i];
+            // a '-' at either end of the set is a literal '-'
+            if (i + 2 < set.size() && set[i + 1] == '-')
+            {
+                last = set[i + 2];
+                i += 2;
+            }
+            for (unsigned int c = first; c <= last; ++c)
+            {
+                accepts[c] = true;
+            }
+        }
+    }
+};
+
+// Small integer ids of every distinct quantum number value that was seen, per field
+class QuantumCatalog
+{
+public:
+    // The id of a value, which is added to the catalog the first time it is seen
+    std::uint8_t intern(size_t field, std::string_view value)
+    {
+        std::vector<std::string> &field_values = values[field];
+        for (size_t i = 0; i < field_values.size(); ++i)
+        {
+            if (field_values[i] == value)
+                return static_cast<std::uint8_t>(i);
+        }
+        if (field_values.size() == 256)
+        {
+            std::cout << "More than 256 different values of the quantum number "
+                      << QUANTUM_FIELDS[field] << "\n";
+            exit(1);
+        }
+        field_values.emplace_back(value);
+        return static_cast<std::uint8_t>(field_values.size() - 1);
+    }
+
+    // one byte per field, in the order of QUANTUM_FIELDS
+    QuantumCode pack(const AmplitudeParts &parts)
+    {
+        QuantumCode code = 0;
+        for (size_t field = 0; field < N_QUANTUM_FIELDS; ++field)
+        {
+            code |= QuantumCode(intern(field, parts[field])) << (8 * field);
+        }
+        return code;
+    }
+
+    // The name of a (masked) code, with the values of the fields listed in type, like
+    // "1p" for the type "JP"
+    std::string key(std::string_view type, QuantumCode code) const
+    {
+        std::string key;
+        for (char letter : type)
+        {
+            size_t field = QUANTUM_FIELDS.find(letter);
+            key += values[field][(code >> (8 * field)) & 0xFF];
+        }
+        return key;
+    }
+
+private:
+    std::array<std::vector<std::string>, N_QUANTUM_FIELDS> values;
+};
+
+#endif // AMPLITUDE_NAMES_H
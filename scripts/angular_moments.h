@@ -0,0 +1,229 @@
+/* Weighted spherical harmonic moments of a pair of decay angles
+
+For every L <= L_max and 0 <= M <= L this accumulates the weighted moment
+    H(L,M) = sum_i w_i Y_LM(theta_i, phi_i)
+as its real (cos(M phi)) and imaginary (sin(M phi)) parts, together with the sums of
+w^2 * Re(Y_LM)^2 and w^2 * Im(Y_LM)^2 that give their errors. Dividing by the weighted
+number of events gives the average <Y_LM>. Negative M follow from the symmetry
+Y_L,-M = (-1)^M conj(Y_LM), so they are not stored.
+
+Events are handled in batches. The normalized associated Legendre functions are built
+with the standard three-term recurrence, whose coefficients only depend on (L,M) and are
+computed once, and cos(M phi) / sin(M phi) with the Chebyshev recurrence. For each
+(L,M) the recurrence runs over the whole batch in a flat loop, which the compiler can
+vectorize, instead of evaluating one event at a time.
+*/
+
+#ifndef ANGULAR_MOMENTS_H
+#define ANGULAR_MOMENTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+class MomentAccumulator
+{
+public:
+    static const size_t BATCH_SIZE = 512;
+
+    MomentAccumulator() = default;
+    explicit MomentAccumulator(int l_max) : l_max(l_max)
+    {
+        size_t n = n_moments();
+        sum_re.assign(n, 0.0);
+        sum_im.assign(n, 0.0);
+        sum_re2.assign(n, 0.0);
+        sum_im2.assign(n, 0.0);
+
+        // recurrence coefficients of the 4pi-normalized Legendre functions, including
+        // the Condon-Shortley phase
+        diagonal.assign(l_max + 1, 0.0);
+        a.assign(n, 0.0);
+        b.assign(n, 0.0);
+        for (int m = 1; m <= l_max; ++m)
+        {
+            diagonal[m] = -std::sqrt((2.0 * m + 1.0) / (2.0 * m));
+        }
+        for (auto *scratch : {&sin_theta, &cos_phi, &p_mm, &p_prev, &p_prev2, &p, &cos_m,
+                              &sin_m, &cos_m1, &sin_m1})
+        {
+            scratch->assign(BATCH_SIZE, 0.0);
+        }
+        for (int l = 1; l <= l_max; ++l)
+        {
+            for (int m = 0; m < l; ++m)
+            {
+                a[index(l, m)] = std::sqrt((4.0 * l * l - 1.0) / (l * l - m * m));
+                b[index(l, m)] =
+                    l - 1 > m ? std::sqrt(((l - 1.0) * (l - 1.0) - m * m) /
+                                          (4.0 * (l - 1.0) * (l - 1.0) - 1.0))
+                              : 0.0;
+            }
+        }
+    }
+
+    int get_l_max() const { return l_max; }
+
+    size_t n_moments() const
+    {
+        return l_max < 0 ? 0 : (l_max + 1) * (l_max + 2) / 2;
+    }
+
+    static size_t index(int l, int m)
+    {
+        return l * (l + 1) / 2 + m;
+    }
+
+    // queue one event, processing the batch once it is full
+    void fill(double cos_theta, double phi, double w)
+    {
+        if (l_max < 0)
+            return;
+        batch_x.push_back(cos_theta);
+        batch_phi.push_back(phi);
+        batch_w.push_back(w);
+        if (batch_x.size() == BATCH_SIZE)
+            flush();
+    }
+
+    // process any queued events. Must be called before reading or merging the sums
+    void flush()
+    {
+        size_t n = batch_x.size();
+        if (n == 0)
+            return;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            sin_theta[i] = std::sqrt(std::max(0.0, 1.0 - batch_x[i] * batch_x[i]));
+            cos_phi[i] = std::cos(batch_phi[i]);
+            p_mm[i] = std::sqrt(1.0 / (4.0 * M_PI));
+            cos_m[i] = 1.0; // cos(0 phi)
+            sin_m[i] = 0.0;
+            cos_m1[i] = cos_phi[i]; // cos(-phi), for the recurrence
+            sin_m1[i] = -std::sin(batch_phi[i]);
+        }
+
+        for (int m = 0; m <= l_max; ++m)
+        {
+            if (m > 0)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    p_mm[i] *= diagonal[m] * sin_theta[i];
+                    // cos(m phi) = 2 cos(phi) cos((m-1) phi) - cos((m-2) phi)
+                    double next_cos = 2.0 * cos_phi[i] * cos_m[i] - cos_m1[i];
+                    double next_sin = 2.0 * cos_phi[i] * sin_m[i] - sin_m1[i];
+                    cos_m1[i] = cos_m[i];
+                    sin_m1[i] = sin_m[i];
+                    cos_m[i] = next_cos;
+                    sin_m[i] = next_sin;
+                }
+            }
+            for (size_t i = 0; i < n; ++i)
+            {
+                p[i] = p_mm[i];
+                p_prev[i] = 0.0;
+            }
+            for (int l = m; l <= l_max; ++l)
+            {
+                if (l > m)
+                {
+                    double a_lm = a[index(l, m)], b_lm = b[index(l, m)];
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        p_prev2[i] = p_prev[i];
+                        p_prev[i] = p[i];
+                        p[i] = a_lm * (batch_x[i] * p_prev[i] - b_lm * p_prev2[i]);
+                    }
+                }
+                double re = 0.0, im = 0.0, re2 = 0.0, im2 = 0.0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    double wy_re = batch_w[i] * p[i] * cos_m[i];
+                    double wy_im = batch_w[i] * p[i] * sin_m[i];
+                    re += wy_re;
+                    im += wy_im;
+                    re2 += wy_re * wy_re;
+                    im2 += wy_im * wy_im;
+                }
+                size_t k = index(l, m);
+                sum_re[k] += re;
+                sum_im[k] += im;
+                sum_re2[k] += re2;
+                sum_im2[k] += im2;
+            }
+        }
+
+        batch_x.clear();
+        batch_phi.clear();
+        batch_w.clear();
+    }
+
+    void merge(MomentAccumulator &other)
+    {
+        flush();
+        other.flush();
+        for (size_t k = 0; k < n_moments(); ++k)
+        {
+            sum_re[k] += other.sum_re[k];
+            sum_im[k] += other.sum_im[k];
+            sum_re2[k] += other.sum_re2[k];
+            sum_im2[k] += other.sum_im2[k];
+        }
+    }
+
+    // csv column names, where M = 0 moments are real and so have no imaginary column
+    std::vector<std::string> headers() const
+    {
+        std::vector<std::string> names;
+        for (int l = 0; l <= l_max; ++l)
+        {
+            for (int m = 0; m <= l; ++m)
+            {
+                std::string name = "Y_" + std::to_string(l) + "_" + std::to_string(m);
+                if (m == 0)
+                {
+                    names.insert(names.end(), {name, name + "_err"});
+                    continue;
+                }
+                names.insert(
+                    names.end(), {name + "_re", name + "_re_err", name + "_im",
+                                  name + "_im_err"});
+            }
+        }
+        return names;
+    }
+
+    // values in the same order as headers(). Call flush() beforehand
+    std::vector<double> values() const
+    {
+        std::vector<double> result;
+        for (int l = 0; l <= l_max; ++l)
+        {
+            for (int m = 0; m <= l; ++m)
+            {
+                size_t k = index(l, m);
+                result.push_back(sum_re[k]);
+                result.push_back(std::sqrt(sum_re2[k]));
+                if (m == 0)
+                    continue;
+                result.push_back(sum_im[k]);
+                result.push_back(std::sqrt(sum_im2[k]));
+            }
+        }
+        return result;
+    }
+
+private:
+    int l_max = -1;
+    std::vector<double> sum_re, sum_im, sum_re2, sum_im2;
+    std::vector<double> diagonal, a, b;
+    std::vector<double> batch_x, batch_phi, batch_w;
+    // per batch scratch space, kept to avoid reallocating it for every batch
+    std::vector<double> sin_theta, cos_phi, p_mm, p_prev, p_prev2, p, cos_m, sin_m,
+        cos_m1, sin_m1;
+};
+
+#endif // ANGULAR_MOMENTS_H
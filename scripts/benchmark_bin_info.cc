@@ -0,0 +1,275 @@
+/* Benchmark the bin info extraction over tree sizes, compression, and thread counts
+
+Writes n_files synthetic flat 'kin' trees (t, E_Beam, M4Pi, Weight) and n_files
+synthetic FSRoot trees (four-momenta of 5 particles and the beam, Run, Event, Chi2DOF)
+holding n_events entries in total, with the given ROOT compression setting (for example
+101 for zlib level 1, 404 for LZ4, or 505 for ZSTD). Every file is its own bin, and the
+extraction of extract_bin_info.cc and extract_bin_info_fsroot.cc is then run with 1, 2,
+4, ... up to max_threads threads.
+
+Each run is done twice: once reading the branches the extraction binds without using
+them, which is the I/O (reading, decompressing, and deserializing the baskets), and
+once for the full extraction. The compute time is the difference between the two. For
+every format and thread count the JSON output holds
+    wall_s, io_s, compute_s, events_per_s, decompressed_mb_per_s
+along with the compressed and uncompressed sizes of the trees. The files are read right
+after being written, so they are most likely in the page cache and the numbers do not
+include disk reads.
+
+Since files are distributed over the threads, there should be at least as many files as
+threads for the thread scaling to mean anything.
+
+Example:
+    root -l -b -q 'scripts/benchmark_bin_info.cc("bench.json", 100000000, 16, 505)'
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio> // for std::remove
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread> // for std::thread::hardware_concurrency
+#include <vector>
+
+#include "bin_info.h"
+#include "fsroot_bin_info.h"
+
+const std::string FSROOT_TREE = "ntFSGlueX_benchmark";
+const std::string FSROOT_MESON_INDICES = "2,3,4,5";
+
+// one measured extraction run
+struct BenchmarkRun
+{
+    std::string format;
+    unsigned int threads;
+    double wall_s, io_s;
+};
+
+// forward declarations
+void write_flat_file(
+    const std::string &path, Long64_t n_events, int compression, unsigned int seed);
+void write_fsroot_file(
+    const std::string &path, Long64_t n_events, int compression, unsigned int seed);
+double tree_megabytes(
+    const std::vector<std::string> &files, const std::string &tree_name, bool zipped);
+template <typename Result>
+double time_bins(
+    const std::vector<std::string> &bins,
+    const std::function<Result(const std::string &)> &process_file, unsigned int threads);
+
+void benchmark_bin_info(
+    std::string json_name, Long64_t n_events = 10000000, int n_files = 16,
+    int compression = 505, int max_threads = 0, std::string scratch_dir = "/tmp")
+{
+    unsigned int hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned int thread_limit = max_threads > 0 ? max_threads : hardware_threads;
+
+    std::vector<std::string> flat_files, fsroot_files;
+    for (int i = 0; i < n_files; ++i)
+    {
+        Long64_t file_events = n_events / n_files + (i < n_events % n_files ? 1 : 0);
+        std::string prefix = scratch_dir + "/bin_info_benchmark_" + std::to_string(i);
+        flat_files.push_back(prefix + "_flat.root");
+        fsroot_files.push_back(prefix + "_fsroot.root");
+        write_flat_file(flat_files.back(), file_events, compression, i);
+        write_fsroot_file(fsroot_files.back(), file_events, compression, i);
+    }
+    std::cout << "Wrote " << n_files << " flat and FSRoot files with " << n_events
+              << " events in total\n";
+
+    // flat tree reading, with and without the accumulation
+    std::function<Long64_t(const std::string &)> read_flat = [](const std::string &file)
+    {
+        std::unique_ptr<TFile> f;
+        FlatTreeBranches branches;
+        TTree *tree = open_flat_tree(file, "M4Pi", f, branches);
+        Long64_t n_entries = tree->GetEntries();
+        for (Long64_t entry = 0; entry < n_entries; ++entry)
+        {
+            tree->GetEntry(entry);
+        }
+        return n_entries;
+    };
+    std::function<BinAccumulator(const std::string &)> extract_flat =
+        [](const std::string &file) { return process_flat_file(file, "M4Pi"); };
+
+    // FSRoot reading, with and without the kinematics and accumulation
+    std::function<Long64_t(const std::string &)> read_fsroot = [](const std::string &file)
+    {
+        std::unique_ptr<TFile> f;
+        FSRootReader reader;
+        TTree *tree = open_fsroot_tree(file, FSROOT_TREE, FSROOT_MESON_INDICES, f, reader);
+        Long64_t n_entries = tree->GetEntries();
+        for (Long64_t entry = 0; entry < n_entries; ++entry)
+        {
+            tree->GetEntry(entry);
+        }
+        return n_entries;
+    };
+    std::function<BinAccumulator(const std::string &)> extract_fsroot =
+        [](const std::string &file)
+    { return process_fsroot_file(file, FSROOT_TREE, FSROOT_MESON_INDICES, ""); };
+
+    std::vector<BenchmarkRun> runs;
+    for (unsigned int threads = 1; threads <= thread_limit;
+         threads = threads == thread_limit ? thread_limit + 1
+                                           : std::min(2 * threads, thread_limit))
+    {
+        runs.push_back(
+            {"flat", threads, time_bins(flat_files, extract_flat, threads),
+             time_bins(flat_files, read_flat, threads)});
+        runs.push_back(
+            {"fsroot", threads, time_bins(fsroot_files, extract_fsroot, threads),
+             time_bins(fsroot_files, read_fsroot, threads)});
+        std::cout << "Finished " << threads << " thread(s)\n";
+    }
+
+    double flat_zipped = tree_megabytes(flat_files, "kin", true);
+    double flat_unzipped = tree_megabytes(flat_files, "kin", false);
+    double fsroot_zipped = tree_megabytes(fsroot_files, FSROOT_TREE, true);
+    double fsroot_unzipped = tree_megabytes(fsroot_files, FSROOT_TREE, false);
+
+    std::ofstream json(json_name);
+    json << "{\n"
+         << "  \"events\": " << n_events << ",\n"
+         << "  \"files\": " << n_files << ",\n"
+         << "  \"compression\": " << compression << ",\n"
+         << "  \"hardware_threads\": " << hardware_threads << ",\n"
+         << "  \"flat_compressed_mb\": " << flat_zipped << ",\n"
+         << "  \"flat_uncompressed_mb\": " << flat_unzipped << ",\n"
+         << "  \"fsroot_compressed_mb\": " << fsroot_zipped << ",\n"
+         << "  \"fsroot_uncompressed_mb\": " << fsroot_unzipped << ",\n"
+         << "  \"runs\": [\n";
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        const BenchmarkRun &run = runs[i];
+        double unzipped = run.format == "flat" ? flat_unzipped : fsroot_unzipped;
+        json << "    {\"format\": \"" << run.format << "\", \"threads\": " << run.threads
+             << ", \"wall_s\": " << run.wall_s << ", \"io_s\": " << run.io_s
+             << ", \"compute_s\": " << std::max(0.0, run.wall_s - run.io_s)
+             << ", \"events_per_s\": " << n_events / run.wall_s
+             << ", \"decompressed_mb_per_s\": " << unzipped / run.wall_s << "}"
+             << (i + 1 < runs.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+    json.close();
+    std::cout << "Results saved to " << json_name << "\n";
+
+    for (const auto &files : {flat_files, fsroot_files})
+    {
+        for (const auto &file : files)
+        {
+            std::remove(file.c_str());
+        }
+    }
+}
+
+// Wall time in seconds of processing every file as its own bin
+template <typename Result>
+double time_bins(
+    const std::vector<std::string> &bins,
+    const std::function<Result(const std::string &)> &process_file, unsigned int threads)
+{
+    auto start = std::chrono::steady_clock::now();
+    process_bin_files(bins, process_file, threads);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Total compressed or uncompressed size of the trees, in MB
+double tree_megabytes(
+    const std::vector<std::string> &files, const std::string &tree_name, bool zipped)
+{
+    double bytes = 0.0;
+    for (const auto &file : files)
+    {
+        std::unique_ptr<TFile> f(TFile::Open(file.c_str()));
+        TTree *tree = f->Get<TTree>(tree_name.c_str());
+        bytes += zipped ? tree->GetZipBytes() : tree->GetTotBytes();
+    }
+    return bytes / 1e6;
+}
+
+// Flat tree with the branches extract_bin_info.cc reads. About 10% of the events get a
+// negative sideband weight, like in sideband subtracted data
+void write_flat_file(
+    const std::string &path, Long64_t n_events, int compression, unsigned int seed)
+{
+    TFile f(path.c_str(), "RECREATE", "", compression);
+    TTree tree("kin", "kin");
+    Float_t t, e_beam, mass, weight;
+    tree.Branch("t", &t, "t/F");
+    tree.Branch("E_Beam", &e_beam, "E_Beam/F");
+    tree.Branch("M4Pi", &mass, "M4Pi/F");
+    tree.Branch("Weight", &weight, "Weight/F");
+
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::exponential_distribution<double> slope(5.0);
+    for (Long64_t i = 0; i < n_events; ++i)
+    {
+        t = 0.1 + slope(rng);
+        e_beam = 8.2 + 0.6 * uniform(rng);
+        mass = 1.0 + 0.5 * uniform(rng);
+        weight = uniform(rng) < 0.1 ? -0.5 : 1.0;
+        tree.Fill();
+    }
+    tree.Write();
+}
+
+// FSRoot tree with the beam, a recoil (1), and 4 meson particles (2-5). Every event has
+// 1 to 3 combinations, like a typical FSRoot tree
+void write_fsroot_file(
+    const std::string &path, Long64_t n_events, int compression, unsigned int seed)
+{
+    TFile f(path.c_str(), "RECREATE", "", compression);
+    TTree tree(FSROOT_TREE.c_str(), FSROOT_TREE.c_str());
+    // px, py, pz, E of the beam (index 0) and particles 1 - 5
+    std::vector<Double_t> momenta(24);
+    Double_t run = 30000, event = 0, chi2 = 0;
+    const char *components[] = {"Px", "Py", "Pz", "En"};
+    for (int p = 0; p < 6; ++p)
+    {
+        std::string suffix = p == 0 ? "PB" : "P" + std::to_string(p);
+        for (int c = 0; c < 4; ++c)
+        {
+            std::string name = components[c] + suffix;
+            tree.Branch(name.c_str(), &momenta[4 * p + c], (name + "/D").c_str());
+        }
+    }
+    tree.Branch("Run", &run, "Run/D");
+    tree.Branch("Event", &event, "Event/D");
+    tree.Branch("Chi2DOF", &chi2, "Chi2DOF/D");
+
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> momentum(0.0, 0.4);
+    const double masses[] = {0.938272, 0.139570, 0.139570, 0.134977, 0.134977};
+    Long64_t n_written = 0;
+    while (n_written < n_events)
+    {
+        ++event;
+        double beam_energy = 8.2 + 0.6 * uniform(rng);
+        int combos = 1 + static_cast<int>(3 * uniform(rng));
+        for (int c = 0; c < combos && n_written < n_events; ++c, ++n_written)
+        {
+            momenta[0] = momenta[1] = 0.0;
+            momenta[2] = momenta[3] = beam_energy;
+            for (int p = 1; p < 6; ++p)
+            {
+                double px = momentum(rng), py = momentum(rng),
+                       pz = 0.2 * beam_energy * uniform(rng);
+                momenta[4 * p] = px;
+                momenta[4 * p + 1] = py;
+                momenta[4 * p + 2] = pz;
+                momenta[4 * p + 3] =
+                    std::sqrt(px * px + py * py + pz * pz + masses[p - 1] * masses[p - 1]);
+            }
+            chi2 = 10.0 * uniform(rng);
+            tree.Fill();
+        }
+    }
+    tree.Write();
+}
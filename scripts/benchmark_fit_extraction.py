@@ -0,0 +1,229 @@
+"""Benchmark how the .fit extraction scales with the number of waves, reactions and files.
+
+For every combination of the requested sizes, synthetic .fit files are written with
+generate_fit_files.py and aggregated by extract_fit_results.cc, exactly as
+convert_to_csv.py would run it. Each run reports:
+    - files / second of the whole ROOT process
+    - the time of each phase: ROOT startup (including loading AmpTools), reading the
+      .fit files ahead, waiting for them to be read, parsing them, filling the
+      amplitude maps, evaluating the intensities and phase differences, and writing
+      the csv
+    - the peak resident memory of the ROOT process
+    - with --alloc-counter, the heap allocations per file of matching each file against
+      the cached amplitude structure. For files of the same model these are only the
+      copies of the name lists that AmpTools returns by value, since no maps are built
+
+The phase times come from the profile summary that extract_fit_results.cc prints when
+PYAMPPLOTS_PROFILE is set (see profiler.h). Results are printed as a table, and can be
+saved as a csv to compare before and after a change.
+"""
+
+import argparse
+import csv
+import itertools
+import os
+import re
+import subprocess
+import tempfile
+import time
+
+import numpy as np
+
+from generate_fit_files import write_fit_file
+
+PHASES = [
+    "startup",
+    "read",
+    "wait_read",
+    "load",
+    "match_schema",
+    "fill_maps",
+    "intensity",
+    "phase_diff",
+    "write",
+]
+
+
+def main(args: dict) -> None:
+    if not os.environ.get("ROOTSYS"):
+        raise EnvironmentError(
+            "ROOTSYS path is not loaded. Make sure to run 'source setup_gluex.csh'\n"
+        )
+
+    rng = np.random.default_rng(args["seed"])
+    results = []
+    for waves, reactions, files in itertools.product(
+        args["waves"], args["reactions"], args["files"]
+    ):
+        with tempfile.TemporaryDirectory() as directory:
+            fit_files = []
+            for i in range(files):
+                fit_files.append(os.path.join(directory, f"synthetic_{i}.fit"))
+                write_fit_file(fit_files[-1], waves, reactions, rng)
+            result = run_extraction(fit_files, directory, args["alloc_counter"])
+        result.update({"waves": waves, "reactions": reactions, "files": files})
+        results.append(result)
+        print_result(result, header=len(results) == 1)
+
+    if args["output"]:
+        with open(args["output"], "w", newline="") as csv_file:
+            writer = csv.DictWriter(csv_file, fieldnames=list(results[0].keys()))
+            writer.writeheader()
+            writer.writerows(results)
+        print(f"Results saved to {args['output']}")
+
+    return
+
+
+def run_extraction(fit_files: list, directory: str, alloc_counter: str) -> dict:
+    """Run extract_fit_results.cc on the files and measure it
+
+    Args:
+        fit_files (list): paths of the .fit files
+        directory (str): scratch directory for the file list and output csv
+        alloc_counter (str): path of the built alloc_counter.c shim to preload, or ""
+
+    Returns:
+        dict: wall time, files per second, phase times, steady state allocations per
+            file, and peak RSS of the run
+    """
+    list_path = os.path.join(directory, "files.txt")
+    csv_path = os.path.join(directory, "fits.csv")
+    with open(list_path, "w") as list_file:
+        list_file.write("\n".join(fit_files))
+
+    script_dir = os.path.dirname(os.path.abspath(__file__))
+    command = [
+        "root",
+        "-n",
+        "-l",
+        "-b",
+        "-q",
+        "loadAmpTools.C",
+        f'{script_dir}/extract_fit_results.cc("{list_path}", "{csv_path}", 0)',
+    ]
+
+    env = dict(os.environ, PYAMPPLOTS_PROFILE="1")
+    if alloc_counter:
+        env["LD_PRELOAD"] = os.path.abspath(alloc_counter)
+
+    start = time.perf_counter()
+    proc = subprocess.Popen(
+        command,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT,
+        text=True,
+        env=env,
+    )
+    output = proc.stdout.read()
+    # wait4 gives the resource usage of this process alone, where ru_maxrss is in kB
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.perf_counter() - start
+    if os.waitstatus_to_exitcode(status) != 0:
+        raise RuntimeError(f"ROOT macro failed:\n{output}")
+
+    # rows of the profile summary are: phase, calls, wall [s], cpu [s], allocations
+    phases, allocations = {}, {}
+    for phase in PHASES:
+        match = re.search(
+            rf"^{phase}\s+\d+\s+(\S+)\s+\S+\s+(\S+)", output, re.MULTILINE
+        )
+        if not match:
+            raise RuntimeError(f"No '{phase}' time in the ROOT output:\n{output}")
+        phases[phase] = float(match.group(1))
+        allocations[phase] = float(match.group(2)) if match.group(2) != "-" else np.nan
+
+    # every file must make it into the csv, or the timing is of the wrong work. This is
+    # also the check that FitResults can load the layout of generate_fit_files.py
+    with open(csv_path, "r") as csv_file:
+        rows = sum(1 for _ in csv_file) - 1
+    if rows != len(fit_files):
+        rejected = [
+            line for line in output.splitlines() if line.startswith("Invalid fit")
+        ]
+        raise RuntimeError(
+            f"AmpTools only loaded {rows} of {len(fit_files)} generated .fit files, so"
+            " the layout of generate_fit_files.py doesn't match your AmpTools version."
+            " Compare one of them with a .fit file of your own fits.\n"
+            + "\n".join(rejected[:5])
+        )
+
+    result = {"wall_s": wall, "files_per_s": len(fit_files) / wall}
+    result.update({f"{phase}_s": phases[phase] for phase in PHASES})
+    result["steady_allocs_per_file"] = allocations["match_schema"] / len(fit_files)
+    result["peak_rss_mb"] = usage.ru_maxrss / 1024
+    return result
+
+
+def print_result(result: dict, header: bool) -> None:
+    """Print one benchmark result as a row of a fixed width table
+
+    Args:
+        result (dict): result of run_extraction, with the waves, reactions and files
+        header (bool): also print the column names before the row
+    """
+    columns = ["waves", "reactions", "files", "files_per_s"]
+    columns += [f"{phase}_s" for phase in PHASES]
+    columns += ["steady_allocs_per_file", "peak_rss_mb"]
+    if header:
+        print("".join(f"{column:>13}" for column in columns))
+    print(
+        "".join(
+            (
+                f"{result[column]:>13}"
+                if isinstance(result[column], int)
+                else f"{result[column]:>13.4g}"
+            )
+            for column in columns
+        )
+    )
+
+    return
+
+
+def parse_args() -> dict:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument(
+        "-w",
+        "--waves",
+        type=int,
+        nargs="+",
+        default=[4, 8, 16, 32],
+        help="Numbers of eJPmL waves to benchmark. Defaults to 4 8 16 32",
+    )
+    parser.add_argument(
+        "-r",
+        "--reactions",
+        type=int,
+        nargs="+",
+        default=[1, 4],
+        help="Numbers of reactions to benchmark. Defaults to 1 4",
+    )
+    parser.add_argument(
+        "-n",
+        "--files",
+        type=int,
+        nargs="+",
+        default=[10, 100],
+        help="Numbers of .fit files to benchmark. Defaults to 10 100",
+    )
+    parser.add_argument(
+        "-o", "--output", default="", help="Optional csv file to save the results to"
+    )
+    parser.add_argument(
+        "--seed", type=int, default=0, help="Random seed for the generated .fit files"
+    )
+    parser.add_argument(
+        "--alloc-counter",
+        default="",
+        help=(
+            "Path of alloc_counter.so, built from alloc_counter.c, to count the heap"
+            " allocations of each phase"
+        ),
+    )
+    return vars(parser.parse_args())
+
+
+if __name__ == "__main__":
+    args = parse_args()
+    main(args)
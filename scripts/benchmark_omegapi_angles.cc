@@ -0,0 +1,178 @@
+/* Throughput benchmark of the batched omega pi0 angle kernel (omegapi_angles.h)
+
+Generates n_events gamma p -> omega pi0 p, omega -> pi+ pi- pi0 phase space events,
+then times compute_omegapi_angles against a per-event TLorentzVector implementation of
+the same angles. Both run on a single thread, so the printed events / second are per
+core. The largest difference between the two is printed as a correctness check, with
+the azimuthal angles compared modulo 2 pi.
+
+Example, compiled so the kernel is vectorized (see omegapi_angles.h):
+    root -l -b -q -e 'gSystem->SetFlagsOpt("-O3 -fno-math-errno")' \
+        'scripts/benchmark_omegapi_angles.cc+(1000000)'
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "omegapi_angles.h"
+
+const double BEAM_ENERGY = 8.5;
+const double POLARIZATION_ANGLE = 45.0;
+
+// four-vectors of one generated event, in the AmpTools omegapi order
+struct OmegaPiEvent
+{
+    TLorentzVector beam, recoil, bachelor, omega_pi0, pi_plus, pi_minus;
+};
+
+// forward declarations
+std::vector<OmegaPiEvent> generate_events(int n_events);
+std::vector<double> reference_angles(const OmegaPiEvent &event, double polarization_angle);
+double angle_difference(double a, double b, bool periodic);
+
+void benchmark_omegapi_angles(int n_events = 1000000)
+{
+    std::vector<OmegaPiEvent> events = generate_events(n_events);
+
+    // load all the batches up front, so only the kernel itself is timed
+    size_t n_batches = (n_events + OmegaPiBatch::SIZE - 1) / OmegaPiBatch::SIZE;
+    std::vector<OmegaPiBatch> batches(n_batches);
+    for (int i = 0; i < n_events; ++i)
+    {
+        OmegaPiBatch &batch = batches[i / OmegaPiBatch::SIZE];
+        size_t j = batch.n++;
+        const OmegaPiEvent &event = events[i];
+        const TLorentzVector *vectors[] = {
+            &event.beam,      &event.recoil,  &event.bachelor,
+            &event.omega_pi0, &event.pi_plus, &event.pi_minus};
+        FourVectorColumns *columns[] = {
+            &batch.beam,      &batch.recoil,  &batch.bachelor,
+            &batch.omega_pi0, &batch.pi_plus, &batch.pi_minus};
+        for (size_t p = 0; p < 6; ++p)
+        {
+            columns[p]->set(
+                j, vectors[p]->Px(), vectors[p]->Py(), vectors[p]->Pz(), vectors[p]->E());
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto &batch : batches)
+    {
+        compute_omegapi_angles(batch, POLARIZATION_ANGLE);
+    }
+    std::chrono::duration<double> batched_time = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::vector<double>> reference(n_events);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_events; ++i)
+    {
+        reference[i] = reference_angles(events[i], POLARIZATION_ANGLE);
+    }
+    std::chrono::duration<double> reference_time = std::chrono::steady_clock::now() - start;
+
+    double max_difference = 0.0;
+    for (int i = 0; i < n_events; ++i)
+    {
+        const OmegaPiBatch &batch = batches[i / OmegaPiBatch::SIZE];
+        size_t j = i % OmegaPiBatch::SIZE;
+        std::vector<double> batched = {
+            batch.cos_theta[j], batch.phi[j], batch.cos_theta_h[j], batch.phi_h[j],
+            batch.big_phi[j]};
+        for (size_t k = 0; k < batched.size(); ++k)
+        {
+            bool azimuthal = k != 0 && k != 2;
+            max_difference = std::max(
+                max_difference, angle_difference(batched[k], reference[i][k], azimuthal));
+        }
+    }
+
+    std::cout << "events:               " << n_events << "\n"
+              << "batched   events/s:   " << n_events / batched_time.count() << "\n"
+              << "reference events/s:   " << n_events / reference_time.count() << "\n"
+              << "speedup:              " << reference_time.count() / batched_time.count()
+              << "\n"
+              << "max difference:       " << max_difference << "\n";
+}
+
+// gamma p -> p pi0 omega phase space at a fixed omega mass, then omega -> pi0 pi+ pi-
+std::vector<OmegaPiEvent> generate_events(int n_events)
+{
+    const double m_proton = 0.938272, m_pi0 = 0.134977, m_pi = 0.139570,
+                 m_omega = 0.78266;
+    TLorentzVector beam(0.0, 0.0, BEAM_ENERGY, BEAM_ENERGY);
+    TLorentzVector target(0.0, 0.0, 0.0, m_proton);
+    TLorentzVector initial = beam + target;
+    double production_masses[] = {m_proton, m_pi0, m_omega};
+    double decay_masses[] = {m_pi0, m_pi, m_pi};
+
+    TGenPhaseSpace production, decay;
+    production.SetDecay(initial, 3, production_masses);
+    std::vector<OmegaPiEvent> events(n_events);
+    for (auto &event : events)
+    {
+        // unweighted events are not needed to time the kernel
+        production.Generate();
+        event.beam = beam;
+        event.recoil = *production.GetDecay(0);
+        event.bachelor = *production.GetDecay(1);
+        TLorentzVector omega = *production.GetDecay(2);
+        decay.SetDecay(omega, 3, decay_masses);
+        decay.Generate();
+        event.omega_pi0 = *decay.GetDecay(0);
+        event.pi_plus = *decay.GetDecay(1);
+        event.pi_minus = *decay.GetDecay(2);
+    }
+    return events;
+}
+
+// The angles of one event boosted with TLorentzVectors, as the omegapi amplitudes do
+std::vector<double> reference_angles(const OmegaPiEvent &event, double polarization_angle)
+{
+    TLorentzVector omega = event.omega_pi0 + event.pi_plus + event.pi_minus;
+    TLorentzVector resonance = omega + event.bachelor;
+    TVector3 to_resonance = -resonance.BoostVector();
+
+    TLorentzVector beam_res = event.beam, recoil_res = event.recoil, omega_res = omega;
+    TLorentzVector pi_plus = event.pi_plus, pi_minus = event.pi_minus;
+    for (TLorentzVector *v : {&beam_res, &recoil_res, &omega_res, &pi_plus, &pi_minus})
+    {
+        v->Boost(to_resonance);
+    }
+
+    TVector3 z = -recoil_res.Vect().Unit();
+    TVector3 y = beam_res.Vect().Cross(z).Unit();
+    TVector3 x = y.Cross(z);
+    TVector3 omega_unit = omega_res.Vect().Unit();
+    double cos_theta = omega_unit.Dot(z);
+    double phi = std::atan2(omega_unit.Dot(y), omega_unit.Dot(x));
+
+    TVector3 to_omega = -omega_res.BoostVector();
+    pi_plus.Boost(to_omega);
+    pi_minus.Boost(to_omega);
+    TVector3 z_h = omega_unit;
+    TVector3 y_h = z.Cross(z_h).Unit();
+    TVector3 x_h = y_h.Cross(z_h);
+    TVector3 normal = pi_plus.Vect().Cross(pi_minus.Vect()).Unit();
+    double cos_theta_h = normal.Dot(z_h);
+    double phi_h = std::atan2(normal.Dot(y_h), normal.Dot(x_h));
+
+    TVector3 eps(
+        std::cos(polarization_angle * M_PI / 180.0),
+        std::sin(polarization_angle * M_PI / 180.0), 0.0);
+    TVector3 y_lab = event.beam.Vect().Unit().Cross(-event.recoil.Vect().Unit()).Unit();
+    double big_phi =
+        std::atan2(y_lab.Dot(eps), event.beam.Vect().Unit().Dot(eps.Cross(y_lab)));
+
+    return {cos_theta, phi, cos_theta_h, phi_h, big_phi};
+}
+
+double angle_difference(double a, double b, bool periodic)
+{
+    double difference = std::abs(a - b);
+    if (periodic)
+        difference = std::min(difference, 2.0 * M_PI - difference);
+    return difference;
+}
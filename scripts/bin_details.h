@@ -0,0 +1,131 @@
+/* Per-bin details that are filled alongside the summary statistics
+
+Besides the csv summary row, a bin can optionally collect fine histograms of any
+branches (bin_histograms.h) and weighted angular moments of a pair of decay angles
+(angular_moments.h). All of them are filled in the same single pass over each file, and
+are mergeable so that multi-file bins and parallel processing work just like for the
+summary statistics.
+*/
+
+#ifndef BIN_DETAILS_H
+#define BIN_DETAILS_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "angular_moments.h"
+#include "bin_histograms.h"
+#include "bin_info.h"
+
+// What to fill for each bin besides the summary, as given to extract_bin_info
+struct DetailConfig
+{
+    std::vector<FineHistogram> histograms; // empty histograms, used as a template
+    int moment_l_max = -1;                 // < 0 disables the moments
+    std::string cos_theta_branch;
+    std::string phi_branch;
+
+    bool empty() const
+    {
+        return histograms.empty() && moment_l_max < 0;
+    }
+};
+
+struct DetailedBin
+{
+    BinAccumulator accumulator;
+    std::vector<FineHistogram> histograms;
+    MomentAccumulator moments;
+
+    void merge(DetailedBin &other)
+    {
+        accumulator.merge(other.accumulator);
+        moments.merge(other.moments);
+        for (size_t i = 0; i < histograms.size(); ++i)
+        {
+            histograms[i].merge(other.histograms[i]);
+        }
+    }
+};
+
+DetailedBin empty_detailed_bin(const DetailConfig &config)
+{
+    DetailedBin bin;
+    bin.histograms = config.histograms;
+    bin.moments = MomentAccumulator(config.moment_l_max);
+    return bin;
+}
+
+// Accumulate a flat tree file like process_flat_file, also filling the details
+DetailedBin process_flat_file_detailed(
+    const std::string &file, const std::string &mass_branch, const DetailConfig &config)
+{
+    DetailedBin result = empty_detailed_bin(config);
+
+    std::unique_ptr<TFile> f;
+    FlatTreeBranches branches;
+    TTree *tree = open_flat_tree(file, mass_branch, f, branches);
+
+    // a branch can only have one address, so the summary branches are reused whenever
+    // they are requested again, and every other branch is only bound once
+    std::vector<std::unique_ptr<ScalarBranch>> extra_branches;
+    std::map<std::string, const ScalarBranch *> sources = {
+        {"t", &branches.t},
+        {"E_Beam", &branches.e},
+        {mass_branch, &branches.m},
+        {"Weight", &branches.weight},
+    };
+    auto source = [&](const std::string &name)
+    {
+        if (sources.count(name))
+            return sources[name];
+        extra_branches.push_back(std::make_unique<ScalarBranch>());
+        if (!extra_branches.back()->bind(tree, name))
+        {
+            std::cout << "Branch " << name << " not found in file: " << file << "\n";
+            exit(1);
+        }
+        sources[name] = extra_branches.back().get();
+        return sources[name];
+    };
+
+    std::vector<const ScalarBranch *> histogram_sources;
+    for (const auto &h : result.histograms)
+    {
+        histogram_sources.push_back(source(h.branch));
+    }
+    const ScalarBranch *cos_theta = nullptr, *phi = nullptr;
+    if (config.moment_l_max >= 0)
+    {
+        cos_theta = source(config.cos_theta_branch);
+        phi = source(config.phi_branch);
+    }
+
+    profiler::ScopedPhase reading("read", false);
+    Long64_t n_entries = tree->GetEntries();
+    for (Long64_t entry = 0; entry < n_entries; ++entry)
+    {
+        tree->GetEntry(entry);
+        double weight = branches.weight.value();
+        if (weight == 0.0)
+            continue;
+        branches.fill(result.accumulator);
+        for (size_t i = 0; i < histogram_sources.size(); ++i)
+        {
+            result.histograms[i].fill(histogram_sources[i]->value(), weight);
+        }
+        if (cos_theta)
+        {
+            result.moments.fill(cos_theta->value(), phi->value(), weight);
+        }
+    }
+    result.moments.flush();
+    reading.stop();
+    profiler::count("events", n_entries);
+    profiler::count("bytes_read", f->GetBytesRead());
+    return result;
+}
+
+#endif // BIN_DETAILS_H
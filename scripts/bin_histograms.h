@@ -0,0 +1,172 @@
+/* Fine-binned weighted distributions of each bin, filled during the bin info pass
+
+The histograms are configured with a spec string of comma separated entries in the form
+"branch:n_bins:low:high", for example
+    "M4Pi:100:1.0:1.5,t:50:0.3:0.5,cosTheta:40:-1:1"
+Each histogram keeps the sum of weights and the sum of squared weights in every bin
+(the equivalent of TH1::Sumw2), including an underflow and an overflow bin.
+
+All histograms of all bins are written to one binary side file, so that plotting does
+not need to read the event data again. Everything is stored little-endian:
+    char[4]   magic "PAPH"
+    uint32    version (1)
+    uint32    number of bins, n_bins
+    uint32    number of histograms, n_hists
+    n_bins    x {uint32 length, char[length]} bin definitions, in csv row order
+    n_hists   x {uint32 length, char[length] branch, uint32 n_fine, double low, high}
+    n_bins    x n_hists x {double sumw[n_fine + 2], double sumw2[n_fine + 2]}
+Every bin's block has the same size, so the histograms of bin i can be read directly at
+(end of header) + i * (block size). See read_bin_histograms in analysis/utils.py.
+*/
+
+#ifndef BIN_HISTOGRAMS_H
+#define BIN_HISTOGRAMS_H
+
+#include <algorithm>
+#include <cctype>  // for std::isspace
+#include <cmath>
+#include <cstdint>
+#include <cstdlib> // for std::strtod
+#include <fstream>
+#include <iostream>
+#include <sstream> // for std::istringstream
+#include <string>
+#include <vector>
+
+#include "bin_info.h"
+
+struct FineHistogram
+{
+    std::string branch;
+    uint32_t n_fine = 0;
+    double low = 0.0;
+    double high = 0.0;
+    // index 0 is the underflow, and n_fine + 1 the overflow
+    std::vector<double> sumw;
+    std::vector<double> sumw2;
+
+    void fill(double x, double w)
+    {
+        size_t i;
+        if (x < low)
+            i = 0;
+        else if (x >= high)
+            i = n_fine + 1;
+        else // the min guards against rounding up at the upper edge
+            i = 1 + std::min<size_t>(
+                        static_cast<size_t>((x - low) / (high - low) * n_fine), n_fine - 1);
+        sumw[i] += w;
+        sumw2[i] += w * w;
+    }
+
+    void merge(const FineHistogram &other)
+    {
+        for (size_t i = 0; i < sumw.size(); ++i)
+        {
+            sumw[i] += other.sumw[i];
+            sumw2[i] += other.sumw2[i];
+        }
+    }
+};
+
+// Read a whole field of a spec as a finite number. Returns false if it isn't one
+bool parse_spec_number(const std::string &field, double &value)
+{
+    const char *start = field.c_str();
+    char *end = nullptr;
+    value = std::strtod(start, &end);
+    while (end != start && std::isspace(static_cast<unsigned char>(*end)))
+        ++end;
+    return end != start && *end == '\0' && std::isfinite(value);
+}
+
+// Parse the "branch:n_bins:low:high,..." spec string into empty histograms
+std::vector<FineHistogram> parse_histogram_specs(const std::string &specs)
+{
+    std::vector<FineHistogram> histograms;
+    std::istringstream entries(specs);
+    std::string entry;
+    while (std::getline(entries, entry, ','))
+    {
+        if (entry.find_first_not_of(" ") == std::string::npos)
+            continue;
+        FineHistogram h;
+        std::istringstream fields(entry);
+        std::string n_fine, low, high;
+        std::getline(fields >> std::ws, h.branch, ':');
+        double n_bins = 0.0;
+        bool is_valid = std::getline(fields, n_fine, ':') &&
+                        std::getline(fields, low, ':') && std::getline(fields, high) &&
+                        parse_spec_number(n_fine, n_bins) &&
+                        parse_spec_number(low, h.low) && parse_spec_number(high, h.high);
+        // the number of bins must be a positive whole number
+        if (!is_valid || n_bins < 1 || n_bins > 1e8 || n_bins != std::floor(n_bins) ||
+            h.high <= h.low)
+        {
+            std::cout << "Invalid histogram spec '" << entry
+                      << "', expected branch:n_bins:low:high\n";
+            exit(1);
+        }
+        for (const auto &other : histograms)
+        {
+            if (other.branch == h.branch)
+            {
+                std::cout << "Branch " << h.branch << " can only be histogrammed once\n";
+                exit(1);
+            }
+        }
+        h.n_fine = static_cast<uint32_t>(n_bins);
+        h.sumw.assign(h.n_fine + 2, 0.0);
+        h.sumw2.assign(h.n_fine + 2, 0.0);
+        histograms.push_back(h);
+    }
+    return histograms;
+}
+
+// Write the histograms of every bin to the binary side file described above
+void write_bin_histograms(
+    const std::string &file_name, const std::vector<std::string> &bin_vector,
+    const std::vector<std::vector<FineHistogram>> &bins)
+{
+    if (bins.empty())
+        return;
+    std::ofstream out(file_name, std::ios::binary);
+    auto write_u32 = [&](uint32_t value)
+    { out.write(reinterpret_cast<const char *>(&value), sizeof(value)); };
+    auto write_string = [&](const std::string &value)
+    {
+        write_u32(value.size());
+        out.write(value.data(), value.size());
+    };
+
+    const std::vector<FineHistogram> &layout = bins.front();
+    out.write("PAPH", 4);
+    write_u32(1);
+    write_u32(bins.size());
+    write_u32(layout.size());
+    for (const auto &bin : bin_vector)
+    {
+        write_string(bin);
+    }
+    for (const auto &h : layout)
+    {
+        write_string(h.branch);
+        write_u32(h.n_fine);
+        out.write(reinterpret_cast<const char *>(&h.low), sizeof(double));
+        out.write(reinterpret_cast<const char *>(&h.high), sizeof(double));
+    }
+    for (const auto &bin : bins)
+    {
+        for (const auto &h : bin)
+        {
+            out.write(
+                reinterpret_cast<const char *>(h.sumw.data()), h.sumw.size() * sizeof(double));
+            out.write(
+                reinterpret_cast<const char *>(h.sumw2.data()),
+                h.sumw2.size() * sizeof(double));
+        }
+    }
+    out.close();
+}
+
+#endif // BIN_HISTOGRAMS_H
@@ -0,0 +1,490 @@
+/* Core pieces shared by the bin information extraction macros
+
+A "bin" is one line of the input list. That line can be a single ROOT file, several
+whitespace separated ROOT files, and/or glob patterns, for example:
+    /path/to/mass_1.100-1.125/anglesOmegaPiAmplitude.root
+    /path/to/mass_1.125-1.150/run_0301*.root /path/to/mass_1.125-1.150/run_0302*.root
+Every file of a bin is read independently into a BinAccumulator, which only holds
+weighted sums and extrema, so the accumulators of each file can be merged into a single
+csv row afterwards. This avoids having to hadd a bin split over many files beforehand.
+
+The accumulated sums reproduce what the TH1 statistics gave us before:
+    events     = sum(w)
+    events_err = sqrt(sum(w^2))
+    avg        = sum(w*x) / sum(w)
+    rms        = sqrt(sum(w*x^2) / sum(w) - avg^2)
+The low / high edges are the extrema of the positively weighted events, rounded to the
+requested decimal place.
+*/
+
+#ifndef BIN_INFO_H
+#define BIN_INFO_H
+
+#include <glob.h> // for expanding wildcards in the bin definitions
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream> // for std::istringstream
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "ROOT/TSeq.hxx"
+#include "ROOT/TThreadExecutor.hxx"
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+#include "profiler.h"
+#include "results_table.h"
+
+// Weighted running sums of a single variable. Sums are mergeable, so any number of
+// partial results (files, entry ranges, ...) can be combined in any order
+struct WeightedStats
+{
+    double sumw = 0.0;
+    double sumw2 = 0.0;
+    double sumwx = 0.0;
+    double sumwx2 = 0.0;
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+
+    void fill(double x, double w)
+    {
+        sumw += w;
+        sumw2 += w * w;
+        sumwx += w * x;
+        sumwx2 += w * x * x;
+        // only positively weighted events define the edges, like the non-zero bin
+        // contents of a histogram did
+        if (w > 0)
+        {
+            min = std::min(min, x);
+            max = std::max(max, x);
+        }
+    }
+
+    void merge(const WeightedStats &other)
+    {
+        sumw += other.sumw;
+        sumw2 += other.sumw2;
+        sumwx += other.sumwx;
+        sumwx2 += other.sumwx2;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    // add another set of sums scaled by factor, used to weight up sampled subsets.
+    // Extrema are only kept for positive factors, as they cannot be subtracted
+    void add_scaled(const WeightedStats &other, double factor)
+    {
+        sumw += factor * other.sumw;
+        sumw2 += factor * other.sumw2;
+        sumwx += factor * other.sumwx;
+        sumwx2 += factor * other.sumwx2;
+        if (factor > 0)
+        {
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+        }
+    }
+
+    double mean() const
+    {
+        return sumw != 0.0 ? sumwx / sumw : 0.0;
+    }
+
+    double rms() const
+    {
+        if (sumw == 0.0)
+            return 0.0;
+        double variance = sumwx2 / sumw - mean() * mean();
+        return variance > 0.0 ? std::sqrt(variance) : 0.0;
+    }
+};
+
+// Everything needed to produce one csv row: the -t, E_beam, and mass statistics
+struct BinAccumulator
+{
+    WeightedStats t;
+    WeightedStats e;
+    WeightedStats m;
+    long long entries = 0;
+
+    void fill(double t_value, double e_value, double m_value, double weight)
+    {
+        t.fill(t_value, weight);
+        e.fill(e_value, weight);
+        m.fill(m_value, weight);
+        ++entries;
+    }
+
+    void merge(const BinAccumulator &other)
+    {
+        t.merge(other.t);
+        e.merge(other.e);
+        m.merge(other.m);
+        entries += other.entries;
+    }
+
+    void add_scaled(const BinAccumulator &other, double factor)
+    {
+        t.add_scaled(other.t, factor);
+        e.add_scaled(other.e, factor);
+        m.add_scaled(other.m, factor);
+    }
+};
+
+// Reads a numeric scalar branch as a double, whether it was stored as a floating point
+// or an integer type (like the Run and Event numbers). Must not be copied or moved once
+// bound, since the tree holds its address
+class ScalarBranch
+{
+public:
+    ScalarBranch() = default;
+    ScalarBranch(const ScalarBranch &) = delete;
+    ScalarBranch &operator=(const ScalarBranch &) = delete;
+
+    bool bind(TTree *tree, const std::string &name)
+    {
+        TLeaf *leaf = tree->GetLeaf(name.c_str());
+        if (!leaf)
+            return false;
+        std::string type_name = leaf->GetTypeName();
+        if (type_name == "Float_t")
+            type = FLOAT;
+        else if (type_name == "Double_t")
+            type = DOUBLE;
+        else if (type_name == "Int_t")
+            type = INT;
+        else if (type_name == "UInt_t")
+            type = UINT;
+        else if (type_name == "Long64_t")
+            type = LONG64;
+        else if (type_name == "ULong64_t")
+            type = ULONG64;
+        else
+        {
+            std::cout << "Unsupported type " << type_name << " of branch " << name << "\n";
+            return false;
+        }
+        tree->SetBranchStatus(name.c_str(), 1);
+        tree->SetBranchAddress(name.c_str(), static_cast<void *>(&buffer));
+        return true;
+    }
+
+    double value() const
+    {
+        switch (type)
+        {
+        case FLOAT:
+            return buffer.f;
+        case INT:
+            return buffer.i;
+        case UINT:
+            return buffer.u;
+        case LONG64:
+            return buffer.l;
+        case ULONG64:
+            return buffer.ul;
+        default:
+            return buffer.d;
+        }
+    }
+
+private:
+    enum Type
+    {
+        FLOAT,
+        DOUBLE,
+        INT,
+        UINT,
+        LONG64,
+        ULONG64
+    };
+    Type type = DOUBLE;
+    union
+    {
+        float f;
+        double d;
+        int i;
+        unsigned int u;
+        long long l;
+        unsigned long long ul;
+    } buffer = {};
+};
+
+// forward declarations
+std::vector<std::string> expand_bin_definition(const std::string &definition);
+
+// file path is a text file where each line defines one bin. Blank lines are skipped
+std::vector<std::string> read_bin_list(const std::string &file_path)
+{
+    std::vector<std::string> bin_vector;
+    std::ifstream infile(file_path);
+    std::string line;
+    while (std::getline(infile, line))
+    {
+        // trim surrounding whitespace
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos)
+            continue;
+        size_t last = line.find_last_not_of(" \t\r");
+        bin_vector.push_back(line.substr(first, last - first + 1));
+    }
+    return bin_vector;
+}
+
+// Split a bin definition into its ROOT files, expanding any glob patterns. Patterns
+// that match nothing are an error, since the bin would silently lose events otherwise
+std::vector<std::string> expand_bin_definition(const std::string &definition)
+{
+    std::vector<std::string> files;
+    std::istringstream tokens(definition);
+    std::string token;
+    while (tokens >> token)
+    {
+        if (token.find_first_of("*?[") == std::string::npos)
+        {
+            files.push_back(token);
+            continue;
+        }
+        glob_t matches;
+        if (glob(token.c_str(), 0, nullptr, &matches) != 0 || matches.gl_pathc == 0)
+        {
+            std::cout << "No files found matching pattern: " << token << "\n";
+            globfree(&matches);
+            exit(1);
+        }
+        // glob returns the matches sorted, keeping the file order reproducible
+        for (size_t i = 0; i < matches.gl_pathc; ++i)
+        {
+            files.push_back(matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+    }
+    return files;
+}
+
+// The branches of a flat 'kin' tree that are needed for the bin information
+struct FlatTreeBranches
+{
+    ScalarBranch t, e, m, weight;
+
+    bool bind(TTree *tree, const std::string &mass_branch)
+    {
+        // only read the branches we need
+        tree->SetBranchStatus("*", 0);
+        return t.bind(tree, "t") && e.bind(tree, "E_Beam") && m.bind(tree, mass_branch) &&
+               weight.bind(tree, "Weight");
+    }
+
+    // add the currently loaded entry to the accumulator
+    void fill(BinAccumulator &accumulator) const
+    {
+        // zero weight events never entered the weighted histograms either
+        if (weight.value() == 0.0)
+            return;
+        accumulator.fill(t.value(), e.value(), m.value(), weight.value());
+    }
+};
+
+// Open a flat tree file and bind its branches, exiting if anything is missing
+TTree *open_flat_tree(
+    const std::string &file, const std::string &mass_branch, std::unique_ptr<TFile> &f,
+    FlatTreeBranches &branches)
+{
+    f.reset(TFile::Open(file.c_str()));
+    TTree *tree = f ? f->Get<TTree>("kin") : nullptr;
+    if (!tree)
+    {
+        std::cout << "'kin' tree could not be opened in file: " << file << "\n";
+        exit(1);
+    }
+    if (!branches.bind(tree, mass_branch))
+    {
+        std::cout << "Missing one of the t, E_Beam, " << mass_branch
+                  << ", or Weight branches in file: " << file << "\n";
+        exit(1);
+    }
+    return tree;
+}
+
+// Accumulate a flat tree file, whose 'kin' tree holds t, E_Beam, mass_branch and Weight
+BinAccumulator process_flat_file(const std::string &file, const std::string &mass_branch)
+{
+    BinAccumulator accumulator;
+    std::unique_ptr<TFile> f;
+    FlatTreeBranches branches;
+    TTree *tree = open_flat_tree(file, mass_branch, f, branches);
+
+    // the accumulation is a few additions per entry, so this is all tree reading
+    profiler::ScopedPhase reading("read", false);
+    Long64_t n_entries = tree->GetEntries();
+    for (Long64_t entry = 0; entry < n_entries; ++entry)
+    {
+        tree->GetEntry(entry);
+        branches.fill(accumulator);
+    }
+    reading.stop();
+    profiler::count("events", n_entries);
+    profiler::count("bytes_read", f->GetBytesRead());
+
+    return accumulator;
+}
+
+// Run process_file over every file of every bin using n_threads (0 = all cores). The
+// results are returned per bin, in the order the files appear in the bin definition
+template <typename Result>
+std::vector<std::vector<Result>> process_bin_files(
+    const std::vector<std::string> &bin_vector,
+    const std::function<Result(const std::string &)> &process_file,
+    unsigned int n_threads)
+{
+    // flatten the bins into (bin index, file) tasks so that a bin with many files
+    // spreads over the threads just as well as many single file bins
+    std::vector<std::pair<size_t, std::string>> tasks;
+    for (size_t i = 0; i < bin_vector.size(); ++i)
+    {
+        for (const auto &file : expand_bin_definition(bin_vector[i]))
+        {
+            tasks.emplace_back(i, file);
+        }
+    }
+
+    auto profiled_file = [&](const std::string &file)
+    {
+        profiler::ScopedPhase phase("file", true, file);
+        profiler::count("files", 1);
+        return process_file(file);
+    };
+
+    profiler::ScopedPhase phase("process_files");
+    std::vector<Result> file_results;
+    if (n_threads == 1 || tasks.size() <= 1)
+    {
+        for (const auto &task : tasks)
+        {
+            file_results.push_back(profiled_file(task.second));
+        }
+    }
+    else
+    {
+        ROOT::EnableThreadSafety();
+        ROOT::TThreadExecutor pool(n_threads);
+        file_results = pool.Map(
+            [&](unsigned int i) { return profiled_file(tasks[i].second); },
+            ROOT::TSeqU(tasks.size()));
+    }
+    phase.stop();
+
+    std::vector<std::vector<Result>> bin_results(bin_vector.size());
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        bin_results[tasks[i].first].push_back(std::move(file_results[i]));
+    }
+    return bin_results;
+}
+
+// Process every file of every bin, and merge the per-file results into one
+// accumulator per bin
+std::vector<BinAccumulator> accumulate_bins(
+    const std::vector<std::string> &bin_vector,
+    const std::function<BinAccumulator(const std::string &)> &process_file,
+    unsigned int n_threads)
+{
+    // merge in file order so the summed values don't depend on thread scheduling
+    std::vector<BinAccumulator> bin_results;
+    for (const auto &file_results : process_bin_files(bin_vector, process_file, n_threads))
+    {
+        BinAccumulator accumulator;
+        for (const auto &file_result : file_results)
+        {
+            accumulator.merge(file_result);
+        }
+        bin_results.push_back(accumulator);
+    }
+    return bin_results;
+}
+
+double round_to_decimals(double value, int decimals)
+{
+    return std::round(value * std::pow(10, decimals)) / std::pow(10, decimals);
+}
+
+// csv header row, whose order matches the values written for each bin
+std::vector<std::string> bin_info_headers()
+{
+    return {
+        "file",
+        "t_low",
+        "t_high",
+        "t_center",
+        "t_avg",
+        "t_rms",
+        "e_low",
+        "e_high",
+        "e_center",
+        "e_avg",
+        "e_rms",
+        "m_low",
+        "m_high",
+        "m_center",
+        "m_avg",
+        "m_rms",
+        "events",
+        "events_err",
+    };
+}
+
+// A table with one row per bin, whose "file" column is the bin definition itself, and
+// the remaining headers as empty Float64 columns
+ResultsTable bin_table(
+    const std::vector<std::string> &bin_vector, const std::vector<std::string> &headers)
+{
+    ResultsTable table;
+    size_t file_column = table.add_column(headers.front(), ColumnType::Text);
+    for (size_t i = 1; i < headers.size(); ++i)
+    {
+        table.add_column(headers[i]);
+    }
+    table.append_rows(bin_vector.size());
+    for (size_t row = 0; row < bin_vector.size(); ++row)
+    {
+        table.set_text(file_column, row, bin_vector[row]);
+    }
+    return table;
+}
+
+// Fill the values of a bin's row. Round -t and E_beam edges to 2nd decimal, and the
+// mass edges to the third decimal (1 MeV)
+void fill_bin_values(ResultsTable &table, size_t row, const BinAccumulator &accumulator)
+{
+    table.set_float(table.column("events"), row, accumulator.m.sumw);
+    table.set_float(table.column("events_err"), row, std::sqrt(accumulator.m.sumw2));
+
+    const std::vector<std::tuple<std::string, const WeightedStats *, int>> variables = {
+        {"t", &accumulator.t, 2},
+        {"e", &accumulator.e, 2},
+        {"m", &accumulator.m, 3},
+    };
+    for (const auto &variable : variables)
+    {
+        const std::string &name = std::get<0>(variable);
+        const WeightedStats &stats = *std::get<1>(variable);
+        double low = round_to_decimals(stats.min, std::get<2>(variable));
+        double high = round_to_decimals(stats.max, std::get<2>(variable));
+        table.set_float(table.column(name + "_low"), row, low);
+        table.set_float(table.column(name + "_high"), row, high);
+        table.set_float(table.column(name + "_center"), row, (high + low) / 2.0);
+        table.set_float(table.column(name + "_avg"), row, stats.mean());
+        table.set_float(table.column(name + "_rms"), row, stats.rms());
+    }
+}
+
+#endif // BIN_INFO_H
@@ -0,0 +1,99 @@
+/* Bin keys, which tell the data bin that a fit result belongs to
+
+Fits of a binned analysis are usually kept in one directory per bin, named after the
+bin's edges, like
+    /path/to/mass_1.100-1.125/best.fit
+    /path/to/tbin_0.1-0.2/mass_1.100-1.125/rand_3.fit
+Every directory of a path that looks like "name_low-high" is an edge range of the bin,
+where the first letter of the name picks the variable it bins: t for -t, e for E_beam,
+and m for the mass (so "mass", "m4pi", and "ebeam" are all fine). The key of a file
+is made of all its edge ranges, with the numbers written in a standard way, so
+"mass_1.1-1.125" and "mass_1.100-1.125" are the same bin. Paths without any edge range
+fall back to the name of the file's directory.
+
+A data bin can either get the key of its own files' directories, or be matched by its
+measured edges to the edge ranges of the fits' directories, which doesn't need the data
+files to be kept in the same directories as the fits.
+*/
+
+#ifndef BIN_KEYS_H
+#define BIN_KEYS_H
+
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The low and high edge of one binned variable, which is 't', 'e', or 'm', or 0 when
+// the name of the range doesn't start with any of those
+struct EdgeRange
+{
+    char variable = 0;
+    double low = 0.0;
+    double high = 0.0;
+};
+
+struct BinKey
+{
+    std::string name;
+    std::vector<EdgeRange> ranges;
+};
+
+// Read a "name_low-high" directory name. Returns false if it isn't one
+bool parse_edge_range(std::string_view component, EdgeRange &range, std::string &name)
+{
+    size_t underscore = component.rfind('_');
+    if (underscore == 0 || underscore == std::string_view::npos ||
+        !std::isalpha(static_cast<unsigned char>(component.front())))
+        return false;
+
+    // both edges must be complete unsigned numbers
+    std::string edges(component.substr(underscore + 1));
+    if (edges.empty() || !std::isdigit(static_cast<unsigned char>(edges.front())))
+        return false;
+    char *end = nullptr;
+    range.low = std::strtod(edges.c_str(), &end);
+    if (*end != '-' || !std::isdigit(static_cast<unsigned char>(end[1])))
+        return false;
+    range.high = std::strtod(end + 1, &end);
+    if (*end != '\0')
+        return false;
+
+    char first = std::tolower(static_cast<unsigned char>(component.front()));
+    range.variable = (first == 't' || first == 'e' || first == 'm') ? first : 0;
+    std::ostringstream standard;
+    standard << component.substr(0, underscore) << "_" << range.low << "-" << range.high;
+    name = standard.str();
+    return true;
+}
+
+// The key of a file, from the edge ranges of the directories it is in
+BinKey directory_bin_key(const std::string &file)
+{
+    BinKey key;
+    std::filesystem::path directory = std::filesystem::path(file).parent_path();
+    for (const auto &component : directory)
+    {
+        EdgeRange range;
+        std::string name;
+        if (!parse_edge_range(component.string(), range, name))
+            continue;
+        key.name += (key.name.empty() ? "" : "/") + name;
+        key.ranges.push_back(range);
+    }
+    if (key.ranges.empty())
+        key.name = directory.filename().string();
+    return key;
+}
+
+// Whether a bin with the measured [low, high] edges fits inside of a range, up to the
+// tolerance of rounding the measured edges
+bool is_within(const EdgeRange &range, double low, double high, double tolerance)
+{
+    return low >= range.low - tolerance && high <= range.high + tolerance;
+}
+
+#endif // BIN_KEYS_H
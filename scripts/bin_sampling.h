@@ -0,0 +1,259 @@
+/* Approximate bin information from a random sample of each tree
+
+Reading every event is more than needed when previewing binning schemes, so here each
+file is split into sampling units (its clusters, which are subdivided further if a tree
+only has a handful of them) and a simple random sample of those units is read. Whole
+units are read rather than the first N entries, so the preview stays unbiased even when
+the files are ordered by run or kinematics, and only the baskets of the chosen units
+have to be decompressed.
+
+Every file is a stratum. The sums of a bin are estimated by weighting up each file's
+sampled units by (units in file) / (units sampled), which is an unbiased estimate of the
+full sums. The uncertainties of the estimated events, averages and RMSs come from a
+stratified delete-one-unit jackknife with a finite population correction, so fully read
+files do not contribute any sampling uncertainty. They are reported as the half-width of
+a 95% confidence interval in the extra "_ci" columns.
+*/
+
+#ifndef BIN_SAMPLING_H
+#define BIN_SAMPLING_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bin_info.h"
+
+// units are only subdivided down to this many entries, so each stays a cheap sequential
+// read, and trees with fewer clusters than MIN_SAMPLING_UNITS get their clusters split
+const Long64_t MIN_UNIT_ENTRIES = 1000;
+const size_t MIN_SAMPLING_UNITS = 256;
+
+// two sided 95% confidence level
+const double CONFIDENCE_Z = 1.96;
+
+// The sampled units of a single file, kept separately for the jackknife
+struct SampledFile
+{
+    std::vector<BinAccumulator> units;
+    size_t n_units_total = 0;
+    Long64_t entries_read = 0;
+    Long64_t entries_total = 0;
+};
+
+// Split the tree into [first, last) entry ranges following its cluster boundaries
+std::vector<std::pair<Long64_t, Long64_t>> sampling_units(TTree *tree)
+{
+    std::vector<std::pair<Long64_t, Long64_t>> clusters;
+    Long64_t n_entries = tree->GetEntries();
+    TTree::TClusterIterator cluster_it = tree->GetClusterIterator(0);
+    Long64_t first;
+    while ((first = cluster_it.Next()) < n_entries)
+    {
+        clusters.emplace_back(first, std::min(cluster_it.GetNextEntry(), n_entries));
+    }
+    if (clusters.empty() || clusters.size() >= MIN_SAMPLING_UNITS)
+        return clusters;
+
+    // too few clusters to sample from, so split each one into equal entry blocks
+    size_t splits = (MIN_SAMPLING_UNITS + clusters.size() - 1) / clusters.size();
+    std::vector<std::pair<Long64_t, Long64_t>> units;
+    for (const auto &cluster : clusters)
+    {
+        Long64_t size = cluster.second - cluster.first;
+        Long64_t n_blocks = std::max<Long64_t>(
+            1, std::min<Long64_t>(splits, size / MIN_UNIT_ENTRIES));
+        for (Long64_t i = 0; i < n_blocks; ++i)
+        {
+            units.emplace_back(
+                cluster.first + size * i / n_blocks,
+                cluster.first + size * (i + 1) / n_blocks);
+        }
+    }
+    return units;
+}
+
+// Read a random fraction of the tree's sampling units. fill_range is called with the
+// [first, last) entries of each chosen unit, and fills that unit's accumulator. A
+// fraction >= 1 reads all
+SampledFile sample_tree(
+    TTree *tree, double fraction, unsigned int seed,
+    const std::function<void(Long64_t, Long64_t, BinAccumulator &)> &fill_range)
+{
+    SampledFile result;
+    std::vector<std::pair<Long64_t, Long64_t>> units = sampling_units(tree);
+    result.n_units_total = units.size();
+    result.entries_total = tree->GetEntries();
+
+    // at least 2 units are needed for a jackknife estimate of the variance
+    size_t n_sampled = std::min(
+        units.size(),
+        std::max<size_t>(2, static_cast<size_t>(std::ceil(fraction * units.size()))));
+
+    std::vector<size_t> order(units.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937_64 rng(seed);
+    std::shuffle(order.begin(), order.end(), rng);
+    order.resize(n_sampled);
+    // read the chosen units front to back, which is friendlier to the file cache
+    std::sort(order.begin(), order.end());
+
+    for (size_t i : order)
+    {
+        BinAccumulator unit;
+        fill_range(units[i].first, units[i].second, unit);
+        result.entries_read += units[i].second - units[i].first;
+        result.units.push_back(unit);
+    }
+    profiler::count("events", result.entries_read);
+    profiler::count("bytes_read", tree->GetCurrentFile()->GetBytesRead());
+    return result;
+}
+
+// Seed for one file, so the same files are sampled the same way regardless of the
+// order in which threads pick them up
+unsigned int file_seed(const std::string &file, unsigned int seed)
+{
+    return static_cast<unsigned int>(std::hash<std::string>{}(file)) ^ seed;
+}
+
+// Sample a flat tree file, see process_flat_file
+SampledFile sample_flat_file(
+    const std::string &file, const std::string &mass_branch, double fraction,
+    unsigned int seed)
+{
+    std::unique_ptr<TFile> f;
+    FlatTreeBranches branches;
+    TTree *tree = open_flat_tree(file, mass_branch, f, branches);
+    return sample_tree(
+        tree, fraction, file_seed(file, seed),
+        [&](Long64_t first, Long64_t last, BinAccumulator &unit)
+        {
+            for (Long64_t entry = first; entry < last; ++entry)
+            {
+                tree->GetEntry(entry);
+                branches.fill(unit);
+            }
+        });
+}
+
+// Sum of each file's sampled units, weighted up to the full file
+BinAccumulator estimate_totals(const std::vector<SampledFile> &files)
+{
+    BinAccumulator totals;
+    for (const auto &file : files)
+    {
+        double factor = static_cast<double>(file.n_units_total) / file.units.size();
+        for (const auto &unit : file.units)
+        {
+            totals.add_scaled(unit, factor);
+        }
+    }
+    return totals;
+}
+
+// The quantities that get a confidence interval, in the order of the "_ci" headers
+std::vector<double> sampled_quantities(const BinAccumulator &totals)
+{
+    return {
+        totals.m.sumw,
+        totals.t.mean(),
+        totals.t.rms(),
+        totals.e.mean(),
+        totals.e.rms(),
+        totals.m.mean(),
+        totals.m.rms(),
+    };
+}
+
+// csv header row for sampled bins, which adds the sampling columns to bin_info_headers
+std::vector<std::string> sampled_bin_info_headers()
+{
+    std::vector<std::string> headers = bin_info_headers();
+    headers.insert(
+        headers.end(),
+        {
+            "sample_fraction",
+            "events_ci",
+            "t_avg_ci",
+            "t_rms_ci",
+            "e_avg_ci",
+            "e_rms_ci",
+            "m_avg_ci",
+            "m_rms_ci",
+        });
+    return headers;
+}
+
+// Fill the values of a sampled bin's row, whose files are the strata of the estimate
+void fill_sampled_bin_values(
+    ResultsTable &table, size_t row, const std::vector<SampledFile> &files)
+{
+    BinAccumulator totals = estimate_totals(files);
+    fill_bin_values(table, row, totals);
+    std::vector<double> estimates = sampled_quantities(totals);
+
+    // stratified jackknife: drop one unit of a stratum at a time, and re-weight the
+    // remaining units of that stratum to the full file
+    std::vector<double> variances(estimates.size(), 0.0);
+    Long64_t entries_read = 0, entries_total = 0;
+    for (const auto &file : files)
+    {
+        entries_read += file.entries_read;
+        entries_total += file.entries_total;
+        size_t n = file.units.size();
+        if (n < 2 || n == file.n_units_total)
+            continue; // fully read, so there is no sampling uncertainty
+
+        BinAccumulator stratum;
+        for (const auto &unit : file.units)
+        {
+            stratum.merge(unit);
+        }
+        double N = file.n_units_total;
+        // totals with this stratum's contribution removed
+        BinAccumulator others = totals;
+        others.add_scaled(stratum, -N / n);
+
+        std::vector<std::vector<double>> replicates;
+        for (const auto &unit : file.units)
+        {
+            BinAccumulator replicate = others;
+            replicate.add_scaled(stratum, N / (n - 1));
+            replicate.add_scaled(unit, -N / (n - 1));
+            replicates.push_back(sampled_quantities(replicate));
+        }
+
+        double scale = (1.0 - n / N) * (n - 1.0) / n;
+        for (size_t q = 0; q < estimates.size(); ++q)
+        {
+            double mean = 0.0;
+            for (const auto &replicate : replicates)
+            {
+                mean += replicate[q] / n;
+            }
+            for (const auto &replicate : replicates)
+            {
+                variances[q] += scale * std::pow(replicate[q] - mean, 2);
+            }
+        }
+    }
+
+    table.set_float(
+        table.column("sample_fraction"), row,
+        entries_total > 0 ? static_cast<double>(entries_read) / entries_total : 0.0);
+    std::vector<std::string> headers = sampled_bin_info_headers();
+    std::vector<std::string> ci_headers(headers.end() - variances.size(), headers.end());
+    for (size_t q = 0; q < variances.size(); ++q)
+    {
+        table.set_float(
+            table.column(ci_headers[q]), row, CONFIDENCE_Z * std::sqrt(variances[q]));
+    }
+}
+
+#endif // BIN_SAMPLING_H
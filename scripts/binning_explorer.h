@@ -0,0 +1,187 @@
+/* Cumulative weighted sums of one variable, for evaluating many binnings at once
+
+The events are read once into a fine, fixed grid of n_fine bins over [x_min, x_max).
+The per-grid-bin sums of w, w^2, w*x and w*x^2 are then turned into prefix sums, so the
+yield, error, average and RMS of any bin [low, high) are a difference of two prefix
+entries, and evaluating a whole candidate binning is only a few microseconds regardless
+of the number of events. Candidate edges are snapped to the nearest grid edge, so the
+grid spacing should be well below the smallest bin width of interest.
+
+The x values are stored relative to the middle of the range, which keeps the prefix sums
+of w*x^2 small enough that differencing them does not lose the precision of narrow bins.
+*/
+
+#ifndef BINNING_EXPLORER_H
+#define BINNING_EXPLORER_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bin_info.h"
+
+class CumulativeBinning
+{
+public:
+    CumulativeBinning() = default;
+    CumulativeBinning(double x_min, double x_max, size_t n_fine)
+        : x_min(x_min), x_max(x_max), n_fine(n_fine), width((x_max - x_min) / n_fine),
+          x_ref((x_min + x_max) / 2.0), sumw(n_fine, 0.0), sumw2(n_fine, 0.0),
+          sumwx(n_fine, 0.0), sumwx2(n_fine, 0.0)
+    {
+    }
+
+    void fill(double x, double w)
+    {
+        // NaN or infinite values have no bin, and can't be cast to an index
+        if (!std::isfinite(x))
+            return;
+        if (x < x_min)
+        {
+            underflow.fill(x, w);
+            return;
+        }
+        double position = (x - x_min) / width;
+        if (!(position < static_cast<double>(n_fine)))
+        {
+            overflow.fill(x, w);
+            return;
+        }
+        size_t i = std::min(static_cast<size_t>(position), n_fine - 1);
+        double dx = x - x_ref;
+        sumw[i] += w;
+        sumw2[i] += w * w;
+        sumwx[i] += w * dx;
+        sumwx2[i] += w * dx * dx;
+    }
+
+    void merge(const CumulativeBinning &other)
+    {
+        for (size_t i = 0; i < n_fine; ++i)
+        {
+            sumw[i] += other.sumw[i];
+            sumw2[i] += other.sumw2[i];
+            sumwx[i] += other.sumwx[i];
+            sumwx2[i] += other.sumwx2[i];
+        }
+        underflow.merge(other.underflow);
+        overflow.merge(other.overflow);
+    }
+
+    // build the prefix sums. Must be called after the last fill / merge
+    void finalize()
+    {
+        prefix_w.assign(n_fine + 1, 0.0);
+        prefix_w2.assign(n_fine + 1, 0.0);
+        prefix_wx.assign(n_fine + 1, 0.0);
+        prefix_wx2.assign(n_fine + 1, 0.0);
+        for (size_t i = 0; i < n_fine; ++i)
+        {
+            prefix_w[i + 1] = prefix_w[i] + sumw[i];
+            prefix_w2[i + 1] = prefix_w2[i] + sumw2[i];
+            prefix_wx[i + 1] = prefix_wx[i] + sumwx[i];
+            prefix_wx2[i + 1] = prefix_wx2[i] + sumwx2[i];
+        }
+    }
+
+    // grid edge index closest to x, clamped to the grid
+    size_t edge_index(double x) const
+    {
+        double i = std::round((x - x_min) / width);
+        if (std::isnan(i))
+            return 0;
+        return static_cast<size_t>(std::clamp(i, 0.0, static_cast<double>(n_fine)));
+    }
+
+    double edge_value(size_t i) const
+    {
+        return x_min + i * width;
+    }
+
+    // statistics of the bin [low, high), whose min / max are the snapped bin edges
+    WeightedStats query(double low, double high) const
+    {
+        size_t a = edge_index(low), b = edge_index(high);
+        WeightedStats stats;
+        stats.sumw = prefix_w[b] - prefix_w[a];
+        stats.sumw2 = prefix_w2[b] - prefix_w2[a];
+        double shifted_wx = prefix_wx[b] - prefix_wx[a];
+        double shifted_wx2 = prefix_wx2[b] - prefix_wx2[a];
+        // undo the shift by x_ref only after differencing
+        stats.sumwx = shifted_wx + x_ref * stats.sumw;
+        stats.sumwx2 = shifted_wx2 + 2 * x_ref * shifted_wx + x_ref * x_ref * stats.sumw;
+        stats.min = edge_value(a);
+        stats.max = edge_value(b);
+        return stats;
+    }
+
+    // n_bins edges between low and high that split the weighted events equally
+    std::vector<double> equal_statistics_edges(double low, double high, size_t n_bins) const
+    {
+        size_t a = edge_index(low), b = edge_index(high);
+        double total = prefix_w[b] - prefix_w[a];
+        std::vector<double> edges = {edge_value(a)};
+        size_t i = a;
+        for (size_t k = 1; k < n_bins; ++k)
+        {
+            // weights can be negative after sideband subtraction, so the prefix is
+            // not guaranteed to be sorted and a forward scan is used instead of bisection
+            double target = prefix_w[a] + total * k / n_bins;
+            while (i < b && prefix_w[i] < target)
+                ++i;
+            edges.push_back(edge_value(i));
+        }
+        edges.push_back(edge_value(b));
+        return edges;
+    }
+
+    const WeightedStats &get_underflow() const { return underflow; }
+    const WeightedStats &get_overflow() const { return overflow; }
+
+private:
+    double x_min = 0.0;
+    double x_max = 0.0;
+    size_t n_fine = 0;
+    double width = 0.0;
+    double x_ref = 0.0;
+    std::vector<double> sumw, sumw2, sumwx, sumwx2;
+    std::vector<double> prefix_w, prefix_w2, prefix_wx, prefix_wx2;
+    WeightedStats underflow, overflow;
+};
+
+// Fill the cumulative binning with one branch of a flat 'kin' tree file
+CumulativeBinning process_flat_file_cumulative(
+    const std::string &file, const std::string &branch, double x_min, double x_max,
+    size_t n_fine)
+{
+    CumulativeBinning binning(x_min, x_max, n_fine);
+
+    std::unique_ptr<TFile> f(TFile::Open(file.c_str()));
+    TTree *tree = f ? f->Get<TTree>("kin") : nullptr;
+    if (!tree)
+    {
+        std::cout << "'kin' tree could not be opened in file: " << file << "\n";
+        exit(1);
+    }
+    tree->SetBranchStatus("*", 0);
+    ScalarBranch x, weight;
+    if (!x.bind(tree, branch) || !weight.bind(tree, "Weight"))
+    {
+        std::cout << "Missing the " << branch << " or Weight branch in file: " << file
+                  << "\n";
+        exit(1);
+    }
+
+    Long64_t n_entries = tree->GetEntries();
+    for (Long64_t entry = 0; entry < n_entries; ++entry)
+    {
+        tree->GetEntry(entry);
+        if (weight.value() == 0.0)
+            continue;
+        binning.fill(x.value(), weight.value());
+    }
+    return binning;
+}
+
+#endif // BINNING_EXPLORER_H
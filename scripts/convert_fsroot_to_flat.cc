@@ -0,0 +1,223 @@
+/* Convert an FSRoot tree into the flat 'kin' tree that AmpTools and extract_bin_info.cc
+read
+
+The output follows the AmpTools ROOTDataReader four-vector layout
+    E_Beam, Px_Beam, Py_Beam, Pz_Beam
+    NumFinalState
+    E_FinalState[NumFinalState], Px_FinalState[...], Py_FinalState[...], Pz_FinalState[...]
+    Weight
+where the final state is the recoil particle followed by the meson_indices particles, in
+the order they are given. The summary branches t (|t| of the meson system) and
+mass_branch (the meson invariant mass) are added, so the output can also be given
+straight to extract_bin_info.cc. FSRoot entries are unweighted, so every Weight is 1.
+
+The particles are read with the same single pass FSRoot reader as
+extract_bin_info_fsroot.cc (see fsroot_bin_info.h), including the best_combo selection
+of one combination per event. The input tree is split into entry ranges along its
+cluster boundaries, and each range is converted by its own thread into a
+TBufferMerger file. Every thread hands its baskets to the merger in batches of
+FLUSH_ENTRIES entries, and the merger writes them to the output file, so no thread has
+to wait on a shared output tree. The entries of different ranges can end up in any
+order, which does not matter for fits or the bin info.
+
+Example:
+    root -l -b -q 'scripts/convert_fsroot_to_flat.cc("tree.root", "flat.root", "ntFSGlueX_100_112", "1", "2,3,4,5", "M4Pi")'
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread> // for std::thread::hardware_concurrency
+#include <utility>
+#include <vector>
+
+#include "ROOT/TBufferMerger.hxx"
+#include "fsroot_bin_info.h"
+
+// entries each thread buffers before passing a cluster of baskets on to the merger
+const Long64_t FLUSH_ENTRIES = 100000;
+// basket size of the output branches in bytes, large enough to hold a full cluster
+const Int_t BASKET_SIZE = 512000;
+
+// Branch buffers of the AmpTools flat tree
+struct KinTreeWriter
+{
+    Float_t e_beam, px_beam, py_beam, pz_beam;
+    Int_t n_final_state;
+    std::vector<Float_t> e_final_state, px_final_state, py_final_state, pz_final_state;
+    Float_t t, mass, weight = 1.0;
+
+    void bind(TTree *kin, size_t n_particles, const std::string &mass_branch)
+    {
+        n_final_state = n_particles;
+        for (auto *column :
+             {&e_final_state, &px_final_state, &py_final_state, &pz_final_state})
+        {
+            column->assign(n_particles, 0.0);
+        }
+        kin->Branch("E_Beam", &e_beam, "E_Beam/F", BASKET_SIZE);
+        kin->Branch("Px_Beam", &px_beam, "Px_Beam/F", BASKET_SIZE);
+        kin->Branch("Py_Beam", &py_beam, "Py_Beam/F", BASKET_SIZE);
+        kin->Branch("Pz_Beam", &pz_beam, "Pz_Beam/F", BASKET_SIZE);
+        kin->Branch("NumFinalState", &n_final_state, "NumFinalState/I", BASKET_SIZE);
+        kin->Branch(
+            "E_FinalState", e_final_state.data(), "E_FinalState[NumFinalState]/F",
+            BASKET_SIZE);
+        kin->Branch(
+            "Px_FinalState", px_final_state.data(), "Px_FinalState[NumFinalState]/F",
+            BASKET_SIZE);
+        kin->Branch(
+            "Py_FinalState", py_final_state.data(), "Py_FinalState[NumFinalState]/F",
+            BASKET_SIZE);
+        kin->Branch(
+            "Pz_FinalState", pz_final_state.data(), "Pz_FinalState[NumFinalState]/F",
+            BASKET_SIZE);
+        kin->Branch("Weight", &weight, "Weight/F", BASKET_SIZE);
+        kin->Branch("t", &t, "t/F", BASKET_SIZE);
+        kin->Branch(mass_branch.c_str(), &mass, (mass_branch + "/F").c_str(), BASKET_SIZE);
+    }
+
+    // fill one output entry for every entry of a computed batch
+    void fill(TTree *kin, const FSRootBatch &batch)
+    {
+        for (size_t i = 0; i < batch.n; ++i)
+        {
+            e_beam = batch.beam_en[i];
+            px_beam = batch.beam_px[i];
+            py_beam = batch.beam_py[i];
+            pz_beam = batch.beam_pz[i];
+            for (Int_t p = 0; p < n_final_state; ++p)
+            {
+                px_final_state[p] = batch.final_state[4 * p][i];
+                py_final_state[p] = batch.final_state[4 * p + 1][i];
+                pz_final_state[p] = batch.final_state[4 * p + 2][i];
+                e_final_state[p] = batch.final_state[4 * p + 3][i];
+            }
+            t = batch.t[i];
+            mass = batch.m[i];
+            kin->Fill();
+        }
+    }
+};
+
+// forward declarations
+std::vector<std::pair<Long64_t, Long64_t>> cluster_ranges(TTree *tree, size_t n_ranges);
+Long64_t convert_range(
+    const std::string &file_path, const std::string &nt, const std::string &recoil_index,
+    const std::string &meson_indices, const std::string &mass_branch,
+    const std::string &best_combo, Long64_t first, Long64_t last,
+    ROOT::TBufferMerger &merger);
+
+// n_threads = 0 uses all available cores, and 1 converts the tree serially
+void convert_fsroot_to_flat(
+    std::string file_path, std::string output_path, std::string nt,
+    std::string recoil_index, std::string meson_indices, std::string mass_branch = "M4Pi",
+    std::string best_combo = "", int n_threads = 0)
+{
+    std::string indices = "," + meson_indices + ",";
+    indices.erase(std::remove(indices.begin(), indices.end(), ' '), indices.end());
+    if (indices.find("," + recoil_index + ",") != std::string::npos)
+    {
+        std::cout << "The recoil particle " << recoil_index
+                  << " can not also be one of the meson particles\n";
+        exit(1);
+    }
+
+    // only used to plan the entry ranges, each thread opens the file on its own
+    std::unique_ptr<TFile> f;
+    FSRootReader reader;
+    TTree *tree = open_fsroot_tree(file_path, nt, meson_indices, f, reader);
+    unsigned int n_workers =
+        n_threads > 0 ? n_threads : std::max(1u, std::thread::hardware_concurrency());
+    // a few ranges per thread keeps the threads busy until the end
+    std::vector<std::pair<Long64_t, Long64_t>> ranges =
+        cluster_ranges(tree, n_workers == 1 ? 1 : 4 * n_workers);
+    f.reset();
+
+    ROOT::EnableThreadSafety();
+    ROOT::TBufferMerger merger(output_path.c_str());
+    auto convert = [&](unsigned int i)
+    {
+        return convert_range(
+            file_path, nt, recoil_index, meson_indices, mass_branch, best_combo,
+            ranges[i].first, ranges[i].second, merger);
+    };
+
+    std::vector<Long64_t> written;
+    if (n_workers == 1 || ranges.size() <= 1)
+    {
+        for (unsigned int i = 0; i < ranges.size(); ++i)
+        {
+            written.push_back(convert(i));
+        }
+    }
+    else
+    {
+        ROOT::TThreadExecutor pool(n_workers);
+        written = pool.Map(convert, ROOT::TSeqU(ranges.size()));
+    }
+
+    Long64_t n_written = 0;
+    for (Long64_t n : written)
+    {
+        n_written += n;
+    }
+    std::cout << "Wrote " << n_written << " entries to " << output_path << "\n";
+}
+
+// Group the tree's clusters into about n_ranges contiguous [first, last) entry ranges
+std::vector<std::pair<Long64_t, Long64_t>> cluster_ranges(TTree *tree, size_t n_ranges)
+{
+    Long64_t n_entries = tree->GetEntries();
+    Long64_t target = std::max<Long64_t>(1, n_entries / std::max<size_t>(1, n_ranges));
+
+    std::vector<std::pair<Long64_t, Long64_t>> ranges;
+    TTree::TClusterIterator cluster_it = tree->GetClusterIterator(0);
+    Long64_t first, range_start = 0;
+    while ((first = cluster_it.Next()) < n_entries)
+    {
+        Long64_t last = std::min(cluster_it.GetNextEntry(), n_entries);
+        if (last - range_start >= target || last == n_entries)
+        {
+            ranges.emplace_back(range_start, last);
+            range_start = last;
+        }
+    }
+    return ranges;
+}
+
+// Convert the events starting in entries [first, last) into a new merger file, returning
+// the number of entries written
+Long64_t convert_range(
+    const std::string &file_path, const std::string &nt, const std::string &recoil_index,
+    const std::string &meson_indices, const std::string &mass_branch,
+    const std::string &best_combo, Long64_t first, Long64_t last,
+    ROOT::TBufferMerger &merger)
+{
+    std::unique_ptr<TFile> f;
+    FSRootReader reader;
+    TTree *tree = open_fsroot_tree(file_path, nt, meson_indices, f, reader, best_combo);
+    if (!reader.bind_final_state(tree, recoil_index))
+    {
+        std::cout << "Could not read the recoil particle " << recoil_index
+                  << " from file: " << file_path << "\n";
+        exit(1);
+    }
+
+    std::shared_ptr<ROOT::TBufferMergerFile> out = merger.GetFile();
+    // owned by the merger file, which deletes it when closed
+    TTree *kin = new TTree("kin", "kin");
+    kin->SetDirectory(out.get());
+    kin->SetAutoFlush(FLUSH_ENTRIES);
+    KinTreeWriter writer;
+    writer.bind(kin, reader.final_state_columns() / 4, mass_branch);
+
+    scan_fsroot_range(
+        tree, reader, first, last,
+        [&](const FSRootBatch &batch) { writer.fill(kin, batch); });
+
+    Long64_t n_written = kin->GetEntries();
+    out->Write();
+    return n_written;
+}
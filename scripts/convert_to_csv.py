@@ -7,11 +7,20 @@ Behind the scenes, this script calls a ROOT macro for either situation.
 """
 
 import argparse
+import glob
 import os
 import re
 import subprocess
 import tempfile
 
+from sharded_extraction import run_sharded
+
+# .fit files, and .fitpack archives of them (see pack_fit_files.py)
+FIT_EXTENSIONS = (".fit", ".fitpack")
+
+# output of each file type when no --output is given
+DEFAULT_OUTPUTS = {"fit": "fits.csv", "root": "data.csv", "joined": "joined.csv"}
+
 
 def main(args: dict) -> None:
 
@@ -21,8 +30,17 @@ def main(args: dict) -> None:
             "ROOTSYS path is not loaded. Make sure to run 'source setup_gluex.csh'\n"
         )
 
-    if args["output"] and not args["output"].endswith(".csv"):
+    if not 0.0 < args["sample"] <= 1.0:
+        raise ValueError("--sample must be a fraction between 0 and 1")
+
+    if args["output"] and not args["output"].endswith(
+        (".csv", ".papt", ".sqlite", ".db")
+    ):
         args["output"] = args["output"] + ".csv"
+    if args["campaign"]:
+        if not args["output"].endswith((".sqlite", ".db")):
+            raise ValueError("--campaign needs an output ending in .sqlite or .db")
+        args["output"] += ":" + args["campaign"]
 
     # args["input"] can be a file containing a list of result files, so save the list of
     # files to input_files. Otherwise, input_files is just args["input"]
@@ -30,7 +48,7 @@ def main(args: dict) -> None:
     if (
         len(args["input"]) == 1
         and os.path.isfile(args["input"][0])
-        and not args["input"][0].endswith(".fit")
+        and not args["input"][0].endswith(FIT_EXTENSIONS)
         and not args["input"][0].endswith(".root")
     ):
         with open(args["input"][0], "r") as file:
@@ -38,22 +56,50 @@ def main(args: dict) -> None:
     else:
         input_files = args["input"]
 
-    # Check if all input files exist, and expand to its absolute path
+    # Check if all input files exist, and expand to its absolute path. A line of a list
+    # file may hold several whitespace separated files or glob patterns, which together
+    # make up one bin. Those are expanded here, and kept together on one line
     print("Checking if all input files exist...")
-    for file in input_files:
-        if not os.path.exists(file):
-            raise FileNotFoundError(f"The file {file} does not exist")
-        if not os.path.isabs(file):
-            input_files[input_files.index(file)] = os.path.abspath(file)
+    all_files = []
+    for i, entry in enumerate(input_files):
+        bin_files = []
+        for token in entry.split():
+            matches = sorted(glob.glob(token)) if glob.has_magic(token) else [token]
+            # a member of an archive exists if its archive does
+            archive = re.sub(r"(\.fitpack)/.*", r"\1", matches[0]) if matches else ""
+            if not matches or not os.path.exists(archive):
+                raise FileNotFoundError(f"The file {token} does not exist")
+            bin_files.extend(os.path.abspath(match) for match in matches)
+        input_files[i] = " ".join(bin_files)
+        all_files.extend(bin_files)
 
-    if all(file.endswith(".fit") for file in input_files):
+    if all(file.endswith(FIT_EXTENSIONS) for file in all_files):
+        if any(len(entry.split()) > 1 for entry in input_files):
+            raise ValueError("Multi-file bins are only supported for .root files")
         file_type = "fit"
-    elif all(file.endswith(".root") for file in input_files):
+    elif all(file.endswith(".root") for file in all_files):
         file_type = "root"
+    elif all(file.endswith(FIT_EXTENSIONS + (".root",)) for file in all_files):
+        # fits and data together are joined by their bin keys
+        if any(
+            len(entry.split()) > 1
+            and any(file.endswith(FIT_EXTENSIONS) for file in entry.split())
+            for entry in input_files
+        ):
+            raise ValueError("Multi-file bins are only supported for .root files")
+        if (
+            args["fsroot"]
+            or args["sample"] < 1.0
+            or args["histograms"]
+            or args["moments"] >= 0
+        ):
+            raise ValueError(
+                "Joined fit and data extraction only supports flat trees, without"
+                " sampling, histograms, or moments"
+            )
+        file_type = "joined"
     else:
-        raise ValueError(
-            "All input files must be of the same type: either .fit or .root files"
-        )
+        raise ValueError("All input files must be either .fit or .root files")
 
     # sort the input files
     input_files = (
@@ -68,8 +114,36 @@ def main(args: dict) -> None:
             print(f"\t{file}")
         return
 
-    # get the script directory to properly call the script with the right path
-    script_dir = os.path.dirname(os.path.abspath(__file__))
+    output_file_name = args["output"] or DEFAULT_OUTPUTS[file_type]
+    if args["workers"] > 1:
+        if file_type == "joined" or args["histograms"]:
+            raise ValueError(
+                "--workers does not support joined extraction or histograms, which"
+                " need all files in one process"
+            )
+        if not output_file_name.endswith(".csv"):
+            raise ValueError("--workers only supports .csv output")
+        # the cores are shared by the workers, rather than used by each of them
+        if args["threads"] == 0:
+            args["threads"] = max(1, (os.cpu_count() or 1) // args["workers"])
+
+        # the workers write every column of their fits, and the merge keeps those of a
+        # serial run. They read every file only when they print its name, so that a
+        # crash is blamed on the right file
+        worker_args = dict(args, prefetch=0)
+        run_sharded(
+            input_files,
+            lambda list_path, csv_path: root_command(
+                worker_args, file_type, list_path, csv_path, is_union_schema=True
+            ),
+            output_file_name,
+            args["workers"],
+            varying_columns=file_type == "fit",
+            union_schema=args["union_schema"],
+            announces_files=file_type == "fit",
+            verbose=args["verbose"],
+        )
+        return
 
     # hand off the files to the macro as a tempfile, where each file is on a newline
     # this seems to improve the speed of subprocess.Popen
@@ -78,36 +152,7 @@ def main(args: dict) -> None:
         temp_file_path = temp_file.name
     print(f"Temp file created at {temp_file_path}")
 
-    # convert this flag into bool integers for the ROOT macro to interpret
-    is_acceptance_corrected = 1 if args["acceptance_corrected"] else 0
-
-    # setup ROOT command with appropriate arguments
-    package = ""
-    if file_type == "fit":
-        output_file_name = "fits.csv" if not args["output"] else args["output"]
-        command = (
-            f'{script_dir}/extract_fit_results.cc("{temp_file_path}",'
-            f' "{output_file_name}", {is_acceptance_corrected})'
-        )
-        package = "loadAmpTools.C"
-    elif file_type == "root":
-        output_file_name = "data.csv" if not args["output"] else args["output"]
-        if args["fsroot"]:
-            command = (
-                f'{script_dir}/extract_bin_info_fsroot.cc("{temp_file_path}",'
-                f" \"{output_file_name}\", \"{args['tree_name']}\","
-                f" \"{args['meson_index']}\")\n "
-            )
-            package = "$FSROOT/rootlogon.FSROOT.C"
-        else:
-            command = (
-                f'{script_dir}/extract_bin_info.cc("{temp_file_path}",'
-                f" \"{output_file_name}\", \"{args['mass_branch']}\")"
-            )
-    else:
-        raise ValueError("Invalid type. Must be either 'fit' or 'root'")
-
-    command = ["root", "-n", "-l", "-b", "-q", package, command]
+    command = root_command(args, file_type, temp_file_path, output_file_name)
 
     print("Running ROOT macro...")
     # call the ROOT macro
@@ -133,6 +178,72 @@ def main(args: dict) -> None:
     return
 
 
+def root_command(
+    args: dict,
+    file_type: str,
+    list_path: str,
+    output_file_name: str,
+    is_union_schema: bool = False,
+) -> list:
+    """The ROOT command that runs the extraction macro of a file type
+
+    Args:
+        args (dict): parsed arguments of this script
+        file_type (str): "fit", "root", or "joined"
+        list_path (str): text file listing the input files, one per line
+        output_file_name (str): file the macro writes
+        is_union_schema (bool, optional): write every column of the .fit files, even
+            without --union-schema. Defaults to False.
+
+    Returns:
+        list: the command and its arguments, for subprocess
+    """
+    # get the script directory to properly call the script with the right path
+    script_dir = os.path.dirname(os.path.abspath(__file__))
+
+    # convert these flags into bool integers for the ROOT macro to interpret
+    is_acceptance_corrected = 1 if args["acceptance_corrected"] else 0
+    is_union_schema = 1 if args["union_schema"] or is_union_schema else 0
+
+    # setup ROOT command with appropriate arguments
+    package = ""
+    if file_type == "fit":
+        command = (
+            f'{script_dir}/extract_fit_results.cc("{list_path}",'
+            f' "{output_file_name}", {is_acceptance_corrected},'
+            f' "{args["amplitude_grammar"]}", {is_union_schema}, {args["prefetch"]})'
+        )
+        package = "loadAmpTools.C"
+    elif file_type == "root":
+        if args["fsroot"]:
+            command = (
+                f'{script_dir}/extract_bin_info_fsroot.cc("{list_path}",'
+                f" \"{output_file_name}\", \"{args['tree_name']}\","
+                f" \"{args['meson_index']}\", {args['sample']}, {args['seed']},"
+                f" {args['threads']}, \"{args['best_combo']}\")\n "
+            )
+        else:
+            command = (
+                f'{script_dir}/extract_bin_info.cc("{list_path}",'
+                f" \"{output_file_name}\", \"{args['mass_branch']}\","
+                f" {args['threads']}, {args['sample']}, {args['seed']},"
+                f" \"{args['histograms']}\", \"{args['histogram_output']}\","
+                f" {args['moments']}, \"{args['moment_angles']}\")"
+            )
+    elif file_type == "joined":
+        command = (
+            f'{script_dir}/extract_joined_results.cc("{list_path}",'
+            f' "{output_file_name}", {is_acceptance_corrected},'
+            f" \"{args['mass_branch']}\", \"{args['key_source']}\", {args['threads']},"
+            f' "{args["amplitude_grammar"]}", {is_union_schema})'
+        )
+        package = "loadAmpTools.C"
+    else:
+        raise ValueError("Invalid type. Must be either 'fit' or 'root'")
+
+    return ["root", "-n", "-l", "-b", "-q", package, command]
+
+
 def parse_args() -> dict:
     parser = argparse.ArgumentParser(description=__doc__)
     parser.add_argument(
@@ -140,7 +251,11 @@ def parse_args() -> dict:
         "--input",
         help=(
             "Input file(s). Also accepts path(s) with a wildcard '*' and finds all"
-            " matching files. Can also accept a file containing a list of files"
+            " matching files. Can also accept a file containing a list of files. For"
+            " ROOT data files, a line of that list may contain several whitespace"
+            " separated files or wildcard patterns, which are combined into one bin."
+            " Passing both .fit and .root files writes one joined table, see"
+            " --key-source"
         ),
         nargs="+",
     )
@@ -165,7 +280,24 @@ def parse_args() -> dict:
         ),
     )
     parser.add_argument(
-        "-o", "--output", default="", help="File name of output .csv file"
+        "-o",
+        "--output",
+        default="",
+        help=(
+            "File name of output .csv file. A name ending in .papt writes a binary"
+            " columnar file instead, see analysis.utils.read_results_table, and a"
+            " name ending in .sqlite or .db adds a campaign to a SQLite database"
+        ),
+    )
+    parser.add_argument(
+        "--campaign",
+        type=str,
+        default="",
+        help=(
+            "Name of the campaign to write into a .sqlite/.db output, replacing one of"
+            " the same name. Defaults to the name of the extraction script. Read it"
+            " back with analysis.utils.read_campaign"
+        ),
     )
     parser.add_argument(
         "-a",
@@ -177,6 +309,63 @@ def parse_args() -> dict:
             " False, or the 'reconstructed' values"
         ),
     )
+    parser.add_argument(
+        "--amplitude-grammar",
+        type=str,
+        default="",
+        help=(
+            "Grammar of the amplitude names in the .fit files, describing where each"
+            " eJPmL quantum number is, e.g. 'J{J:[0-9]+}_M{m:[-0-9]+}_refl{e:[+-]}'."
+            " See scripts/amplitude_names.h for the syntax. Defaults to '', which uses"
+            " the standard eJPmL format"
+        ),
+    )
+    parser.add_argument(
+        "--prefetch",
+        type=int,
+        default=8,
+        help=(
+            "Number of .fit files to read ahead into memory on a separate thread, while"
+            " the current file is parsed. Hides the latency of network filesystems."
+            " Defaults to 8, and 0 reads each file only when it is parsed"
+        ),
+    )
+    parser.add_argument(
+        "-w",
+        "--workers",
+        type=int,
+        default=1,
+        help=(
+            "Number of ROOT processes that extract shards of the sorted input list at"
+            " once, into a merged csv in the same order. A file that crashes its"
+            " worker is quarantined and listed in '<output>.quarantine.txt', and the"
+            " rest of its shard is extracted again. Not supported for joined"
+            " extraction or histograms. Defaults to 1, a single process"
+        ),
+    )
+    parser.add_argument(
+        "--union-schema",
+        action="store_true",
+        help=(
+            "When passed, the csv of .fit files has the columns of every file, so fits"
+            " with different amplitudes can be combined, and the values a file doesn't"
+            " have are left empty. Defaults to False, where the columns are those of"
+            " the first file"
+        ),
+    )
+    parser.add_argument(
+        "--key-source",
+        type=str,
+        choices=["directory", "edges"],
+        default="directory",
+        help=(
+            "When .fit and .root files are given together, each fit is joined to the"
+            " data bin with the same key, taken from directory names like"
+            " 'mass_1.100-1.125'. 'directory' reads the data bin's key from its own"
+            " directories, and 'edges' matches its measured edges to the fits'"
+            " directories instead. Defaults to 'directory'"
+        ),
+    )
     parser.add_argument(
         "-m",
         "--mass-branch",
@@ -188,6 +377,72 @@ def parse_args() -> dict:
             " create csv's for ROOT data files. Defaults to M4Pi"
         ),
     )
+    parser.add_argument(
+        "-j",
+        "--threads",
+        type=int,
+        default=0,
+        help=(
+            "Number of threads used to read the ROOT data files. Defaults to 0, which"
+            " uses all available cores"
+        ),
+    )
+    parser.add_argument(
+        "--sample",
+        type=float,
+        default=1.0,
+        help=(
+            "Fraction of each ROOT data file to read, for quickly previewing binning"
+            " schemes. A random subset of the file's clusters is read, and the csv"
+            " values become estimates with additional '_ci' columns holding their 95%%"
+            " confidence intervals. Defaults to 1.0, which reads every event"
+        ),
+    )
+    parser.add_argument(
+        "--seed",
+        type=int,
+        default=0,
+        help="Random seed used to choose the sampled clusters when using --sample",
+    )
+    parser.add_argument(
+        "--histograms",
+        type=str,
+        default="",
+        help=(
+            "Fine histograms to fill for each bin of non-FSRoot data files, as comma"
+            " separated 'branch:n_bins:low:high' entries, e.g."
+            " 'M4Pi:100:1.0:1.5,t:50:0.3:0.5'. They are written to a binary file that"
+            " can be read with analysis.utils.read_bin_histograms"
+        ),
+    )
+    parser.add_argument(
+        "--histogram-output",
+        type=str,
+        default="",
+        help=(
+            "File name of the binary histogram file. Defaults to the output csv name"
+            " with '_hists.bin' in place of its extension"
+        ),
+    )
+    parser.add_argument(
+        "--moments",
+        type=int,
+        default=-1,
+        help=(
+            "Maximum L of the weighted spherical harmonic moments of the decay angles"
+            " to add as csv columns for non-FSRoot data files. Defaults to -1, which"
+            " disables them"
+        ),
+    )
+    parser.add_argument(
+        "--moment-angles",
+        type=str,
+        default="cosTheta,phi",
+        help=(
+            "Comma separated names of the cos(theta) and phi branches used for the"
+            " moments. Defaults to 'cosTheta,phi'"
+        ),
+    )
     parser.add_argument(
         "-p",
         "--preview",
@@ -226,6 +481,16 @@ def parse_args() -> dict:
             " FSRoot formatted data files"
         ),
     )
+    parser.add_argument(
+        "--best-combo",
+        type=str,
+        default="",
+        help=(
+            "Branch used to keep only the best combination of each event in FSRoot"
+            " files, where the entry with the lowest value is kept, e.g. 'Chi2DOF'."
+            " Defaults to '', which keeps every combination"
+        ),
+    )
     return vars(parser.parse_args())
 
 
@@ -0,0 +1,169 @@
+/* Compare many candidate binnings of one variable from a single pass over the events
+
+Instead of re-running the bin extraction for every candidate bin width, the events are
+read once into a fine cumulative structure (see binning_explorer.h), and each candidate
+binning is then evaluated from it in microseconds.
+
+The input list uses the same format as extract_bin_info.cc, but its files are not
+expected to be cut into bins already. Every file of every line is read and combined.
+
+The schemes file lists one candidate binning per line, as a name, a type, and its
+arguments. Lines starting with '#' are ignored:
+    w25     uniform  1.0 1.5 0.025          # low, high, bin width
+    eq20    equal    1.0 1.5 20             # low, high, bins with equal statistics
+    custom  edges    1.0 1.1 1.15 1.2 1.5   # explicit bin edges
+
+The csv file will have one row per bin of every scheme, with columns for:
+    - The scheme name and bin index
+    - The low and high bin edges, snapped to the fine grid, and the bin center
+    - The average and RMS of the variable in the bin
+    - The number of events and its error
+
+NOTE:
+Like extract_bin_info.cc, this assumes the flat trees hold a Weight branch used for
+sideband subtraction. Events outside [x_min, x_max) are reported as a summary only.
+ */
+
+#include <chrono>
+#include <fstream> // for reading the schemes
+#include <iostream>
+#include <sstream> // for std::istringstream
+#include <string>
+#include <vector>
+
+#include "bin_info.h"
+#include "binning_explorer.h"
+#include "results_table.h"
+
+// forward declarations
+std::vector<std::pair<std::string, std::vector<double>>> read_schemes(
+    const std::string &schemes_path, const CumulativeBinning &binning);
+
+void explore_binning(
+    std::string file_path, std::string schemes_path, std::string csv_name,
+    std::string branch, double x_min, double x_max, int n_fine = 20000,
+    int n_threads = 0)
+{
+    // read the events once, in parallel over all files
+    std::vector<std::string> bin_vector = read_bin_list(file_path);
+    std::function<CumulativeBinning(const std::string &)> process_file =
+        [&](const std::string &file)
+    { return process_flat_file_cumulative(file, branch, x_min, x_max, n_fine); };
+
+    CumulativeBinning binning(x_min, x_max, n_fine);
+    for (const auto &file_results : process_bin_files(bin_vector, process_file, n_threads))
+    {
+        for (const auto &file_result : file_results)
+        {
+            binning.merge(file_result);
+        }
+    }
+    binning.finalize();
+
+    std::cout << "Events below " << x_min << ": " << binning.get_underflow().sumw
+              << ", above " << x_max << ": " << binning.get_overflow().sumw << "\n";
+
+    // evaluate every scheme, timing only the queries
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::string, std::vector<double>>> schemes =
+        read_schemes(schemes_path, binning);
+    std::vector<std::vector<WeightedStats>> results;
+    size_t n_queries = 0;
+    for (const auto &scheme : schemes)
+    {
+        const std::vector<double> &edges = scheme.second;
+        std::vector<WeightedStats> scheme_results;
+        for (size_t i = 0; i + 1 < edges.size(); ++i)
+        {
+            scheme_results.push_back(binning.query(edges[i], edges[i + 1]));
+        }
+        n_queries += scheme_results.size();
+        results.push_back(scheme_results);
+    }
+    double elapsed = std::chrono::duration<double, std::micro>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cout << "Evaluated " << schemes.size() << " schemes (" << n_queries
+              << " bins) in " << elapsed << " microseconds\n";
+
+    ResultsTable table;
+    table.set_metadata("extractor", "explore_binning");
+    table.set_metadata("branch", branch);
+    const size_t scheme_column = table.add_column("scheme", ColumnType::Text);
+    const size_t bin_column = table.add_column("bin", ColumnType::Int64);
+    std::vector<size_t> value_columns;
+    for (const char *name :
+         {"x_low", "x_high", "x_center", "x_avg", "x_rms", "events", "events_err"})
+    {
+        value_columns.push_back(table.add_column(name));
+    }
+    for (size_t s = 0; s < schemes.size(); ++s)
+    {
+        size_t first = table.append_rows(results[s].size());
+        for (size_t i = 0; i < results[s].size(); ++i)
+        {
+            const WeightedStats &stats = results[s][i];
+            const double values[] = {
+                stats.min,    stats.max,   (stats.min + stats.max) / 2.0,
+                stats.mean(), stats.rms(), stats.sumw, std::sqrt(stats.sumw2)};
+            table.set_text(scheme_column, first + i, schemes[s].first);
+            table.set_int(bin_column, first + i, i);
+            for (size_t v = 0; v < value_columns.size(); ++v)
+            {
+                table.set_float(value_columns[v], first + i, values[v]);
+            }
+        }
+    }
+    write_results(table, csv_name);
+}
+
+// Parse the schemes file into (name, edges) pairs. Equal statistics edges need the
+// filled binning, which is why it is passed in
+std::vector<std::pair<std::string, std::vector<double>>> read_schemes(
+    const std::string &schemes_path, const CumulativeBinning &binning)
+{
+    std::vector<std::pair<std::string, std::vector<double>>> schemes;
+    std::ifstream infile(schemes_path);
+    std::string line;
+    while (std::getline(infile, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string name, type;
+        if (!(tokens >> name >> type))
+            continue;
+
+        std::vector<double> args;
+        double arg;
+        while (tokens >> arg)
+        {
+            args.push_back(arg);
+        }
+
+        std::vector<double> edges;
+        if (type == "uniform" && args.size() == 3 && args[2] > 0)
+        {
+            size_t n_bins = static_cast<size_t>(std::round((args[1] - args[0]) / args[2]));
+            for (size_t i = 0; i <= n_bins; ++i)
+            {
+                edges.push_back(args[0] + i * args[2]);
+            }
+        }
+        else if (type == "equal" && args.size() == 3 && args[2] >= 1)
+        {
+            edges = binning.equal_statistics_edges(
+                args[0], args[1], static_cast<size_t>(args[2]));
+        }
+        else if (type == "edges" && args.size() >= 2)
+        {
+            edges = args;
+        }
+        else
+        {
+            std::cout << "Invalid binning scheme: " << line << "\n";
+            exit(1);
+        }
+        schemes.emplace_back(name, edges);
+    }
+    return schemes;
+}
@@ -5,171 +5,168 @@ The csv file will have columns for:
     - The center, average, and RMS values for the t, E_beam, and mass histograms
     - The total number of events and the error on the total number of events
 
+Each line of the input list defines one bin, and can either be a single ROOT file, or
+several whitespace separated files and/or glob patterns that together make up the bin
+(see bin_info.h). Files are processed in parallel and merged into a single row per bin,
+so bins split across many run periods do not need to be hadd'ed first.
+
+When sample_fraction < 1, only a random subset of each file's clusters is read and the
+values are estimates, for quickly previewing binning schemes. The csv then also has the
+read fraction of entries, and 95% confidence intervals on the events, averages, and RMS
+values (see bin_sampling.h).
+
+Fine-binned weighted histograms of any branches can be filled in the same pass by
+passing a spec string like "M4Pi:100:1.0:1.5,t:50:0.3:0.5" as histograms. They are
+written to a binary side file next to the csv (see bin_histograms.h for its layout), and
+are only filled when every event is read, i.e. not in sampling mode.
+
+Likewise, passing moment_l_max >= 0 accumulates the weighted spherical harmonic moments
+H(L,M) = sum w * Y_LM(theta, phi) for L <= moment_l_max and 0 <= M <= L, with their
+errors, and adds them as "Y_L_M" columns (see angular_moments.h). The decay angles are
+read from the cos(theta) and phi (in radians) branches named in moment_angles.
+
+Set the PYAMPPLOTS_PROFILE environment variable to get the time spent on each file and
+on reading the trees, along with the events and bytes read (see profiler.h).
+
+A csv_name ending in ".papt" writes the same table as a binary columnar file instead,
+which analysis/utils.py can read without parsing any text (see results_table.h).
+
 NOTE:
 This script assumes that the original Flat Tree data files have been cut to their
-respective bin, and that they contain the t, E_beam, and Weight branches. The 
-Weight branch is used for sideband subtraction, and so if a separate "background" file 
+respective bin, and that they contain the t, E_beam, and Weight branches. The
+Weight branch is used for sideband subtraction, and so if a separate "background" file
 is used, then it will need to be implemented here.
  */
 
-#include <cmath>   // for power function
-#include <fstream> // for writing csv
+// guarded, since extract_joined_results.cc includes this macro
+#ifndef EXTRACT_BIN_INFO_CC
+#define EXTRACT_BIN_INFO_CC
+
 #include <iostream>
 #include <sstream> // for std::istringstream
 #include <string>
 #include <vector>
 
-// forward declarations
-std::pair<double, double> get_hist_edges(TH1D *h, int round_to_decimals);
+#include "bin_details.h"
+#include "bin_info.h"
+#include "bin_sampling.h"
+#include "profiler.h"
 
-void extract_bin_info(std::string file_path, std::string csv_name, std::string mass_branch)
+// forward declarations
+ResultsTable bin_info_table(
+    const std::vector<std::string> &bin_vector, const std::string &mass_branch,
+    int n_threads = 0, double sample_fraction = 1.0, unsigned int seed = 0,
+    const std::string &histograms = "", const std::string &histogram_file = "",
+    int moment_l_max = -1, const std::string &moment_angles = "cosTheta,phi");
+
+// n_threads = 0 uses all available cores, and 1 processes the files serially
+void extract_bin_info(
+    std::string file_path, std::string csv_name, std::string mass_branch,
+    int n_threads = 0, double sample_fraction = 1.0, unsigned int seed = 0,
+    std::string histograms = "", std::string histogram_file = "", int moment_l_max = -1,
+    std::string moment_angles = "cosTheta,phi")
 {
-    // file path is a text file with a list of ROOT files, each on a newline
-    std::vector<std::string> file_vector;
-    std::ifstream infile(file_path);
-    std::string line;
-    while (std::getline(infile, line))
-    {
-        file_vector.push_back(line);
-    }
+    profiler::Session session("extract_bin_info");
 
-    // Define header row and corresponding values
-    std::vector<std::string> headers = {
-        "file",
-        "t_low",
-        "t_high",
-        "t_center",
-        "t_avg",
-        "t_rms",
-        "e_low",
-        "e_high",
-        "e_center",
-        "e_avg",
-        "e_rms",
-        "m_low",
-        "m_high",
-        "m_center",
-        "m_avg",
-        "m_rms",
-        "events",
-        "events_err",
-    };
-    std::vector<std::map<std::string, double>> values;
-
-    for (const auto &file : file_vector)
-    {
-        std::map<std::string, double> value_map;
-        // grab the file and tree
-        std::unique_ptr<TFile> f(TFile::Open(file.c_str()));
-        TTree *tree = f->Get<TTree>("kin");
-        if (!tree)
-        {
-            std::cout << "'kin' tree could not be opened in file: " << file << "\n";
-            exit(1);
-        }
+    // file path is a text file with a list of bins, each on a newline
+    std::vector<std::string> bin_vector = read_bin_list(file_path);
 
-        TCanvas *c1 = new TCanvas("c1", "c1", 1800, 1800);
-
-        // Assign histograms. These are required to get the mean and rms values
-        tree->Draw("t>>h_t", "Weight");
-        TH1D *h_t = (TH1D *)gPad->GetPrimitive("h_t");
-        tree->Draw("E_Beam>>h_e", "Weight");
-        TH1D *h_e = (TH1D *)gPad->GetPrimitive("h_e");
-        tree->Draw((mass_branch + ">>h_m").c_str(), "Weight");
-        TH1D *h_m = (TH1D *)gPad->GetPrimitive("h_m");
-
-        // Fill the map. Round -t and E_beam to 2nd decimal, and the mass values to
-        // the third decimal (1 MeV)
-        double bin_contents_error;
-        value_map["events"] = h_m->IntegralAndError(0, h_m->GetNbinsX() + 1, bin_contents_error);
-        value_map["events_err"] = bin_contents_error;
-
-        double t_low, t_high;
-        std::tie(t_low, t_high) = get_hist_edges(h_t, 2);
-        value_map["t_low"] = t_low;
-        value_map["t_high"] = t_high;
-        value_map["t_center"] = (t_high + t_low) / 2.0;
-        value_map["t_avg"] = h_t->GetMean();
-        value_map["t_rms"] = h_t->GetRMS();
-
-        double e_low, e_high;
-        std::tie(e_low, e_high) = get_hist_edges(h_e, 2);
-        value_map["e_low"] = e_low;
-        value_map["e_high"] = e_high;
-        value_map["e_center"] = (e_high + e_low) / 2.0;
-        value_map["e_avg"] = h_e->GetMean();
-        value_map["e_rms"] = h_e->GetRMS();
-
-        double m_low, m_high;
-        std::tie(m_low, m_high) = get_hist_edges(h_m, 3);
-        value_map["m_low"] = m_low;
-        value_map["m_high"] = m_high;
-        value_map["m_center"] = (m_high + m_low) / 2.0;
-        value_map["m_avg"] = h_m->GetMean();
-        value_map["m_rms"] = h_m->GetRMS();
-
-        values.push_back(value_map);
-
-        // Clean up
-        delete h_t;
-        delete h_e;
-        delete h_m;
-        delete c1;
+    // default to the output name, with its extension swapped
+    if (!histograms.empty() && histogram_file.empty())
+    {
+        histogram_file = csv_name.substr(0, csv_name.rfind('.')) + "_hists.bin";
     }
 
-    // open csv file for writing
-    std::ofstream csv_file;
-    csv_file.open(csv_name);
+    ResultsTable table = bin_info_table(
+        bin_vector, mass_branch, n_threads, sample_fraction, seed, histograms,
+        histogram_file, moment_l_max, moment_angles);
+    write_results(table, csv_name);
+}
 
-    // Write the header line
-    for (size_t i = 0; i < headers.size(); ++i)
+// The table of extract_bin_info, with one row per bin. The histograms are still
+// written to histogram_file. This is the whole extraction without the csv, which
+// analysis/extraction.py calls from Python
+ResultsTable bin_info_table(
+    const std::vector<std::string> &bin_vector, const std::string &mass_branch,
+    int n_threads, double sample_fraction, unsigned int seed,
+    const std::string &histograms, const std::string &histogram_file, int moment_l_max,
+    const std::string &moment_angles)
+{
+    if (sample_fraction < 1.0)
     {
-        csv_file << headers[i];
-        if (i < headers.size() - 1)
+        if (!histograms.empty() || moment_l_max >= 0)
         {
-            csv_file << ",";
+            std::cout << "Histograms and moments are not filled when sampling events\n";
         }
+        std::function<SampledFile(const std::string &)> sample_file =
+            [&](const std::string &file)
+        { return sample_flat_file(file, mass_branch, sample_fraction, seed); };
+        ResultsTable table = bin_table(bin_vector, sampled_bin_info_headers());
+        size_t row = 0;
+        for (const auto &files : process_bin_files(bin_vector, sample_file, n_threads))
+        {
+            fill_sampled_bin_values(table, row++, files);
+        }
+        return table;
     }
-    csv_file << "\n";
 
-    // Write values
-    for (size_t i = 0; i < values.size(); ++i)
+    DetailConfig details;
+    details.histograms = parse_histogram_specs(histograms);
+    details.moment_l_max = moment_l_max;
+    std::istringstream angle_branches(moment_angles);
+    std::getline(angle_branches, details.cos_theta_branch, ',');
+    std::getline(angle_branches, details.phi_branch);
+    if (!details.empty())
     {
-        csv_file << file_vector[i] << ",";
-        for (size_t j = 1; j < headers.size(); ++j)
+        std::function<DetailedBin(const std::string &)> process_file =
+            [&](const std::string &file)
+        { return process_flat_file_detailed(file, mass_branch, details); };
+
+        std::vector<std::string> headers = bin_info_headers();
+        std::vector<std::string> moment_headers = MomentAccumulator(moment_l_max).headers();
+        headers.insert(headers.end(), moment_headers.begin(), moment_headers.end());
+
+        ResultsTable table = bin_table(bin_vector, headers);
+        std::vector<std::vector<FineHistogram>> bin_histograms;
+        size_t row = 0;
+        for (auto &file_results : process_bin_files(bin_vector, process_file, n_threads))
         {
-            csv_file << values[i].at(headers[j]);
-            if (j < headers.size() - 1)
+            DetailedBin bin = empty_detailed_bin(details);
+            for (auto &file_result : file_results)
+            {
+                bin.merge(file_result);
+            }
+            fill_bin_values(table, row, bin.accumulator);
+            std::vector<double> moment_values = bin.moments.values();
+            for (size_t i = 0; i < moment_headers.size(); ++i)
             {
-                csv_file << ",";
+                table.set_float(table.column(moment_headers[i]), row, moment_values[i]);
             }
+            bin_histograms.push_back(bin.histograms);
+            ++row;
         }
-        csv_file << "\n";
-    }
 
-    csv_file.close();
-}
+        if (!details.histograms.empty())
+        {
+            if (histogram_file.empty())
+                std::cout << "No histogram file given, so the histograms are not saved\n";
+            else
+                write_bin_histograms(histogram_file, bin_vector, bin_histograms);
+        }
+        return table;
+    }
 
-// Get the min / max non-zero bin edges of a histogram
-std::pair<double, double> get_hist_edges(TH1D *h, int round_to_decimals)
-{
-    double min = std::numeric_limits<double>::max();
-    double max = std::numeric_limits<double>::min();
+    std::vector<BinAccumulator> accumulators = accumulate_bins(
+        bin_vector,
+        [&](const std::string &file) { return process_flat_file(file, mass_branch); },
+        n_threads);
 
-    for (int i = 1; i <= h->GetNbinsX(); ++i)
+    ResultsTable table = bin_table(bin_vector, bin_info_headers());
+    for (size_t row = 0; row < accumulators.size(); ++row)
     {
-        double bin_content = h->GetBinContent(i);
-        if (bin_content > 0 && h->GetXaxis()->GetBinLowEdge(i) < min)
-        {
-            min = h->GetXaxis()->GetBinLowEdge(i);
-        }
-        if (bin_content > 0 && h->GetXaxis()->GetBinUpEdge(i) > max)
-        {
-            max = h->GetXaxis()->GetBinUpEdge(i);
-        }
+        fill_bin_values(table, row, accumulators[row]);
     }
-    // round values to requested decimal place
-    min = std::round((min * std::pow(10, round_to_decimals))) / std::pow(10, round_to_decimals);
-    max = std::round((max * std::pow(10, round_to_decimals))) / std::pow(10, round_to_decimals);
-    return std::make_pair(min, max);
-}
\ No newline at end of file
+    return table;
+}
+
+#endif // EXTRACT_BIN_INFO_CC
@@ -1,164 +1,126 @@
 /* Extract the bin information from a list of pre-cut ROOT data files used in fits
 
 The csv file will have columns for:
-    - The low and high bin edges for the t, E_beam, and mass histograms
-    - The center, average, and RMS values for the t, E_beam, and mass histograms
+    - The low and high edges of the t, E_beam, and mass distributions
+    - The center, average, and RMS values for the t, E_beam, and mass distributions
     - The total number of events and the error on the total number of events
 
 NOTE:
-This script assumes that the original Flat Tree data files have been cut to their
-respective bin, and that they contain the t, E_beam, and Weight branches. The 
-Weight branch is used for sideband subtraction, and so if a separate "background" file 
-is used, then it will need to be implemented here.
+This script assumes that the original FSRoot data files have been cut to their
+respective bin. Unlike the Flat Tree version, FSRoot entries are not weighted, so any
+sideband subtraction will need to be implemented here.
+
+Each file is read in a single pass, computing |t|, the beam energy, and the meson mass
+directly from the four-momentum branches of the meson_indices particles and the beam
+(see fsroot_bin_info.h), rather than scanning the tree once per FSRoot expression. The
+values are accumulated in range-free streaming sums (see bin_info.h), so the edges,
+averages, and RMS values are exact for any channel, with nothing lost to overflow.
+
+Like extract_bin_info.cc, a line of the input list may hold several files or glob
+patterns that make up one bin, and files are processed in parallel.
+
+FSRoot trees can hold several combinations of one event. Passing the name of a ranking
+branch as best_combo, such as the kinematic fit "Chi2DOF", keeps only the combination
+with its lowest value for every event (identified by its Run and Event numbers), so that
+the events are not counted multiple times.
+
+When sample_fraction < 1, only a random subset of each file's clusters is read and the
+values are estimates, with the same extra columns as extract_bin_info.cc (see
+bin_sampling.h).
+
+Set the PYAMPPLOTS_PROFILE environment variable to see how the time splits between
+reading the trees and computing the kinematics (see profiler.h).
+
+A csv_name ending in ".papt" writes the same table as a binary columnar file instead,
+which analysis/utils.py can read without parsing any text (see results_table.h).
  */
 
-#include <cmath>   // for power function
-#include <fstream> // for writing csv
 #include <iostream>
-#include <sstream> // for std::istringstream
 #include <string>
 #include <vector>
 
-// forward declarations
-std::pair<double, double> get_hist_edges(TH1D *h, int round_to_decimals);
+#include "bin_info.h"
+#include "bin_sampling.h"
+#include "fsroot_bin_info.h"
+#include "profiler.h"
 
-// maybe have particle indices as inputs? Meson vertex and baryon vertex? How to parse?
-void extract_bin_info_fsroot(std::string file_path, std::string csv_name, std::string nt, std::string meson_indices)
+// forward declarations
+SampledFile sample_fsroot_file(
+    const std::string &file, const std::string &nt, const std::string &meson_indices,
+    const std::string &best_combo, double fraction, unsigned int seed);
+ResultsTable fsroot_bin_info_table(
+    const std::vector<std::string> &bin_vector, const std::string &nt,
+    const std::string &meson_indices, double sample_fraction = 1.0,
+    unsigned int seed = 0, int n_threads = 0, const std::string &best_combo = "");
+
+// n_threads = 0 uses all available cores, and 1 processes the files serially
+void extract_bin_info_fsroot(
+    std::string file_path, std::string csv_name, std::string nt,
+    std::string meson_indices, double sample_fraction = 1.0, unsigned int seed = 0,
+    int n_threads = 0, std::string best_combo = "")
 {
-    // file path is a text file with a list of ROOT files, each on a newline
-    std::vector<std::string> file_vector;
-    std::ifstream infile(file_path);
-    std::string line;
-    while (std::getline(infile, line))
-    {
-        file_vector.push_back(line);
-    }
+    profiler::Session session("extract_bin_info_fsroot");
 
-    // Define header row and corresponding values
-    std::vector<std::string> headers = {
-        "file",
-        "t_low",
-        "t_high",
-        "t_center",
-        "t_avg",
-        "t_rms",
-        "e_low",
-        "e_high",
-        "e_center",
-        "e_avg",
-        "e_rms",
-        "m_low",
-        "m_high",
-        "m_center",
-        "m_avg",
-        "m_rms",
-        "events",
-        "events_err",
-    };
-    std::vector<std::map<std::string, double>> values;
-
-    for (const auto &file : file_vector)
-    {
-        std::map<std::string, double> value_map;
-        TCanvas *c1 = new TCanvas("c1", "c1", 1800, 1800);
-
-        // Assign histograms. These are required to get the mean and rms values
-        TH1D *h_t = (TH1D*)FSHistogram::getTH1F( file.c_str(), nt, "abs(MASS2("+meson_indices+";B))", "(400,0.0,2.0)", "" );
-        TH1D *h_e = (TH1D*)FSHistogram::getTH1F( file.c_str(), nt, "EnPB", "(400,0.0,12.0)", "" ); 
-        TH1D *h_m = (TH1D*)FSHistogram::getTH1F( file.c_str(), nt, "MASS("+meson_indices+")", "(400,0.0,2.0)", "" );
-        
-
-        // Fill the map. Round -t and E_beam to 2nd decimal, and the mass values to
-        // the third decimal (1 MeV)
-        double bin_contents_error;
-        value_map["events"] = h_m->IntegralAndError(0, h_m->GetNbinsX() + 1, bin_contents_error);
-        value_map["events_err"] = bin_contents_error;
-
-        double t_low, t_high;
-        std::tie(t_low, t_high) = get_hist_edges(h_t, 2);
-        value_map["t_low"] = t_low;
-        value_map["t_high"] = t_high;
-        value_map["t_center"] = (t_high + t_low) / 2.0;
-        value_map["t_avg"] = h_t->GetMean();
-        value_map["t_rms"] = h_t->GetRMS();
-
-        double e_low, e_high;
-        std::tie(e_low, e_high) = get_hist_edges(h_e, 2);
-        value_map["e_low"] = e_low;
-        value_map["e_high"] = e_high;
-        value_map["e_center"] = (e_high + e_low) / 2.0;
-        value_map["e_avg"] = h_e->GetMean();
-        value_map["e_rms"] = h_e->GetRMS();
-
-        double m_low, m_high;
-        std::tie(m_low, m_high) = get_hist_edges(h_m, 3);
-        value_map["m_low"] = m_low;
-        value_map["m_high"] = m_high;
-        value_map["m_center"] = (m_high + m_low) / 2.0;
-        value_map["m_avg"] = h_m->GetMean();
-        value_map["m_rms"] = h_m->GetRMS();
-
-        values.push_back(value_map);
-
-        // Clean up
-        delete h_t;
-        delete h_e;
-        delete h_m;
-        delete c1;
-    }
+    // file path is a text file with a list of bins, each on a newline
+    std::vector<std::string> bin_vector = read_bin_list(file_path);
 
-    // open csv file for writing
-    std::ofstream csv_file;
-    csv_file.open(csv_name);
+    ResultsTable table = fsroot_bin_info_table(
+        bin_vector, nt, meson_indices, sample_fraction, seed, n_threads, best_combo);
+    write_results(table, csv_name);
+}
 
-    // Write the header line
-    for (size_t i = 0; i < headers.size(); ++i)
+// The table of extract_bin_info_fsroot, with one row per bin. This is the whole
+// extraction without the csv, which analysis/extraction.py calls from Python
+ResultsTable fsroot_bin_info_table(
+    const std::vector<std::string> &bin_vector, const std::string &nt,
+    const std::string &meson_indices, double sample_fraction, unsigned int seed,
+    int n_threads, const std::string &best_combo)
+{
+    if (sample_fraction < 1.0)
     {
-        csv_file << headers[i];
-        if (i < headers.size() - 1)
+        std::function<SampledFile(const std::string &)> sample_file =
+            [&](const std::string &file)
+        {
+            return sample_fsroot_file(
+                file, nt, meson_indices, best_combo, sample_fraction, seed);
+        };
+        ResultsTable table = bin_table(bin_vector, sampled_bin_info_headers());
+        size_t row = 0;
+        for (const auto &files : process_bin_files(bin_vector, sample_file, n_threads))
         {
-            csv_file << ",";
+            fill_sampled_bin_values(table, row++, files);
         }
+        return table;
     }
-    csv_file << "\n";
 
-    // Write values
-    for (size_t i = 0; i < values.size(); ++i)
+    std::vector<BinAccumulator> accumulators = accumulate_bins(
+        bin_vector,
+        [&](const std::string &file)
+        { return process_fsroot_file(file, nt, meson_indices, best_combo); },
+        n_threads);
+
+    ResultsTable table = bin_table(bin_vector, bin_info_headers());
+    for (size_t row = 0; row < accumulators.size(); ++row)
     {
-        csv_file << file_vector[i] << ",";
-        for (size_t j = 1; j < headers.size(); ++j)
-        {
-            csv_file << values[i].at(headers[j]);
-            if (j < headers.size() - 1)
-            {
-                csv_file << ",";
-            }
-        }
-        csv_file << "\n";
+        fill_bin_values(table, row, accumulators[row]);
     }
-
-    csv_file.close();
+    return table;
 }
 
-// Get the min / max non-zero bin edges of a histogram
-std::pair<double, double> get_hist_edges(TH1D *h, int round_to_decimals) {
-    double min = std::numeric_limits<double>::max();
-    double max = std::numeric_limits<double>::min();
-
-    for (int i = 1; i <= h->GetNbinsX(); ++i)
-    {
-        double bin_content = h->GetBinContent(i);
-        if (bin_content > 0 && h->GetXaxis()->GetBinLowEdge(i) < min)
-        {
-            min = h->GetXaxis()->GetBinLowEdge(i);
-        }
-        if (bin_content > 0 && h->GetXaxis()->GetBinUpEdge(i) > max)
+// Read a random sample of the FSRoot tree's entries
+SampledFile sample_fsroot_file(
+    const std::string &file, const std::string &nt, const std::string &meson_indices,
+    const std::string &best_combo, double fraction, unsigned int seed)
+{
+    std::unique_ptr<TFile> f;
+    FSRootReader reader;
+    TTree *tree = open_fsroot_tree(file, nt, meson_indices, f, reader, best_combo);
+    return sample_tree(
+        tree, fraction, file_seed(file, seed),
+        [&](Long64_t first, Long64_t last, BinAccumulator &unit)
         {
-            max = h->GetXaxis()->GetBinUpEdge(i);
-        }
-    }
-    // round values to requested decimal place
-    min = std::round((min * std::pow(10, round_to_decimals))) / std::pow(10, round_to_decimals);
-    max = std::round((max * std::pow(10, round_to_decimals))) / std::pow(10, round_to_decimals);
-    return std::make_pair(min, max);
+            scan_fsroot_range(
+                tree, reader, first, last,
+                [&](const FSRootBatch &batch) { fill_accumulator(batch, unit); });
+        });
 }
@@ -18,6 +18,8 @@ format, where:
     P = parity (either p [+] or m [-])
     m = m-projection (either p [+], m [-], or 0)
     L = orbital angular momentum (standard letter convention: S, P, D, F, ...)
+Names in another format can be read by passing an amplitude_grammar, which describes
+where each quantum number is in the name (see amplitude_names.h).
 It also assumes that reflectivity sums do not mix and are constrained across sums,
 meaning that phase differences can not be computed between negative and positive
 reflectivity waves.
@@ -28,48 +30,53 @@ NOTE: this script is "reaction" independent, meaning if multiple reactions are i
     that coherent sums are calculated over all reactions. This is so that multiple
     orientations, typically denoted using the "reaction", can be fit simultaneously and
     have their fit results extracted in one go.
+
+Set the PYAMPPLOTS_PROFILE environment variable to get the time spent reading and
+parsing the files, filling the maps, evaluating the intensities and phase differences,
+and writing the csv (see profiler.h). The files are read ahead on a separate thread, so
+a large wait_read time means the extraction is waiting on the filesystem.
 */
 
+// guarded, since extract_joined_results.cc includes this macro
+#ifndef EXTRACT_FIT_RESULTS_CC
+#define EXTRACT_FIT_RESULTS_CC
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstring>
-#include <fstream> // for writing csv
+#include <fstream> // for reading the file list
 #include <iostream>
 #include <map>
 #include <sstream> // for std::istringstream
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "IUAmpTools/FitResults.h"
-
-// forward declarations
-void fill_maps(
-    FitResults &results,
-    std::map<std::string, double> &standard_results,
-    std::map<std::string, std::complex<double>> &production_coefficients,
-    std::map<std::string, std::map<std::string, std::vector<std::string>>> &coherent_sums,
-    std::map<std::string, std::pair<std::string, std::string>> &phase_diffs);
-
-std::tuple<std::string, std::string, std::string, std::string> parse_amplitude(std::string amplitude);
-
-void extract_fit_results(std::string file_path, std::string csv_name, bool is_acceptance_corrected)
+#include "amplitude_names.h"
+#include "file_prefetcher.h"
+#include "fit_archive.h"
+#include "profiler.h"
+#include "results_table.h"
+
+// The structure of a fit result, which only depends on its amplitude and parameter
+// names. Campaigns typically fit many bins with the same model, so it is built from the
+// first file and reused as long as the following files have the same names. Files of
+// the same model then only cost the AmpTools calls, without rebuilding any of the maps.
+struct FitSchema
 {
-    // file path is a text file with a list of AmpTools output files, each on a newline
-    std::vector<std::string> file_vector;
-    std::ifstream infile(file_path);
-    std::string line;
-    while (std::getline(infile, line))
-    {
-        file_vector.push_back(line);
-    }
+    // every reaction and its amplitudes, in order, to recognize files of this schema
+    std::vector<std::string> reactions;
+    std::vector<std::vector<std::string>> amplitudes;
 
-    // ==== MAP INITIALIZATION ====
+    // AmpTools parameters that are not amplitude based, i.e. without a "::"
+    std::vector<std::string> parameters;
 
-    // map of the standard AmpTools outputs that will be common to any fit result
-    std::map<std::string, double> standard_results;
-
-    // map for all phase differences between amplitudes, whose keys are in
-    // "eJPmL_eJPmL" format, and whose values are the pair of full AmpTools
-    // amplitude names
-    std::map<std::string, std::pair<std::string, std::string>> phase_diffs;
+    // map of an amplitude for every wave in eJPmL format. Its (constrained) production
+    // coefficient is the wave's
+    std::map<std::string, std::string> production_amplitudes;
 
     // This next map stores all the different coherent sum types. The keys are the
     // coherent sum type in eJPmL format, and the values are the strings of each
@@ -84,255 +91,490 @@ void extract_fit_results(std::string file_path, std::string csv_name, bool is_ac
     // "eJPmL -> "p1p0S" -> {xx::ImagPosSign::p1p0S, xx::RealNegSign::p1p0S}
     // A coherent sum such as the one over all JP=1+ states would be:
     // "JP" -> "1p" -> {xx::ImagNegSign::m1p0S, xx::RealNegSign::p1ppD, ...}
-
-    // Initialize the map for all coherent sum types
     std::map<std::string, std::map<std::string, std::vector<std::string>>> coherent_sums;
-    std::vector<std::string> coherent_sum_types = {
-        "eJPmL", // single amplitudes
-        "JPmL",  // sum reflectivity
-        "eJPL",  // sum m-projection
-        "JPL",   // sum {reflectivity, m-projection}
-        "eJP",   // sum {m-projection, angular momenta}
-        "JP",    // sum {reflectivity, m-projection, angular momenta}
-        "e"      // sum all except reflectivity
-    };
-    for (const auto &key : coherent_sum_types)
+
+    // map for all phase differences between amplitudes, whose keys are in
+    // "eJPmL_eJPmL" format, and whose values are the pair of full AmpTools
+    // amplitude names
+    std::map<std::string, std::pair<std::string, std::string>> phase_diffs;
+
+    // Whether the results have exactly the reactions, amplitudes, and non-amplitude
+    // parameters of this schema. AmpTools returns the lists of names by value, so this
+    // still copies the names of every file, but none of the maps are built again
+    bool matches(const FitResults &results) const
     {
-        coherent_sums[key] = std::map<std::string, std::vector<std::string>>();
+        if (results.reactionList() != reactions)
+            return false;
+        for (size_t i = 0; i < reactions.size(); ++i)
+        {
+            if (results.ampList(reactions[i]) != amplitudes[i])
+                return false;
+        }
+
+        // the parameters have their own columns, so they must be the same as well
+        size_t n_parameters = 0;
+        for (const auto &par_name : results.parNameList())
+        {
+            if (par_name.find("::") != std::string::npos)
+                continue;
+            if (n_parameters == parameters.size() || par_name != parameters[n_parameters])
+                return false;
+            ++n_parameters;
+        }
+        return n_parameters == parameters.size();
     }
+};
 
-    // lastly a map for the production coefficients (in eJPmL format)
-    std::map<std::string, std::complex<double>> production_coefficients;
+// ==== QUANTUM NUMBER MASKS ====
+// The quantum numbers of an amplitude are packed into a single integer code (see
+// amplitude_names.h). A coherent sum type is the mask of the fields it keeps, so
+// amplitudes are in the same coherent sum when their codes are equal after masking, and
+// no strings are built until the sums are complete.
 
-    // open csv file for writing
-    std::ofstream csv_file;
-    csv_file.open(csv_name);
+// Mask of the fields a coherent sum type keeps, like "JP". Letters outside of "eJPmL"
+// throw, which is a compile error for the types in COHERENT_SUM_TYPES
+constexpr QuantumCode quantum_mask(std::string_view type)
+{
+    QuantumCode mask = 0;
+    for (char letter : type)
+    {
+        size_t field = QUANTUM_FIELDS.find(letter);
+        if (field == std::string_view::npos)
+            throw std::invalid_argument("coherent sum types can only use the letters eJPmL");
+        mask |= QuantumCode(0xFF) << (8 * field);
+    }
+    return mask;
+}
 
-    // Collect all rows in a stringstream to minimize I/O operations
-    std::stringstream csv_data;
-    bool is_header_written = false;
+struct CoherentSumType
+{
+    std::string_view name;
+    QuantumCode mask;
+};
+
+// All coherent sum types in the csv. More can be declared in coherent_sum_types.def
+#define COHERENT_SUM(type) {type, quantum_mask(type)},
+constexpr CoherentSumType COHERENT_SUM_TYPES[] = {
+    COHERENT_SUM("eJPmL") // single amplitudes
+    COHERENT_SUM("JPmL")  // sum reflectivity
+    COHERENT_SUM("eJPL")  // sum m-projection
+    COHERENT_SUM("JPL")   // sum {reflectivity, m-projection}
+    COHERENT_SUM("eJP")   // sum {m-projection, angular momenta}
+    COHERENT_SUM("JP")    // sum {reflectivity, m-projection, angular momenta}
+    COHERENT_SUM("e")     // sum all except reflectivity
+#include "coherent_sum_types.def"
+};
+#undef COHERENT_SUM
+
+constexpr bool are_sum_types_unique()
+{
+    for (size_t i = 0; i < std::size(COHERENT_SUM_TYPES); ++i)
+    {
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (COHERENT_SUM_TYPES[i].name == COHERENT_SUM_TYPES[j].name)
+                return false;
+        }
+    }
+    return true;
+}
+static_assert(are_sum_types_unique(), "A coherent sum type is declared more than once");
+
+// The standard AmpTools fit outputs, common to any fit result, in their csv order
+const std::array<const char *, 7> STANDARD_RESULTS = {
+    "detected_events", "detected_events_err",  "eMatrixStatus",
+    "generated_events", "generated_events_err", "lastMinuitCommandStatus",
+    "likelihood"};
+
+// forward declarations
+void fill_maps(
+    const FitResults &results, const AmplitudeGrammar &grammar, QuantumCatalog &catalog,
+    FitSchema &schema);
+std::array<double, 7> standard_results(const FitResults &results);
+std::vector<std::string> schema_columns(const FitSchema &schema);
+void fill_row(
+    const FitResults &results, const FitSchema &schema, bool is_acceptance_corrected,
+    std::vector<double> &row);
+ResultsTable fit_results_table(
+    const std::vector<std::string> &file_vector, bool is_acceptance_corrected,
+    const std::string &amplitude_grammar = "", bool is_union_schema = false,
+    int prefetch_depth = 8);
+bool is_background(std::string_view amplitude);
+QuantumCode pack_quantum_numbers(
+    std::string_view amplitude, const AmplitudeGrammar &grammar, QuantumCatalog &catalog);
+
+// amplitude_grammar describes how the quantum numbers are written in the amplitude
+// names, see amplitude_names.h. Empty uses the default eJPmL grammar. By default the
+// columns are those of the first valid file, and the values of later files with other
+// amplitudes are only written for the columns the first file has. With is_union_schema
+// the output has the columns of all files instead. The columns a file doesn't have are
+// left empty. A csv_name ending in ".papt" writes a columnar file (see results_table.h)
+// The next prefetch_depth files are read into memory on a separate thread while a file
+// is parsed (see file_prefetcher.h), and 0 reads every file only when it is parsed. The
+// list may also have .fitpack archives, or members of them (see fit_archive.h)
+void extract_fit_results(
+    std::string file_path, std::string csv_name, bool is_acceptance_corrected,
+    std::string amplitude_grammar = "", bool is_union_schema = false,
+    int prefetch_depth = 8)
+{
+    profiler::Session session("extract_fit_results");
+
+    // file path is a text file with a list of AmpTools output files, each on a newline
+    std::vector<std::string> file_vector;
+    std::ifstream infile(file_path);
+    std::string line;
+    while (std::getline(infile, line))
+    {
+        file_vector.push_back(line);
+    }
+
+    ResultsTable table = fit_results_table(
+        file_vector, is_acceptance_corrected, amplitude_grammar, is_union_schema,
+        prefetch_depth);
+    write_results(table, csv_name);
+}
+
+// The table of extract_fit_results, with one row per valid file. This is the whole
+// extraction without any file output, which analysis/extraction.py calls from Python
+ResultsTable fit_results_table(
+    const std::vector<std::string> &file_vector, bool is_acceptance_corrected,
+    const std::string &amplitude_grammar, bool is_union_schema, int prefetch_depth)
+{
+    // compiled once, and the quantum number catalog is shared by all files
+    AmplitudeGrammar grammar(
+        amplitude_grammar.empty() ? DEFAULT_AMPLITUDE_GRAMMAR : amplitude_grammar);
+    QuantumCatalog catalog;
+
+    // the schema of the last file, which is only rebuilt when the names change
+    FitSchema schema;
+    bool is_schema_built = false;
+
+    // every file is a row of the table, and each schema column has a table column, or
+    // NO_COLUMN when it is dropped
+    ResultsTable table;
+    table.set_metadata("extractor", "extract_fit_results");
+    table.set_metadata("acceptance_corrected", is_acceptance_corrected ? "1" : "0");
+    table.set_metadata("amplitude_grammar", grammar.get_pattern());
+    const size_t file_column = table.add_column("file", ColumnType::Text);
+    std::vector<size_t> column_ids;
+    std::vector<double> row;
 
     // ==== BEGIN FILE ITERATION ====
-    // Iterate over each file, and add their results as a row in the csv
-    for (const std::string &file : file_vector)
+    // Iterate over each file, and add their results as a row in the table. The files
+    // are parsed from their in-memory copies, while the following files are read
+    std::vector<std::string> files = expand_fit_archives(file_vector);
+    FilePrefetcher prefetcher(files, std::max(prefetch_depth, 0));
+    for (const std::string &file : files)
     {
-        std::cout << "Analyzing File: " << file << "\n";
-        FitResults results(file);
+        // flushed, so that a crash while parsing it still shows which file it was
+        std::cout << "Analyzing File: " << file << std::endl;
+        PrefetchedFile prefetched = prefetcher.next();
+        // reported here, since the reader thread can't exit for a broken archive
+        if (!prefetched.error.empty())
+            std::cout << prefetched.error << "\n";
+        profiler::ScopedPhase loading("load", true, file);
+        FitResults results(prefetched.path);
+        loading.stop();
         if (!results.valid())
         {
             std::cout << "Invalid fit results in file: " << file << "\n";
+            std::cout << "Done File: " << file << std::endl;
             continue;
         }
 
-        // before getting this file's info, clear the results from the last file
-        standard_results.clear();
-        production_coefficients.clear();
-        for (auto &pair : coherent_sums)
-        {
-            pair.second.clear();
-        }
-        phase_diffs.clear();
-
-        // fill all the maps for this file
-        fill_maps(results, standard_results, production_coefficients, coherent_sums, phase_diffs);
-
-        // == WRITE TO CSV ==
-        // write the header row if this is the first file
-        if (!is_header_written)
+        // only build the maps again when this file's names differ from the last
+        profiler::ScopedPhase matching("match_schema");
+        bool is_match = is_schema_built && schema.matches(results);
+        matching.stop();
+        if (!is_match)
         {
-            // 1. standard results (these already have _err values)
-            csv_data << "file" << ",";
-            for (const auto &pair : standard_results)
-            {
-                csv_data << pair.first << ",";
-            }
-            // 2. AmpTools parameter names
-            for (const auto &par_name : results.parNameList())
-            {
-                // skip amplitude-based parameters
-                if (par_name.find("::") != std::string::npos)
-                {
-                    continue;
-                }
-                csv_data << par_name << "," << par_name << "_err,";
-            }
-            // 3. production parameters in eJPmL_(re/im) format
-            for (const auto &pair : production_coefficients)
-            {
-                csv_data << pair.first << "_re" << ",";
-                csv_data << pair.first << "_im" << ",";
-            }
-            // 4. eJPmL based coherent sum titles
-            for (const auto &pair : coherent_sums)
-            {
-                for (const auto &sub_pair : coherent_sums[pair.first])
-                {
-                    csv_data << sub_pair.first << "," << sub_pair.first << "_err,";
-                }
-            }
-            // 5. phase difference names in eJPmL_eJPmL format
-            // use a different iterator method to avoid adding an extra comma at the end
-            for (auto it = phase_diffs.begin(); it != phase_diffs.end(); ++it)
+            profiler::ScopedPhase filling("fill_maps");
+            schema = FitSchema();
+            fill_maps(results, grammar, catalog, schema);
+            profiler::count("schemas", 1);
+
+            // new columns go right after the column before them in this schema, so
+            // every schema keeps its own order
+            bool is_first_schema = !is_schema_built;
+            size_t previous = file_column, n_matched = 0;
+            column_ids.clear();
+            for (const auto &column : schema_columns(schema))
             {
-                csv_data << it->first << "," << it->first << "_err";
-                if (std::next(it) != phase_diffs.end())
-                {
-                    csv_data << ",";
-                }
+                size_t id = table.find_column(column);
+                if (id != ResultsTable::NO_COLUMN)
+                    ++n_matched;
+                else if (is_first_schema || is_union_schema)
+                    id = table.add_column(column, ColumnType::Float64, previous);
+                if (id != ResultsTable::NO_COLUMN)
+                    previous = id;
+                column_ids.push_back(id);
             }
-            csv_data << "\n";
-            is_header_written = true;
-        } // end header row
-
-        // now write the values in the same order of map loops
-        // 1. standard results
-        csv_data << file << ",";
-        for (const auto &pair : standard_results)
-        {
-            csv_data << pair.second << ",";
-        }
-        // 2. AmpTools parameters
-        for (const auto &par_name : results.parNameList())
-        {
-            // skip amplitude-based parameters
-            if (par_name.find("::") != std::string::npos)
+            is_schema_built = true;
+            if (!is_first_schema && !is_union_schema &&
+                (n_matched != column_ids.size() || n_matched + 1 != table.n_columns()))
             {
-                continue;
+                std::cout << "WARNING: the amplitudes of " << file << " differ from the"
+                          << " first file, so only the columns they share are written."
+                          << " Use the union schema mode for fits of different models\n";
             }
-            csv_data << results.parValue(par_name) << ",";
-            csv_data << results.parError(par_name) << ",";
         }
-        // 3. production parameters
-        for (const auto &pair : production_coefficients)
+
+        fill_row(results, schema, is_acceptance_corrected, row);
+        size_t row_index = table.append_rows(1);
+        table.set_text(file_column, row_index, file);
+        for (size_t i = 0; i < row.size(); ++i)
         {
-            csv_data << pair.second.real() << ",";
-            csv_data << pair.second.imag() << ",";
+            if (column_ids[i] != ResultsTable::NO_COLUMN)
+                table.set_float(column_ids[i], row_index, row[i]);
         }
-        // 4. coherent sums
-        for (const auto &pair : coherent_sums)
+        // so that a crash after it, like while writing the csv, isn't blamed on it
+        std::cout << "Done File: " << file << std::endl;
+    }
+
+    return table;
+}
+
+// The csv columns of a schema, after the file name
+std::vector<std::string> schema_columns(const FitSchema &schema)
+{
+    std::vector<std::string> columns;
+    // 1. standard results (these already have _err values)
+    for (const auto &name : STANDARD_RESULTS)
+    {
+        columns.push_back(name);
+    }
+    // 2. AmpTools parameter names
+    for (const auto &par_name : schema.parameters)
+    {
+        columns.push_back(par_name);
+        columns.push_back(par_name + "_err");
+    }
+    // 3. production parameters in eJPmL_(re/im) format
+    for (const auto &pair : schema.production_amplitudes)
+    {
+        columns.push_back(pair.first + "_re");
+        columns.push_back(pair.first + "_im");
+    }
+    // 4. eJPmL based coherent sum titles
+    for (const auto &pair : schema.coherent_sums)
+    {
+        for (const auto &sub_pair : pair.second)
         {
-            for (const auto &sub_pair : coherent_sums[pair.first])
-            {
-                csv_data << results.intensity(sub_pair.second, is_acceptance_corrected).first << ",";
-                csv_data << results.intensity(sub_pair.second, is_acceptance_corrected).second << ",";
-            }
+            columns.push_back(sub_pair.first);
+            columns.push_back(sub_pair.first + "_err");
         }
-        // 5. phase differences, again avoiding an extra comma at the end
-        for (auto it = phase_diffs.begin(); it != phase_diffs.end(); ++it)
+    }
+    // 5. phase difference names in eJPmL_eJPmL format
+    for (const auto &pair : schema.phase_diffs)
+    {
+        columns.push_back(pair.first);
+        columns.push_back(pair.first + "_err");
+    }
+    return columns;
+}
+
+// The values of a file, in the same order as the columns of its schema
+void fill_row(
+    const FitResults &results, const FitSchema &schema, bool is_acceptance_corrected,
+    std::vector<double> &row)
+{
+    row.clear();
+    // 1. standard results
+    profiler::ScopedPhase intensities("intensity");
+    for (double value : standard_results(results))
+    {
+        row.push_back(value);
+    }
+    // 2. AmpTools parameters
+    for (const auto &par_name : schema.parameters)
+    {
+        row.push_back(results.parValue(par_name));
+        row.push_back(results.parError(par_name));
+    }
+    // 3. production parameters
+    for (const auto &pair : schema.production_amplitudes)
+    {
+        std::complex<double> coefficient = results.scaledProductionParameter(pair.second);
+        row.push_back(coefficient.real());
+        row.push_back(coefficient.imag());
+    }
+    // 4. coherent sums
+    for (const auto &pair : schema.coherent_sums)
+    {
+        for (const auto &sub_pair : pair.second)
         {
-            std::string phase1 = it->second.first;
-            std::string phase2 = it->second.second;
-            auto phase_diff = results.phaseDiff(phase1, phase2);            
-            csv_data << phase_diff.first << ","; // value
-            csv_data << phase_diff.second;       // error
-            if (std::next(it) != phase_diffs.end())
-            {
-                csv_data << ",";
-            }
+            auto intensity = results.intensity(sub_pair.second, is_acceptance_corrected);
+            row.push_back(intensity.first);
+            row.push_back(intensity.second);
         }
-        csv_data << "\n"; // end of row, move on to next file
     }
+    intensities.stop();
+    // 5. phase differences
+    profiler::ScopedPhase phases("phase_diff");
+    for (const auto &pair : schema.phase_diffs)
+    {
+        auto phase_diff = results.phaseDiff(pair.second.first, pair.second.second);
+        row.push_back(phase_diff.first);
+        row.push_back(phase_diff.second);
+    }
+}
 
-    // Write all collected data to the CSV file at once
-    csv_file << csv_data.str();
-    csv_file.close();
+// The values of STANDARD_RESULTS, in the same order
+std::array<double, 7> standard_results(const FitResults &results)
+{
+    std::pair<double, double> detected = results.intensity(false);
+    std::pair<double, double> generated = results.intensity(true);
+    return {
+        detected.first,
+        detected.second,
+        static_cast<double>(results.eMatrixStatus()),
+        generated.first,
+        generated.second,
+        static_cast<double>(results.lastMinuitCommandStatus()),
+        results.likelihood()};
 }
 
-// fill all the fit results maps for a single file
+// fill all the schema maps from the amplitudes of a single file
 void fill_maps(
-    FitResults &results,
-    std::map<std::string, double> &standard_results,
-    std::map<std::string, std::complex<double>> &production_coefficients,
-    std::map<std::string, std::map<std::string, std::vector<std::string>>> &coherent_sums,
-    std::map<std::string, std::pair<std::string, std::string>> &phase_diffs)
+    const FitResults &results, const AmplitudeGrammar &grammar, QuantumCatalog &catalog,
+    FitSchema &schema)
 {
-    // Store the standard AmpTools fit outputs
-    standard_results["eMatrixStatus"] = results.eMatrixStatus();
-    standard_results["lastMinuitCommandStatus"] = results.lastMinuitCommandStatus();
-    standard_results["likelihood"] = results.likelihood();
-    standard_results["detected_events"] = results.intensity(false).first;
-    standard_results["detected_events_err"] = results.intensity(false).second;
-    standard_results["generated_events"] = results.intensity(true).first;
-    standard_results["generated_events_err"] = results.intensity(true).second;
+    for (const auto &par_name : results.parNameList())
+    {
+        // skip amplitude-based parameters
+        if (par_name.find("::") == std::string::npos)
+        {
+            schema.parameters.push_back(par_name);
+        }
+    }
+
+    // Amplitudes grouped by their masked quantum numbers for every coherent sum type,
+    // and the phase difference pairs by the codes of both waves. Their csv names are
+    // only made once every amplitude is grouped
+    std::vector<std::map<QuantumCode, std::vector<std::string>>> sums(
+        std::size(COHERENT_SUM_TYPES));
+    std::vector<std::string> background;
+    std::map<QuantumCode, std::string> production_amplitudes;
+    std::map<std::pair<QuantumCode, QuantumCode>, std::pair<std::string, std::string>>
+        phase_diffs;
+    const QuantumCode reflectivity = quantum_mask("e");
 
     // fill the coherent sum and phase difference maps by iterating over all amps
-    for (auto reaction : results.reactionList())
+    for (const auto &reaction : results.reactionList())
     {
-        for (std::string amplitude : results.ampList(reaction))
+        schema.reactions.push_back(reaction);
+        schema.amplitudes.push_back(results.ampList(reaction));
+        const std::vector<std::string> &amplitudes = schema.amplitudes.back();
+
+        // pack every amplitude once, rather than once per pair of amplitudes
+        std::vector<bool> is_bkgd;
+        std::vector<QuantumCode> codes;
+        for (const std::string &amplitude : amplitudes)
+        {
+            is_bkgd.push_back(is_background(amplitude));
+            codes.push_back(
+                is_bkgd.back() ? 0 : pack_quantum_numbers(amplitude, grammar, catalog));
+        }
+
+        for (size_t i = 0; i < amplitudes.size(); ++i)
         {
-            // 'amplitude' is the full name stored by AmpTools in the format:
+            // amplitudes[i] is the full name stored by AmpTools in the format:
             // "reaction::reflectivitySum::eJPmL"
+            const std::string &amplitude = amplitudes[i];
 
             // put isotropic background into the single amplitude category
-            if (amplitude.find("Bkgd") != std::string::npos ||
-                amplitude.find("iso") != std::string::npos)
+            if (is_bkgd[i])
             {
-                coherent_sums["eJPmL"]["Bkgd"].push_back(amplitude);
+                background.push_back(amplitude);
                 continue;
             }
-
-            // split the "eJPmL" part of the amplitude into its components
-            std::string e, JP, m, L;
-            std::tie(e, JP, m, L) = parse_amplitude(amplitude);
-
-            std::string eJPmL = e + JP + m + L;
+            QuantumCode code = codes[i];
 
             // store the production coefficients
-            production_coefficients[eJPmL] = results.scaledProductionParameter(amplitude);
+            production_amplitudes[code] = amplitude;
 
             // store the amplitudes in the coherent sum maps
-            coherent_sums["eJPmL"][eJPmL].push_back(amplitude);
-            coherent_sums["JPmL"][JP + m + L].push_back(amplitude);
-            coherent_sums["eJPL"][e + JP + L].push_back(amplitude);
-            coherent_sums["JPL"][JP + L].push_back(amplitude);
-            coherent_sums["eJP"][e + JP].push_back(amplitude);
-            coherent_sums["JP"][JP].push_back(amplitude);
-            coherent_sums["e"][e].push_back(amplitude);
+            for (size_t type = 0; type < std::size(COHERENT_SUM_TYPES); ++type)
+            {
+                sums[type][code & COHERENT_SUM_TYPES[type].mask].push_back(amplitude);
+            }
 
             // store the phase differences
-            for (std::string pd_amplitude : results.ampList(reaction))
+            for (size_t j = 0; j < amplitudes.size(); ++j)
             {
-                std::string pd_e, pd_JP, pd_m, pd_L;
-                std::tie(pd_e, pd_JP, pd_m, pd_L) = parse_amplitude(pd_amplitude);
-                std::string pd_eJPmL = pd_e + pd_JP + pd_m + pd_L;
-
-                if (pd_eJPmL == eJPmL)
+                if (codes[j] == code)
                     continue; // don't compare to itself
                 // isotropic background cannot have a phase difference
-                if (pd_amplitude.find("Bkgd") != std::string::npos ||
-                    pd_amplitude.find("iso") != std::string::npos)
+                if (is_bkgd[j])
                 {
                     continue;
                 }
 
-                // avoid duplicates due to reverse ordering of names
-                if (phase_diffs.find(pd_eJPmL + "_" + eJPmL) != phase_diffs.end())
+                // avoid phase differences between different reflectivities
+                if ((code & reflectivity) != (codes[j] & reflectivity))
                 {
                     continue;
                 }
 
-                // avoid phase differences between different reflectivities
-                if (eJPmL[0] != pd_eJPmL[0])
+                // avoid duplicates due to reverse ordering of names
+                if (phase_diffs.count({codes[j], code}))
                 {
                     continue;
                 }
 
-                phase_diffs[eJPmL + "_" + pd_eJPmL] = std::make_pair(amplitude, pd_amplitude);
+                phase_diffs[{code, codes[j]}] = std::make_pair(amplitude, amplitudes[j]);
             }
         }
     }
+
+    // name everything in eJPmL format
+    for (size_t type = 0; type < std::size(COHERENT_SUM_TYPES); ++type)
+    {
+        std::string_view name = COHERENT_SUM_TYPES[type].name;
+        auto &type_sums = schema.coherent_sums[std::string(name)];
+        for (auto &pair : sums[type])
+        {
+            type_sums[catalog.key(name, pair.first)] = std::move(pair.second);
+        }
+    }
+    if (!background.empty())
+    {
+        schema.coherent_sums["eJPmL"]["Bkgd"] = background;
+    }
+    for (const auto &pair : production_amplitudes)
+    {
+        schema.production_amplitudes[catalog.key(QUANTUM_FIELDS, pair.first)] =
+            pair.second;
+    }
+    for (const auto &pair : phase_diffs)
+    {
+        std::string key = catalog.key(QUANTUM_FIELDS, pair.first.first) + "_" +
+                          catalog.key(QUANTUM_FIELDS, pair.first.second);
+        schema.phase_diffs[key] = pair.second;
+    }
+}
+
+// whether the amplitude is the isotropic background, which is not an eJPmL wave
+bool is_background(std::string_view amplitude)
+{
+    return amplitude.find("Bkgd") != std::string_view::npos ||
+           amplitude.find("iso") != std::string_view::npos;
 }
 
-// grab the "eJPmL" part of the amplitude and split into its components
-std::tuple<std::string, std::string, std::string, std::string> parse_amplitude(std::string amplitude)
+// Pack the quantum numbers in the last part of the amplitude name, after the "::", like
+// "p1p0S" in "reaction::ImagPosSign::p1p0S". Exits if the name doesn't fit the grammar
+QuantumCode pack_quantum_numbers(
+    std::string_view amplitude, const AmplitudeGrammar &grammar, QuantumCatalog &catalog)
 {
-    // NOTE: this assumes the amplitude is named in the "eJPmL" format already, and will
-    // need to be adjusted if the naming convention is different
-    std::string eJPmL = amplitude.substr(amplitude.rfind("::") + 2);
-    std::string e, JP, m, L;
-    e = eJPmL.substr(0, 1);
-    JP = eJPmL.substr(1, 2);
-    m = eJPmL.substr(3, 1);
-    L = eJPmL.substr(4);
-    return std::make_tuple(e, JP, m, L);
-}
\ No newline at end of file
+    std::string_view name = amplitude.substr(amplitude.rfind("::") + 2);
+    AmplitudeParts parts;
+    if (!grammar.parse(name, parts))
+    {
+        std::cout << "Amplitude " << amplitude << " does not match the amplitude grammar "
+                  << grammar.get_pattern() << "\n";
+        exit(1);
+    }
+    return catalog.pack(parts);
+}
+
+#endif // EXTRACT_FIT_RESULTS_CC
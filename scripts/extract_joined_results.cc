@@ -0,0 +1,239 @@
+/* Extract the fit results and the bin information of a binned fit into one table
+
+extract_fit_results.cc and extract_bin_info.cc write separate csv files, whose rows
+only line up when both lists of files were sorted the same way. This script reads both
+kinds of files in one go, and joins every fit to its data bin by a bin key (see
+bin_keys.h), so the order of the files doesn't matter.
+
+The input list has a .fit file on each of its fit lines, and a bin definition (see
+bin_info.h) on each of its other lines. Every fit is a row of the table, with
+    - bin, the key of its bin
+    - the columns of extract_fit_results.cc, including the .fit file
+    - the columns of extract_bin_info.cc, with the bin's files in bin_files
+Bins without any fit get a row with only the bin columns, and fits without a bin get a
+row with only the fit columns. Both are warned about. The rows follow the order of the
+bins, and the order of the fits within a bin.
+
+key_source picks how a data bin gets its key:
+    "directory" - from the edge ranges of its files' directories, like the fits
+    "edges"     - from its measured t, E_beam, and mass edges, which must fit inside
+                  the edge ranges of exactly one fit key
+The rest of the arguments are those of the two extraction scripts.
+
+NOTE: AmpTools must be loaded first, like for extract_fit_results.cc
+*/
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bin_keys.h"
+#include "extract_bin_info.cc"
+#include "extract_fit_results.cc"
+#include "fit_archive.h"
+#include "profiler.h"
+#include "results_table.h"
+
+// forward declarations
+ResultsTable joined_results_table(
+    const std::vector<std::string> &fit_files, const std::vector<std::string> &bin_vector,
+    bool is_acceptance_corrected, const std::string &mass_branch,
+    const std::string &key_source = "directory", int n_threads = 0,
+    const std::string &amplitude_grammar = "", bool is_union_schema = false);
+std::vector<std::string> data_bin_keys(
+    const ResultsTable &bins, const std::vector<std::string> &bin_vector,
+    const std::string &key_source, const std::map<std::string, BinKey> &fit_keys);
+
+void extract_joined_results(
+    std::string file_path, std::string csv_name, bool is_acceptance_corrected,
+    std::string mass_branch = "M4Pi", std::string key_source = "directory",
+    int n_threads = 0, std::string amplitude_grammar = "", bool is_union_schema = false)
+{
+    profiler::Session session("extract_joined_results");
+
+    // .fit lines (and .fitpack archives) are fits, and every other line is a bin
+    std::vector<std::string> fit_files, bin_vector;
+    for (const std::string &line : read_bin_list(file_path))
+    {
+        bool is_fit = (line.size() > 4 && line.compare(line.size() - 4, 4, ".fit") == 0) ||
+                      is_fit_archive(line);
+        (is_fit ? fit_files : bin_vector).push_back(line);
+    }
+
+    ResultsTable table = joined_results_table(
+        fit_files, bin_vector, is_acceptance_corrected, mass_branch, key_source,
+        n_threads, amplitude_grammar, is_union_schema);
+    write_results(table, csv_name);
+}
+
+// The table of extract_joined_results, which analysis/extraction.py calls from Python
+ResultsTable joined_results_table(
+    const std::vector<std::string> &fit_files, const std::vector<std::string> &bin_vector,
+    bool is_acceptance_corrected, const std::string &mass_branch,
+    const std::string &key_source, int n_threads, const std::string &amplitude_grammar,
+    bool is_union_schema)
+{
+    if (key_source != "directory" && key_source != "edges")
+    {
+        std::cout << "Unknown key source \"" << key_source
+                  << "\", must be \"directory\" or \"edges\"\n";
+        exit(1);
+    }
+
+    ResultsTable fits = fit_results_table(
+        fit_files, is_acceptance_corrected, amplitude_grammar, is_union_schema);
+    ResultsTable bins = bin_info_table(bin_vector, mass_branch, n_threads);
+
+    // the key of every fit, and the fits of every key in the order of the table
+    const size_t fit_file = fits.column("file");
+    std::vector<std::string> fit_row_keys;
+    std::map<std::string, BinKey> fit_keys;
+    std::map<std::string, std::vector<size_t>> fits_by_key;
+    for (size_t row = 0; row < fits.n_rows(); ++row)
+    {
+        BinKey key = directory_bin_key(std::string(fits.get_text(fit_file, row)));
+        fit_row_keys.push_back(key.name);
+        fits_by_key[key.name].push_back(row);
+        fit_keys.emplace(key.name, key);
+    }
+    std::vector<std::string> bin_keys =
+        data_bin_keys(bins, bin_vector, key_source, fit_keys);
+
+    // bin, then the fit columns, then the bin columns
+    ResultsTable table;
+    for (const auto &entry : fits.get_metadata())
+    {
+        table.set_metadata(entry.first, entry.second);
+    }
+    table.set_metadata("extractor", "extract_joined_results");
+    table.set_metadata("key_source", key_source);
+    const size_t bin_column = table.add_column("bin", ColumnType::Text);
+    std::vector<size_t> fit_columns, bin_columns;
+    for (size_t column : fits.column_order())
+    {
+        fit_columns.push_back(
+            table.add_column(fits.column_name(column), fits.column_type(column)));
+    }
+    for (size_t column : bins.column_order())
+    {
+        const std::string &name = bins.column_name(column);
+        std::string joined_name = name == "file" ? "bin_files" : name;
+        if (table.find_column(joined_name) != ResultsTable::NO_COLUMN)
+        {
+            std::cout << "The fit results and bin information both have a column named "
+                      << joined_name << "\n";
+            exit(1);
+        }
+        bin_columns.push_back(table.add_column(joined_name, bins.column_type(column)));
+    }
+
+    // a joined row, where none stands for a missing bin or fit
+    const size_t none = ResultsTable::NO_COLUMN;
+    auto add_row = [&](const std::string &key, size_t bin_row, size_t fit_row)
+    {
+        size_t row = table.append_rows(1);
+        table.set_text(bin_column, row, key);
+        for (size_t i = 0; bin_row != none && i < bin_columns.size(); ++i)
+        {
+            table.copy_cell(bin_columns[i], row, bins, bins.column_order()[i], bin_row);
+        }
+        for (size_t i = 0; fit_row != none && i < fit_columns.size(); ++i)
+        {
+            table.copy_cell(fit_columns[i], row, fits, fits.column_order()[i], fit_row);
+        }
+    };
+
+    std::map<std::string, bool> is_key_joined;
+    for (size_t bin_row = 0; bin_row < bins.n_rows(); ++bin_row)
+    {
+        auto found = fits_by_key.find(bin_keys[bin_row]);
+        if (found == fits_by_key.end())
+        {
+            std::cout << "WARNING: no fit results for the bin " << bin_vector[bin_row]
+                      << " (key \"" << bin_keys[bin_row] << "\")\n";
+            add_row(bin_keys[bin_row], bin_row, none);
+            continue;
+        }
+        if (is_key_joined[found->first])
+        {
+            std::cout << "WARNING: the bin " << bin_vector[bin_row] << " has the same key"
+                      << " as an earlier bin, \"" << found->first << "\"\n";
+        }
+        is_key_joined[found->first] = true;
+        for (size_t fit_row : found->second)
+        {
+            add_row(found->first, bin_row, fit_row);
+        }
+    }
+    for (size_t fit_row = 0; fit_row < fits.n_rows(); ++fit_row)
+    {
+        const std::string &key = fit_row_keys[fit_row];
+        if (is_key_joined[key])
+            continue;
+        std::cout << "WARNING: no bin for the fit results "
+                  << fits.get_text(fit_file, fit_row) << " (key \"" << key << "\")\n";
+        add_row(key, none, fit_row);
+    }
+    return table;
+}
+
+// The key of every bin. The files of a bin must all have the same directory key
+std::vector<std::string> data_bin_keys(
+    const ResultsTable &bins, const std::vector<std::string> &bin_vector,
+    const std::string &key_source, const std::map<std::string, BinKey> &fit_keys)
+{
+    std::vector<std::string> keys;
+    for (size_t row = 0; row < bin_vector.size(); ++row)
+    {
+        if (key_source == "directory")
+        {
+            std::vector<std::string> files = expand_bin_definition(bin_vector[row]);
+            std::string key = directory_bin_key(files.front()).name;
+            for (const std::string &file : files)
+            {
+                if (directory_bin_key(file).name != key)
+                {
+                    std::cout << "The files of the bin " << bin_vector[row]
+                              << " are in directories of different bins\n";
+                    exit(1);
+                }
+            }
+            keys.push_back(key);
+            continue;
+        }
+
+        // the edges are rounded to 2 decimals for t and E_beam, and 3 for the mass
+        std::map<char, std::pair<std::string, double>> variables = {
+            {'t', {"t", 0.005}}, {'e', {"e", 0.005}}, {'m', {"m", 0.0005}}};
+        std::string key;
+        for (const auto &entry : fit_keys)
+        {
+            const std::vector<EdgeRange> &ranges = entry.second.ranges;
+            bool is_match = !ranges.empty();
+            for (const EdgeRange &range : ranges)
+            {
+                if (!is_match || range.variable == 0)
+                {
+                    is_match = false;
+                    break;
+                }
+                const auto &variable = variables[range.variable];
+                double low = bins.get_float(bins.column(variable.first + "_low"), row);
+                double high = bins.get_float(bins.column(variable.first + "_high"), row);
+                is_match = is_within(range, low, high, variable.second);
+            }
+            if (!is_match)
+                continue;
+            if (!key.empty())
+            {
+                std::cout << "The edges of the bin " << bin_vector[row] << " fit in both "
+                          << key << " and " << entry.first << "\n";
+                exit(1);
+            }
+            key = entry.first;
+        }
+        keys.push_back(key);
+    }
+    return keys;
+}
@@ -0,0 +1,264 @@
+/* Read-ahead of a list of input files on a separate reader thread
+
+Input files on network filesystems (like the Lustre work disks that the data/ links
+point to) take a long time to open and read, compared to the time spent parsing them.
+A FilePrefetcher reads the next files of a list, up to depth files ahead of the one
+being parsed, into memory on its own thread. Every read file is handed out as an
+anonymous in-memory file (memfd), whose path
+    /proc/self/fd/<n>
+can be opened by any reader that only takes a file name, like AmpTools' FitResults.
+Parsing then never waits on the filesystem, as long as the reader keeps ahead.
+
+Members of .fitpack archives (see fit_archive.h) are read out of their archive, which
+is only opened once, so a whole archive is read from start to end without opening any
+other file. A file that can't be read is handed out with its own path, so that the
+parser reports the error like before. Why an archive member couldn't be read is handed
+out with it, for the caller to print, since the reader thread must not exit, and an
+archive that can't be opened is only reported with its first member. On systems without
+memfd, the files are still read ahead, which leaves them in the page cache, and are
+then opened by their own path.
+Archive members have no path of their own, so they are written to a temporary file
+instead, which is removed with the PrefetchedFile.
+
+With a depth of 0 every file is read by the caller when it asks for it, without a
+thread. The reader's time is profiled as the "read" phase, and the time the caller
+spends waiting for it as "wait_read" (see profiler.h).
+*/
+
+#ifndef FILE_PREFETCHER_H
+#define FILE_PREFETCHER_H
+
+#include <fcntl.h>    // for open
+#include <sys/mman.h> // for memfd_create
+#include <unistd.h>   // for read, write, close, and unlink
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib> // for std::getenv and mkstemp
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "fit_archive.h"
+#include "profiler.h"
+
+// A file of the list, and where to open it from. Owns its in-memory copy, if any
+class PrefetchedFile
+{
+public:
+    PrefetchedFile() = default;
+    PrefetchedFile(const PrefetchedFile &) = delete;
+    PrefetchedFile &operator=(const PrefetchedFile &) = delete;
+    PrefetchedFile(PrefetchedFile &&other) noexcept { *this = std::move(other); }
+    PrefetchedFile &operator=(PrefetchedFile &&other) noexcept
+    {
+        std::swap(name, other.name);
+        std::swap(path, other.path);
+        std::swap(size, other.size);
+        std::swap(is_read, other.is_read);
+        std::swap(error, other.error);
+        std::swap(memory_fd, other.memory_fd);
+        std::swap(temporary_path, other.temporary_path);
+        return *this;
+    }
+    ~PrefetchedFile()
+    {
+        if (memory_fd >= 0)
+            close(memory_fd);
+        if (!temporary_path.empty())
+            unlink(temporary_path.c_str());
+    }
+
+    std::string name;        // as given in the list
+    std::string path;        // to open, the in-memory copy when there is one
+    std::uintmax_t size = 0; // bytes read
+    bool is_read = false;    // whether the whole file could be read
+    std::string error;       // why an archive member couldn't be read, to be reported
+    int memory_fd = -1;
+    std::string temporary_path; // of an archive member without memfd, removed with it
+};
+
+class FilePrefetcher
+{
+public:
+    FilePrefetcher(const std::vector<std::string> &files, size_t depth)
+        : files(files), depth(depth)
+    {
+        if (depth > 0)
+            reader = std::thread([this] { read_ahead(); });
+    }
+    FilePrefetcher(const FilePrefetcher &) = delete;
+    FilePrefetcher &operator=(const FilePrefetcher &) = delete;
+
+    ~FilePrefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            is_stopping = true;
+        }
+        changed.notify_all();
+        if (reader.joinable())
+            reader.join();
+    }
+
+    // The next file of the list, in order. Must be called at most once per file
+    PrefetchedFile next()
+    {
+        if (depth == 0)
+            return read_file(files[n_taken++]);
+
+        profiler::ScopedPhase waiting("wait_read", false);
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !ready.empty(); });
+        PrefetchedFile file = std::move(ready.front());
+        ready.pop_front();
+        ++n_taken;
+        lock.unlock();
+        changed.notify_all();
+        return file;
+    }
+
+private:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    const std::vector<std::string> &files;
+    size_t depth;
+    size_t n_taken = 0;
+
+    // only used by the thread reading the files
+    std::string contents;
+    std::map<std::string, std::unique_ptr<FitArchive>> archives;
+
+    std::thread reader;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<PrefetchedFile> ready;
+    bool is_stopping = false;
+
+    void read_ahead()
+    {
+        for (const std::string &name : files)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(
+                    lock, [this] { return is_stopping || ready.size() < depth; });
+                if (is_stopping)
+                    return;
+            }
+            PrefetchedFile file = read_file(name);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready.push_back(std::move(file));
+            }
+            changed.notify_all();
+        }
+    }
+
+    // read the whole file, or archive member, and copy it into an in-memory file
+    PrefetchedFile read_file(const std::string &name)
+    {
+        profiler::ScopedPhase reading("read", true, name);
+        PrefetchedFile file;
+        file.name = name;
+        file.path = name;
+        profiler::count("files", 1);
+        std::string archive, member;
+        bool is_member = split_archive_path(name, archive, member);
+        file.is_read =
+            is_member ? read_member(archive, member, file.error) : read_contents(name);
+        if (!file.is_read)
+            return file;
+        file.size = contents.size();
+        profiler::count("bytes_read", file.size);
+
+#ifdef __linux__
+        file.memory_fd = memfd_create("prefetched", MFD_CLOEXEC);
+#endif
+        if (file.memory_fd >= 0 && write_contents(file.memory_fd))
+        {
+            file.path = "/proc/self/fd/" + std::to_string(file.memory_fd);
+            return file;
+        }
+        if (!is_member)
+            return file;
+
+        // a member has no path of its own to fall back to
+        const char *directory = std::getenv("TMPDIR");
+        std::string temporary =
+            std::string(directory ? directory : "/tmp") + "/prefetched_XXXXXX";
+        int fd = mkstemp(temporary.data());
+        if (fd < 0)
+        {
+            file.is_read = false;
+            return file;
+        }
+        file.temporary_path = temporary;
+        bool is_written = write_contents(fd);
+        close(fd);
+        if (is_written)
+            file.path = temporary;
+        else
+            file.is_read = false;
+        return file;
+    }
+
+    // write all of contents to a file descriptor. Returns false if it fails
+    bool write_contents(int fd) const
+    {
+        for (size_t written = 0; written < contents.size();)
+        {
+            ssize_t n_written =
+                write(fd, contents.data() + written, contents.size() - written);
+            if (n_written <= 0)
+                return false;
+            written += n_written;
+        }
+        return true;
+    }
+
+    bool read_contents(const std::string &name)
+    {
+        int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        contents.clear();
+        ssize_t n_read;
+        do
+        {
+            size_t size = contents.size();
+            contents.resize(size + BUFFER_SIZE);
+            n_read = read(fd, contents.data() + size, BUFFER_SIZE);
+            contents.resize(size + std::max<ssize_t>(n_read, 0));
+        } while (n_read > 0);
+        close(fd);
+        return n_read == 0;
+    }
+
+    // read a member into contents, with the error to report if it can't be
+    bool read_member(
+        const std::string &archive, const std::string &member, std::string &error)
+    {
+        std::unique_ptr<FitArchive> &opened = archives[archive];
+        if (!opened)
+        {
+            opened = std::make_unique<FitArchive>(archive);
+            if (!opened->valid())
+                error = opened->get_error();
+        }
+        if (!opened->valid())
+            return false;
+        bool is_read = opened->read(member, contents);
+        if (!is_read)
+            error = opened->get_error();
+        return is_read;
+    }
+};
+
+#endif // FILE_PREFETCHER_H
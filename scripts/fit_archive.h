@@ -0,0 +1,275 @@
+/* Reading .fit files out of an indexed archive
+
+A campaign of many small .fit files, like the omegapi_N.fit files in the rand directory
+of every mass bin, spends most of its extraction time on filesystem metadata (finding,
+opening, and closing every file) on shared storage. pack_fit_files.py packs them into
+one archive, and the extraction reads the files straight from it. A member of an
+archive is named by the archive's path followed by the member's path inside of it, like
+    data/campaign.fitpack/mass_1.100-1.125/rand/omegapi_3.fit
+so the directories of the original files (and their bin keys, see bin_keys.h) are kept.
+A file list may also contain just the archive, which stands for all of its members in
+the order they were packed.
+
+The layout of a .fitpack file, with little-endian numbers, is
+    char[4]   magic "PFIT"
+    uint32    version (1)
+    uint64    number of members
+    uint64    offset of the index from the start of the file
+    the stored bytes of every member, back to back
+    the index, for every member in the order of their bytes:
+        uint32    length of the name, and the name
+        uint64    offset of the stored bytes, and their size
+        uint64    size of the original file
+        uint32    compression (0 for none, 1 for zlib)
+The index is read into a hash map when the archive is opened, after checking that it and
+every member are inside of the file, so every member is found in constant time, and
+reading the members in their packed order reads the archive from start to end.
+Compressed members need zlib, which ROOT macros load themselves, while compiled programs
+need to link it.
+*/
+
+#ifndef FIT_ARCHIVE_H
+#define FIT_ARCHIVE_H
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define FIT_ARCHIVE_ZLIB
+#ifdef __CLING__
+#pragma cling load("libz")
+#endif
+#endif
+
+const std::string FIT_ARCHIVE_EXTENSION = ".fitpack";
+
+// Whether a path is an archive itself, rather than a member of one
+bool is_fit_archive(const std::string &path)
+{
+    return path.size() > FIT_ARCHIVE_EXTENSION.size() &&
+           path.compare(
+               path.size() - FIT_ARCHIVE_EXTENSION.size(), FIT_ARCHIVE_EXTENSION.size(),
+               FIT_ARCHIVE_EXTENSION) == 0;
+}
+
+// Split the path of an archive member into the archive and the member's name. Returns
+// false if the path isn't in an archive
+bool split_archive_path(
+    const std::string &path, std::string &archive, std::string &member)
+{
+    size_t end = path.find(FIT_ARCHIVE_EXTENSION + "/");
+    if (end == std::string::npos)
+        return false;
+    end += FIT_ARCHIVE_EXTENSION.size();
+    archive = path.substr(0, end);
+    member = path.substr(end + 1);
+    return true;
+}
+
+class FitArchive
+{
+public:
+    // Open an archive and read its index. If it isn't a valid archive, it has no
+    // members, and get_error tells why
+    explicit FitArchive(const std::string &path) : path(path)
+    {
+        // large reads, since whole archives are usually read from start to end
+        buffer.resize(BUFFER_SIZE);
+        in.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        in.open(path, std::ios::binary);
+        is_valid = read_index();
+        if (!is_valid)
+        {
+            names.clear();
+            index.clear();
+        }
+    }
+
+    bool valid() const { return is_valid; }
+
+    // why the archive, or the last member that was read, couldn't be read
+    const std::string &get_error() const { return error; }
+
+    // the names of the members, in the order they are stored
+    const std::vector<std::string> &members() const { return names; }
+
+    // Read a member's original bytes. Returns false if there is no such member, or if
+    // it can't be read, which get_error then tells. Never exits, since it is called
+    // from the reader thread of a FilePrefetcher
+    bool read(const std::string &name, std::string &contents)
+    {
+        auto found = index.find(name);
+        if (found == index.end())
+            return false;
+        const Member &member = found->second;
+        error.clear();
+
+        std::string &destination = member.compression == 0 ? contents : stored;
+        destination.resize(member.stored_size);
+        // only seek when the member doesn't follow the last one, to keep reading ahead
+        if (position != member.offset)
+            in.seekg(member.offset);
+        in.read(destination.data(), member.stored_size);
+        if (!in)
+        {
+            // the next member is read from its own offset
+            in.clear();
+            position = NO_POSITION;
+            return fail("the member " + name + " is cut short");
+        }
+        position = member.offset + member.stored_size;
+        if (member.compression == 0)
+            return true;
+
+#ifdef FIT_ARCHIVE_ZLIB
+        contents.resize(member.size);
+        uLongf size = member.size;
+        if (member.compression != 1 ||
+            uncompress(
+                reinterpret_cast<Bytef *>(contents.data()), &size,
+                reinterpret_cast<const Bytef *>(stored.data()),
+                stored.size()) != Z_OK ||
+            size != member.size)
+            return fail("the member " + name + " can't be decompressed");
+        return true;
+#else
+        return fail("its members are compressed, but zlib was not found");
+#endif
+    }
+
+private:
+    static constexpr size_t BUFFER_SIZE = 4 << 20;
+    static constexpr std::uint64_t NO_POSITION = ~std::uint64_t(0);
+    static constexpr std::uint64_t HEADER_SIZE = 24;
+    // of an index entry with an empty name
+    static constexpr std::uint64_t MIN_ENTRY_SIZE = 32;
+    // the most that zlib can compress anything, about 1032:1, with some margin
+    static constexpr std::uint64_t MAX_RATIO = 1100;
+
+    struct Member
+    {
+        std::uint64_t offset = 0;
+        std::uint64_t stored_size = 0;
+        std::uint64_t size = 0;
+        std::uint32_t compression = 0;
+    };
+
+    std::string path;
+    std::vector<char> buffer;
+    std::ifstream in;
+    std::uint64_t position = NO_POSITION; // of the stream, after the last member read
+    std::vector<std::string> names;
+    std::unordered_map<std::string, Member> index;
+    std::string stored; // compressed bytes of the last member
+    bool is_valid = false;
+    std::string error;
+
+    // the constructor, which returns false at the first problem of the archive
+    bool read_index()
+    {
+        char magic[4] = {};
+        in.read(magic, 4);
+        if (!in || std::string(magic, 4) != "PFIT")
+            return fail("it is not a .fitpack archive");
+        if (read_u32() != 1)
+            return fail("its version is not supported");
+        std::uint64_t n_members = read_u64();
+        std::uint64_t index_offset = read_u64();
+
+        // every size is checked against the file before anything is allocated for it,
+        // so that a corrupt archive fails with a message rather than a bad_alloc
+        in.seekg(0, std::ios::end);
+        std::uint64_t file_size = in.tellg();
+        if (!in || index_offset < HEADER_SIZE || index_offset > file_size)
+            return fail("its index is not inside of the file");
+        std::uint64_t index_end = index_offset;
+        if (n_members > (file_size - index_offset) / MIN_ENTRY_SIZE)
+            return fail("its index is cut short");
+
+        in.seekg(index_offset);
+        names.reserve(n_members);
+        index.reserve(n_members);
+        for (std::uint64_t i = 0; i < n_members; ++i)
+        {
+            std::uint32_t name_size = read_u32();
+            index_end += MIN_ENTRY_SIZE + name_size;
+            if (!in || index_end > file_size)
+                return fail("its index is cut short");
+            std::string name(name_size, '\0');
+            in.read(name.data(), name.size());
+            Member member;
+            member.offset = read_u64();
+            member.stored_size = read_u64();
+            member.size = read_u64();
+            member.compression = read_u32();
+            if (!in)
+                return fail("its index is cut short");
+            // members are stored between the header and the index
+            if (member.offset < HEADER_SIZE || member.offset > index_offset ||
+                member.stored_size > index_offset - member.offset)
+                return fail("the member " + name + " is not inside of the file");
+            std::uint64_t max_size = member.stored_size;
+            if (member.compression != 0)
+                max_size *= MAX_RATIO;
+            if (member.size > max_size)
+                return fail("the member " + name + " has an impossible size");
+            names.push_back(name);
+            index.emplace(std::move(name), member);
+        }
+        return true;
+    }
+
+    // Record why the archive can't be read, for its user to report. Returns false
+    bool fail(const std::string &reason)
+    {
+        error = "Can't read the archive " + path + ": " + reason;
+        return false;
+    }
+
+    std::uint32_t read_u32()
+    {
+        std::uint32_t value = 0;
+        in.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    }
+
+    std::uint64_t read_u64()
+    {
+        std::uint64_t value = 0;
+        in.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    }
+};
+
+// Replace every archive of a file list with all of its members, in their packed order.
+// Exits if one of them isn't a valid archive
+std::vector<std::string> expand_fit_archives(const std::vector<std::string> &files)
+{
+    std::vector<std::string> expanded;
+    for (const std::string &file : files)
+    {
+        if (!is_fit_archive(file))
+        {
+            expanded.push_back(file);
+            continue;
+        }
+        FitArchive archive(file);
+        if (!archive.valid())
+        {
+            std::cout << archive.get_error() << "\n";
+            exit(1);
+        }
+        for (const std::string &member : archive.members())
+        {
+            expanded.push_back(file + "/" + member);
+        }
+    }
+    return expanded;
+}
+
+#endif // FIT_ARCHIVE_H
@@ -0,0 +1,384 @@
+/* Native single pass reading of FSRoot trees for the bin information
+
+FSRoot trees store the four-momentum of every final state particle as the PxP#, PyP#,
+PzP#, and EnP# branches, where # is the particle index, and the beam as PxPB, PyPB,
+PzPB, and EnPB. Rather than having FSHistogram parse and scan the tree once for each of
+the FSRoot expressions
+    abs(MASS2(meson_indices;B)) = |t|, the momentum transfer to the meson system
+    EnPB                        = beam energy
+    MASS(meson_indices)         = invariant mass of the meson system
+the branches of the meson_indices particles and the beam are read once per entry into a
+structure-of-arrays batch. The meson four-momenta are summed while loading, and the
+three quantities are computed for the whole batch in one flat loop that the compiler
+can vectorize.
+
+FSRoot trees can hold several combinations (entries) of the same event. When a ranking
+branch is given, only the entry with the lowest value of it (for example the kinematic
+fit Chi2DOF) is kept for each event. Events are identified by their Run and Event
+branches, and their entries are assumed to be contiguous, as FSRoot writes them, so the
+selection streams through the tree only holding the current best entry.
+*/
+
+#ifndef FSROOT_BIN_INFO_H
+#define FSROOT_BIN_INFO_H
+
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <sstream> // for std::istringstream
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bin_info.h"
+
+// Entries of a batch, stored as one array per component
+struct FSRootBatch
+{
+    static const size_t SIZE = 1024;
+
+    size_t n = 0;
+    std::vector<double> meson_px, meson_py, meson_pz, meson_en;
+    std::vector<double> beam_px, beam_py, beam_pz, beam_en;
+    // results of compute_kinematics
+    std::vector<double> t, e, m;
+    // px, py, pz, E of every final state particle, only filled when the reader has
+    // bound them with bind_final_state
+    std::vector<std::vector<double>> final_state;
+
+    explicit FSRootBatch(size_t n_final_state_columns = 0)
+        : final_state(n_final_state_columns, std::vector<double>(SIZE, 0.0))
+    {
+        for (auto *column : {&meson_px, &meson_py, &meson_pz, &meson_en, &beam_px,
+                             &beam_py, &beam_pz, &beam_en, &t, &e, &m})
+        {
+            column->assign(SIZE, 0.0);
+        }
+    }
+
+    bool full() const
+    {
+        return n == SIZE;
+    }
+};
+
+// Compute |t|, the beam energy, and the meson mass of every entry in the batch
+void compute_kinematics(FSRootBatch &batch)
+{
+    const double *mx = batch.meson_px.data(), *my = batch.meson_py.data(),
+                 *mz = batch.meson_pz.data(), *men = batch.meson_en.data();
+    const double *bx = batch.beam_px.data(), *by = batch.beam_py.data(),
+                 *bz = batch.beam_pz.data(), *ben = batch.beam_en.data();
+    double *t = batch.t.data(), *e = batch.e.data(), *m = batch.m.data();
+    for (size_t i = 0; i < batch.n; ++i)
+    {
+        double m2 = men[i] * men[i] - mx[i] * mx[i] - my[i] * my[i] - mz[i] * mz[i];
+        double dx = mx[i] - bx[i], dy = my[i] - by[i], dz = mz[i] - bz[i];
+        double den = men[i] - ben[i];
+        t[i] = std::abs(den * den - dx * dx - dy * dy - dz * dz);
+        e[i] = ben[i];
+        // MASS() returns 0 rather than nan for slightly negative m^2
+        m[i] = std::sqrt(m2 > 0.0 ? m2 : 0.0);
+    }
+}
+
+// Binds the four-momentum branches of the meson particles and the beam
+class FSRootReader
+{
+public:
+    // meson_indices is a comma separated list of particle indices, like "2,3,4,5"
+    bool bind(TTree *tree, const std::string &meson_indices)
+    {
+        // only read the branches we need
+        tree->SetBranchStatus("*", 0);
+        std::istringstream indices(meson_indices);
+        std::string index;
+        while (std::getline(indices, index, ','))
+        {
+            index.erase(0, index.find_first_not_of(" "));
+            index.erase(index.find_last_not_of(" ") + 1);
+            for (const char *component : {"PxP", "PyP", "PzP", "EnP"})
+            {
+                meson.push_back(std::make_unique<ScalarBranch>());
+                if (!meson.back()->bind(tree, component + index))
+                {
+                    std::cout << "Missing branch " << component << index << "\n";
+                    return false;
+                }
+            }
+        }
+        for (const char *component : {"PxPB", "PyPB", "PzPB", "EnPB"})
+        {
+            beam.push_back(std::make_unique<ScalarBranch>());
+            if (!beam.back()->bind(tree, component))
+            {
+                std::cout << "Missing branch " << component << "\n";
+                return false;
+            }
+        }
+        return !meson.empty();
+    }
+
+    // also bind the Run, Event, and ranking branches used to select one entry per event
+    bool bind_selection(TTree *tree, const std::string &rank_branch)
+    {
+        if (!run.bind(tree, "Run") || !event.bind(tree, "Event") ||
+            !rank_value.bind(tree, rank_branch))
+            return false;
+        selecting = true;
+        return true;
+    }
+
+    bool is_selecting() const
+    {
+        return selecting;
+    }
+
+    // also keep the four-momenta of the recoil followed by the meson particles, the
+    // final state order of AmpTools. Must be called after bind
+    bool bind_final_state(TTree *tree, const std::string &recoil_index)
+    {
+        for (const char *component : {"PxP", "PyP", "PzP", "EnP"})
+        {
+            recoil.push_back(std::make_unique<ScalarBranch>());
+            if (!recoil.back()->bind(tree, component + recoil_index))
+            {
+                std::cout << "Missing branch " << component << recoil_index << "\n";
+                return false;
+            }
+        }
+        for (const auto &branches : {&recoil, &meson})
+        {
+            for (const auto &branch : *branches)
+            {
+                final_state.push_back(branch.get());
+            }
+        }
+        return true;
+    }
+
+    // number of columns of FSRootBatch::final_state, 4 per particle
+    size_t final_state_columns() const
+    {
+        return final_state.size();
+    }
+
+    std::pair<double, double> event_key() const
+    {
+        return {run.value(), event.value()};
+    }
+
+    double rank() const
+    {
+        return rank_value.value();
+    }
+
+    // append the currently loaded entry to the batch
+    void load(FSRootBatch &batch) const
+    {
+        load_at(batch, batch.n++);
+    }
+
+    // write the currently loaded entry into slot i of the batch
+    void load_at(FSRootBatch &batch, size_t i) const
+    {
+        double px = 0.0, py = 0.0, pz = 0.0, en = 0.0;
+        for (size_t p = 0; p < meson.size(); p += 4)
+        {
+            px += meson[p]->value();
+            py += meson[p + 1]->value();
+            pz += meson[p + 2]->value();
+            en += meson[p + 3]->value();
+        }
+        batch.meson_px[i] = px;
+        batch.meson_py[i] = py;
+        batch.meson_pz[i] = pz;
+        batch.meson_en[i] = en;
+        batch.beam_px[i] = beam[0]->value();
+        batch.beam_py[i] = beam[1]->value();
+        batch.beam_pz[i] = beam[2]->value();
+        batch.beam_en[i] = beam[3]->value();
+        for (size_t column = 0; column < final_state.size(); ++column)
+        {
+            batch.final_state[column][i] = final_state[column]->value();
+        }
+    }
+
+private:
+    // 4 branches (px, py, pz, E) per meson particle
+    std::vector<std::unique_ptr<ScalarBranch>> meson;
+    std::vector<std::unique_ptr<ScalarBranch>> beam;
+    std::vector<std::unique_ptr<ScalarBranch>> recoil;
+    std::vector<const ScalarBranch *> final_state;
+    bool selecting = false;
+    ScalarBranch run, event, rank_value;
+};
+
+// Open an FSRoot file and bind its branches, exiting if anything is missing. A
+// non-empty rank_branch enables the best combination selection
+TTree *open_fsroot_tree(
+    const std::string &file, const std::string &nt, const std::string &meson_indices,
+    std::unique_ptr<TFile> &f, FSRootReader &reader, const std::string &rank_branch = "")
+{
+    f.reset(TFile::Open(file.c_str()));
+    TTree *tree = f ? f->Get<TTree>(nt.c_str()) : nullptr;
+    if (!tree)
+    {
+        std::cout << "'" << nt << "' tree could not be opened in file: " << file << "\n";
+        exit(1);
+    }
+    if (!reader.bind(tree, meson_indices))
+    {
+        std::cout << "Could not read the particles " << meson_indices
+                  << " from file: " << file << "\n";
+        exit(1);
+    }
+    if (!rank_branch.empty() && !reader.bind_selection(tree, rank_branch))
+    {
+        std::cout << "Could not read the Run, Event, or " << rank_branch
+                  << " branches from file: " << file << "\n";
+        exit(1);
+    }
+    return tree;
+}
+
+// Like scan_fsroot_range, but only keeping the lowest ranked entry of each event. The
+// events that start in [first, last) are processed, so that consecutive ranges split
+// the tree at event boundaries and no event is counted twice or split in two
+template <typename OnBatch>
+void scan_fsroot_events(
+    TTree *tree, const FSRootReader &reader, Long64_t first, Long64_t last,
+    OnBatch on_batch)
+{
+    Long64_t n_entries = tree->GetEntries();
+    Long64_t entry = first;
+    // skip the rest of an event that started before this range
+    if (first > 0 && first < n_entries)
+    {
+        tree->GetEntry(first - 1);
+        std::pair<double, double> previous = reader.event_key();
+        for (; entry < n_entries; ++entry)
+        {
+            tree->GetEntry(entry);
+            if (reader.event_key() != previous)
+                break;
+        }
+    }
+
+    // the best entry of the current event lives in the next free slot of the batch, and
+    // is only committed (by incrementing batch.n) once the event is complete
+    FSRootBatch batch(reader.final_state_columns());
+    bool pending = false;
+    std::pair<double, double> pending_key;
+    double pending_rank = 0.0;
+    profiler::ScopedPhase reading("read", false);
+    for (; entry < n_entries; ++entry)
+    {
+        tree->GetEntry(entry);
+        std::pair<double, double> key = reader.event_key();
+        if (pending && key == pending_key)
+        {
+            if (reader.rank() < pending_rank)
+            {
+                reader.load_at(batch, batch.n);
+                pending_rank = reader.rank();
+            }
+            continue;
+        }
+
+        // a new event, so the pending one is complete
+        if (pending)
+        {
+            pending = false;
+            if (++batch.n == FSRootBatch::SIZE)
+            {
+                reading.stop();
+                {
+                    profiler::ScopedPhase computing("compute", false);
+                    compute_kinematics(batch);
+                    on_batch(batch);
+                }
+                batch.n = 0;
+                reading.restart();
+            }
+        }
+        if (entry >= last)
+            break; // this event belongs to the next range
+        reader.load_at(batch, batch.n);
+        pending = true;
+        pending_key = key;
+        pending_rank = reader.rank();
+    }
+    reading.stop();
+    if (pending)
+        ++batch.n;
+    if (batch.n > 0)
+    {
+        profiler::ScopedPhase computing("compute", false);
+        compute_kinematics(batch);
+        on_batch(batch);
+    }
+}
+
+// Read the entries [first, last) in batches, calling on_batch(batch) once the
+// kinematics of each batch are computed
+template <typename OnBatch>
+void scan_fsroot_range(
+    TTree *tree, const FSRootReader &reader, Long64_t first, Long64_t last,
+    OnBatch on_batch)
+{
+    if (reader.is_selecting())
+    {
+        scan_fsroot_events(tree, reader, first, last, on_batch);
+        return;
+    }
+
+    // time the reading and the kinematics per batch, as timing every entry would cost
+    // more than the kinematics themselves
+    FSRootBatch batch(reader.final_state_columns());
+    profiler::ScopedPhase reading("read", false);
+    for (Long64_t entry = first; entry < last; ++entry)
+    {
+        tree->GetEntry(entry);
+        reader.load(batch);
+        if (batch.full() || entry + 1 == last)
+        {
+            reading.stop();
+            {
+                profiler::ScopedPhase computing("compute", false);
+                compute_kinematics(batch);
+                on_batch(batch);
+            }
+            batch.n = 0;
+            reading.restart();
+        }
+    }
+}
+
+// Add every entry of a computed batch to the accumulator. FSRoot entries are unweighted
+void fill_accumulator(const FSRootBatch &batch, BinAccumulator &accumulator)
+{
+    for (size_t i = 0; i < batch.n; ++i)
+    {
+        accumulator.fill(batch.t[i], batch.e[i], batch.m[i], 1.0);
+    }
+}
+
+// Accumulate every entry of an FSRoot file in one pass
+BinAccumulator process_fsroot_file(
+    const std::string &file, const std::string &nt, const std::string &meson_indices,
+    const std::string &best_combo)
+{
+    BinAccumulator accumulator;
+    std::unique_ptr<TFile> f;
+    FSRootReader reader;
+    TTree *tree = open_fsroot_tree(file, nt, meson_indices, f, reader, best_combo);
+    scan_fsroot_range(
+        tree, reader, 0, tree->GetEntries(),
+        [&](const FSRootBatch &batch) { fill_accumulator(batch, accumulator); });
+    profiler::count("events", tree->GetEntries());
+    profiler::count("bytes_read", f->GetBytesRead());
+    return accumulator;
+}
+
+#endif // FSROOT_BIN_INFO_H
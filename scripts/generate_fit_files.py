@@ -0,0 +1,273 @@
+"""Generate synthetic AmpTools .fit files for benchmarking the fit extraction.
+
+Each file holds n waves named in the vector-pseudoscalar eJPmL format, repeated over m
+reactions, along with a random (but positive definite) covariance matrix and random
+normalization integrals. The values carry no physics meaning, the files only have to be
+readable by the AmpTools FitResults class so that extract_fit_results.cc can be timed
+on fits of any size.
+
+The layout follows what FitResults::writeResults writes: the reactions with their
+amplitudes and scale parameters, the likelihood, the fitter information, the parameters
+and their covariance matrix, each reaction's normalization integrals, and the config
+file. The scale of every amplitude is written as the number 1, which FitResults reads
+like a fixed scale parameter. Whether FitResults loads the files is checked on every
+run of benchmark_fit_extraction.py, which stops without reporting any numbers when it
+rejects a generated file. If that happens with your AmpTools version, compare the output
+with one of your own .fit files.
+"""
+
+import argparse
+import os
+
+import numpy as np
+
+# orbital angular momentum letters, in the standard convention
+L_LETTERS = "SPDFGHIK"
+
+# The two coherent sums that hold each reflectivity's amplitudes, like the vec_ps_refl
+# amplitudes of halld_sim
+REFLECTIVITY_SUMS = {
+    "p": ["ImagPosSign", "RealNegSign"],
+    "m": ["RealPosSign", "ImagNegSign"],
+}
+
+
+def main(args: dict) -> None:
+    os.makedirs(args["output"], exist_ok=True)
+    rng = np.random.default_rng(args["seed"])
+    for i in range(args["files"]):
+        path = os.path.join(args["output"], f"synthetic_{i}.fit")
+        write_fit_file(path, args["waves"], args["reactions"], rng)
+    print(f"Wrote {args['files']} .fit files to {args['output']}")
+
+    return
+
+
+def wave_names(n_waves: int) -> list:
+    """The first n_waves eJPmL wave names of a vector-pseudoscalar system
+
+    Waves are ordered by L, then J, then m, then reflectivity. The parity of a vector
+    and pseudoscalar pair is (-1)^L, and J runs from |L-1| to L+1.
+
+    Args:
+        n_waves (int): number of wave names to return
+
+    Returns:
+        list: wave names like "p1p0S"
+    """
+    names = []
+    for L, letter in enumerate(L_LETTERS):
+        parity = "p" if L % 2 == 0 else "m"
+        for J in range(abs(L - 1), L + 2):
+            for m in ["m", "0", "p"]:
+                if J == 0 and m != "0":
+                    continue
+                for e in ["p", "m"]:
+                    names.append(f"{e}{J}{parity}{m}{letter}")
+                    if len(names) == n_waves:
+                        return names
+    raise ValueError(f"At most {len(names)} waves can be generated")
+
+
+def write_fit_file(
+    path: str, n_waves: int, n_reactions: int, rng: np.random.Generator
+) -> None:
+    """Write one synthetic .fit file
+
+    Args:
+        path (str): output .fit file path
+        n_waves (int): number of eJPmL waves in each reaction
+        n_reactions (int): number of reactions, which share the same waves
+        rng (np.random.Generator): random number generator for all the values
+    """
+    waves = wave_names(n_waves)
+    reactions = [f"Pol{i}" for i in range(n_reactions)]
+
+    # every wave is in both sums of its reflectivity, and its production coefficient is
+    # shared (constrained) across the sums and reactions
+    coefficients = {
+        wave: complex(rng.normal(0, 100), rng.normal(0, 100)) for wave in waves
+    }
+    amplitudes = {
+        reaction: [
+            f"{reaction}::{sum_name}::{wave}"
+            for wave in waves
+            for sum_name in REFLECTIVITY_SUMS[wave[0]]
+        ]
+        for reaction in reactions
+    }
+
+    parameters = []
+    for reaction in reactions:
+        for amplitude in amplitudes[reaction]:
+            value = coefficients[amplitude.split("::")[-1]]
+            parameters.append((f"{amplitude}_re", value.real))
+            parameters.append((f"{amplitude}_im", value.imag))
+    parameters.append(("dsratio", 0.27))
+    covariance = random_covariance(len(parameters), rng)
+
+    lines = ["*** DO NOT EDIT THIS FILE - IT IS FORMATTED FOR INPUT ***"]
+    lines.append("+++ Reactions, Amplitudes, and Scale Parameters +++")
+    lines.append(f"  {n_reactions}")
+    for reaction in reactions:
+        lines.append(f"  {reaction}\t{len(amplitudes[reaction])}")
+        lines.extend(f"  {amplitude}\t1" for amplitude in amplitudes[reaction])
+
+    likelihoods = rng.uniform(-1e5, -1e4, n_reactions)
+    lines.append("+++ Likelihood Total and Partial Sums +++")
+    lines.append(f"  {likelihoods.sum():.15g}")
+    lines.extend(f"  {r}\t{lnL:.15g}" for r, lnL in zip(reactions, likelihoods))
+
+    lines.append("+++ Fitter Information +++")
+    lines.extend(
+        [
+            "  lastMinuitCommand\t1",
+            "  lastMinuitCommandStatus\t0",
+            "  eMatrixStatus\t3",
+            "  minuitPrecision\t1e-15",
+            "  minuitStrategy\t1",
+            f"  estDistToMinimum\t{rng.uniform(0, 1e-3):.15g}",
+            f"  bestMinimum\t{likelihoods.sum():.15g}",
+        ]
+    )
+
+    lines.append("+++ Parameter Values and Errors +++")
+    lines.append(f"  {len(parameters)}")
+    lines.extend(f"  {name}\t{value:.15g}" for name, value in parameters)
+    lines.extend(
+        "  " + "\t".join(f"{value:.15g}" for value in row) for row in covariance
+    )
+
+    lines.append("+++ Normalization Integrals +++")
+    for reaction in reactions:
+        lines.append(f"  {reaction}")
+        lines.extend(normalization_integrals(amplitudes[reaction], rng))
+
+    lines.append("+++ Config File +++")
+    lines.extend(config_lines(reactions, amplitudes, coefficients))
+
+    with open(path, "w") as fit_file:
+        fit_file.write("\n".join(lines) + "\n")
+
+    return
+
+
+def random_covariance(n: int, rng: np.random.Generator) -> np.ndarray:
+    """Random positive definite covariance matrix with mild correlations
+
+    Args:
+        n (int): number of parameters
+        rng (np.random.Generator): random number generator
+
+    Returns:
+        np.ndarray: n x n covariance matrix
+    """
+    sigma = rng.uniform(1, 20, n)
+    factors = rng.normal(0, 0.3, (n, min(n, 8)))
+    correlation = factors @ factors.T + np.eye(n)
+    scale = np.sqrt(np.diag(correlation))
+    correlation /= np.outer(scale, scale)
+    return correlation * np.outer(sigma, sigma)
+
+
+def normalization_integrals(amplitudes: list, rng: np.random.Generator) -> list:
+    """Lines of one reaction's generated and accepted normalization integral matrices
+
+    Only amplitudes in the same coherent sum interfere, so all other elements are 0.
+
+    Args:
+        amplitudes (list): full amplitude names of the reaction
+        rng (np.random.Generator): random number generator
+
+    Returns:
+        list: lines in the NormIntInterface cache format
+    """
+    n = len(amplitudes)
+    sums = [amplitude.split("::")[1] for amplitude in amplitudes]
+    n_generated = int(rng.integers(1e6, 1e7))
+    n_accepted = int(n_generated * rng.uniform(0.1, 0.4))
+    lines = [f"{n_generated}\t{n_accepted}", f"{n}"]
+    lines.extend(amplitudes)
+    for efficiency in [1.0, n_accepted / n_generated]:
+        matrix = np.zeros((n, n), dtype=complex)
+        for i in range(n):
+            matrix[i, i] = efficiency * rng.uniform(0.5, 1.5)
+            for j in range(i):
+                if sums[i] == sums[j]:
+                    value = efficiency * complex(*rng.normal(0, 0.05, 2))
+                    matrix[i, j] = value
+                    matrix[j, i] = value.conjugate()
+        lines.extend(
+            "\t".join(f"({v.real:.15g},{v.imag:.15g})" for v in row) for row in matrix
+        )
+    return lines
+
+
+def config_lines(reactions: list, amplitudes: dict, coefficients: dict) -> list:
+    """The AmpTools config file that would have produced the synthetic fit
+
+    Args:
+        reactions (list): reaction names
+        amplitudes (dict): full amplitude names of each reaction
+        coefficients (dict): production coefficient of each eJPmL wave
+
+    Returns:
+        list: config file lines
+    """
+    lines = ["fit synthetic", "parameter dsratio 0.27"]
+    for reaction in reactions:
+        lines.append(f"reaction {reaction} Beam Proton Pi0 Pi0 Pi+ Pi-")
+        for sum_name in sorted({a.split("::")[1] for a in amplitudes[reaction]}):
+            lines.append(f"sum {reaction} {sum_name}")
+        for amplitude in amplitudes[reaction]:
+            value = coefficients[amplitude.split("::")[-1]]
+            lines.append(f"amplitude {amplitude} Uniform")
+            lines.append(
+                f"initialize {amplitude} cartesian {value.real:.15g} {value.imag:.15g}"
+            )
+    # constrain every wave to its first occurrence
+    first = {}
+    for reaction in reactions:
+        for amplitude in amplitudes[reaction]:
+            wave = amplitude.split("::")[-1]
+            if wave in first:
+                lines.append(f"constrain {first[wave]} {amplitude}")
+            else:
+                first[wave] = amplitude
+    return lines
+
+
+def parse_args() -> dict:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument(
+        "-o", "--output", required=True, help="Directory to write the .fit files to"
+    )
+    parser.add_argument(
+        "-n", "--files", type=int, default=10, help="Number of .fit files to write"
+    )
+    parser.add_argument(
+        "-w",
+        "--waves",
+        type=int,
+        default=8,
+        help="Number of eJPmL waves in each reaction. Defaults to 8",
+    )
+    parser.add_argument(
+        "-r",
+        "--reactions",
+        type=int,
+        default=4,
+        help=(
+            "Number of reactions, e.g. polarization orientations, that share the same"
+            " waves. Defaults to 4"
+        ),
+    )
+    parser.add_argument(
+        "--seed", type=int, default=0, help="Random seed for all generated values"
+    )
+    return vars(parser.parse_args())
+
+
+if __name__ == "__main__":
+    args = parse_args()
+    main(args)
@@ -0,0 +1,397 @@
+/* Generate omega pi0 pseudo-data in the flat 'kin' tree format, split into mass bins
+
+This produces toy data like the files in data/, at any size, to test the plotting and to
+benchmark the bin extraction on large samples. Every event has the branches
+    t, E_Beam, M4Pi, Weight, cosTheta, phi, cosTheta_H, phi_H, Phi
+and the events are written into the data/ layout
+    output_dir/mass_<low>-<high>/anglesOmegaPiAmplitude.root
+along with output_dir/bins.txt, which lists the files in the format that
+convert_to_csv.py and extract_bin_info.cc expect.
+
+The model is a toy: the intensity is
+    I = |sum_waves c * BW_R(M4Pi) * Y_lm(cosTheta, phi) * Y_1lambda(cosTheta_H, phi_H)|^2
+where BW_R is a fixed width relativistic Breit-Wigner of the wave's resonance, and c its
+complex coupling. |t| follows exp(-slope |t|), and E_Beam and Phi are uniform. The model
+is read from a text file, where lines starting with # are comments:
+    mass_range  1.1 1.3 0.025       low, high, and bin width of M4Pi
+    t_range     0.3 0.5 5.0         low and high |t|, and the exponential slope
+    beam_energy 8.2 8.8             low and high beam energy
+    resonance   b1 1.2295 0.142     name, mass, width
+    resonance   rho 1.465 0.4
+    wave        b1 1 0 0 1.0 0.0    resonance, l, m, lambda, Re(c), Im(c)
+    wave        rho 1 1 1 0.5 0.2
+The mass_range, t_range, and beam_energy lines are optional, and default to the values
+above.
+
+Events are drawn by accept-reject against the maximum intensity, which is estimated
+from a scan of the phase space beforehand. The requested events are split into chunks,
+and each chunk has its own random number stream seeded from (seed, chunk index), so the
+output is the same regardless of the number of threads. The threads write each bin
+through a TBufferMerger, so they never wait on each other while filling.
+
+Example:
+    root -l -b -q 'scripts/generate_toy_data.cc("toy_model.txt", "toy", 100000000)'
+*/
+
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread> // for std::thread::hardware_concurrency
+#include <vector>
+
+#include "ROOT/TBufferMerger.hxx"
+#include "ROOT/TSeq.hxx"
+#include "ROOT/TThreadExecutor.hxx"
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+// accepted events generated by each chunk, with its own random number stream
+const Long64_t CHUNK_EVENTS = 1000000;
+// number of phase space points scanned for the maximum intensity, and the safety factor
+// the largest value found is multiplied by
+const Long64_t MAX_SCAN_POINTS = 1000000;
+const double MAX_SAFETY = 1.5;
+// entries each bin's tree buffers before passing its baskets to the merger
+const Long64_t FLUSH_ENTRIES = 100000;
+
+struct ToyResonance
+{
+    std::string name;
+    double mass, width;
+
+    std::complex<double> breit_wigner(double m) const
+    {
+        return 1.0 / std::complex<double>(mass * mass - m * m, -mass * width);
+    }
+};
+
+struct ToyWave
+{
+    size_t resonance;
+    int l, m, lambda;
+    std::complex<double> coupling;
+};
+
+struct ToyEvent
+{
+    double t, e_beam, mass, cos_theta, phi, cos_theta_h, phi_h, big_phi;
+};
+
+// Y_lm(theta, phi) for any sign of m
+std::complex<double> spherical_harmonic(int l, int m, double cos_theta, double phi)
+{
+    double y = std::sph_legendre(l, std::abs(m), std::acos(cos_theta));
+    if (m < 0 && m % 2 != 0)
+        y = -y;
+    return y * std::polar(1.0, m * phi);
+}
+
+struct ToyModel
+{
+    double mass_low = 1.1, mass_high = 1.3, bin_width = 0.025;
+    double t_low = 0.3, t_high = 0.5, t_slope = 5.0;
+    double e_low = 8.2, e_high = 8.8;
+    std::vector<ToyResonance> resonances;
+    std::vector<ToyWave> waves;
+
+    size_t n_bins() const
+    {
+        return static_cast<size_t>(std::round((mass_high - mass_low) / bin_width));
+    }
+
+    double intensity(const ToyEvent &event) const
+    {
+        std::complex<double> amplitude = 0.0;
+        for (const auto &wave : waves)
+        {
+            amplitude += wave.coupling *
+                         resonances[wave.resonance].breit_wigner(event.mass) *
+                         spherical_harmonic(wave.l, wave.m, event.cos_theta, event.phi) *
+                         spherical_harmonic(1, wave.lambda, event.cos_theta_h, event.phi_h);
+        }
+        return std::norm(amplitude);
+    }
+
+    // Draw the kinematics from the proposal distribution. Everything is uniform except
+    // |t|, whose exponential does not depend on the waves and so is sampled directly
+    ToyEvent propose(std::mt19937_64 &rng) const
+    {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        ToyEvent event;
+        double u = uniform(rng);
+        event.t = t_low - std::log(1.0 - u * (1.0 - std::exp(-t_slope * (t_high - t_low)))) /
+                              t_slope;
+        event.e_beam = e_low + (e_high - e_low) * uniform(rng);
+        event.mass = mass_low + (mass_high - mass_low) * uniform(rng);
+        event.cos_theta = 2.0 * uniform(rng) - 1.0;
+        event.phi = M_PI * (2.0 * uniform(rng) - 1.0);
+        event.cos_theta_h = 2.0 * uniform(rng) - 1.0;
+        event.phi_h = M_PI * (2.0 * uniform(rng) - 1.0);
+        event.big_phi = M_PI * (2.0 * uniform(rng) - 1.0);
+        return event;
+    }
+};
+
+// Branch buffers of one bin's output tree
+struct ToyTreeWriter
+{
+    std::shared_ptr<ROOT::TBufferMergerFile> file;
+    TTree *tree = nullptr;
+    Float_t t, e_beam, mass, weight = 1.0, cos_theta, phi, cos_theta_h, phi_h, big_phi;
+
+    void open(ROOT::TBufferMerger &merger)
+    {
+        file = merger.GetFile();
+        // owned by the merger file, which deletes it when closed
+        tree = new TTree("kin", "kin");
+        tree->SetDirectory(file.get());
+        tree->SetAutoFlush(FLUSH_ENTRIES);
+        tree->Branch("t", &t, "t/F");
+        tree->Branch("E_Beam", &e_beam, "E_Beam/F");
+        tree->Branch("M4Pi", &mass, "M4Pi/F");
+        tree->Branch("Weight", &weight, "Weight/F");
+        tree->Branch("cosTheta", &cos_theta, "cosTheta/F");
+        tree->Branch("phi", &phi, "phi/F");
+        tree->Branch("cosTheta_H", &cos_theta_h, "cosTheta_H/F");
+        tree->Branch("phi_H", &phi_h, "phi_H/F");
+        tree->Branch("Phi", &big_phi, "Phi/F");
+    }
+
+    void fill(const ToyEvent &event)
+    {
+        t = event.t;
+        e_beam = event.e_beam;
+        mass = event.mass;
+        cos_theta = event.cos_theta;
+        phi = event.phi;
+        cos_theta_h = event.cos_theta_h;
+        phi_h = event.phi_h;
+        big_phi = event.big_phi;
+        tree->Fill();
+    }
+};
+
+// forward declarations
+ToyModel read_toy_model(const std::string &model_path);
+std::string bin_directory(const ToyModel &model, size_t bin);
+double scan_max_intensity(const ToyModel &model, unsigned int seed);
+Long64_t generate_chunk(
+    const ToyModel &model, double max_intensity, Long64_t n_events, unsigned int seed,
+    size_t chunk, std::vector<std::unique_ptr<ROOT::TBufferMerger>> &mergers,
+    std::atomic<Long64_t> &n_over_max);
+
+// n_threads = 0 uses all available cores
+void generate_toy_data(
+    std::string model_path, std::string output_dir, Long64_t n_events,
+    int n_threads = 0, unsigned int seed = 0)
+{
+    ToyModel model = read_toy_model(model_path);
+
+    // one merger, and so one output file, per mass bin
+    std::vector<std::unique_ptr<ROOT::TBufferMerger>> mergers;
+    gSystem->mkdir(output_dir.c_str(), true);
+    std::ofstream bin_list(output_dir + "/bins.txt");
+    if (!bin_list.is_open())
+    {
+        std::cout << "Can't write the bin list " << output_dir << "/bins.txt\n";
+        exit(1);
+    }
+    ROOT::EnableThreadSafety();
+    for (size_t bin = 0; bin < model.n_bins(); ++bin)
+    {
+        std::string directory = output_dir + "/" + bin_directory(model, bin);
+        gSystem->mkdir(directory.c_str(), true);
+        std::string file = directory + "/anglesOmegaPiAmplitude.root";
+        mergers.push_back(std::make_unique<ROOT::TBufferMerger>(file.c_str()));
+        bin_list << file << "\n";
+    }
+    bin_list.close();
+
+    double max_intensity = MAX_SAFETY * scan_max_intensity(model, seed);
+    size_t n_chunks = (n_events + CHUNK_EVENTS - 1) / CHUNK_EVENTS;
+    std::atomic<Long64_t> n_over_max(0);
+    auto generate = [&](unsigned int chunk)
+    {
+        Long64_t chunk_events =
+            std::min<Long64_t>(CHUNK_EVENTS, n_events - chunk * CHUNK_EVENTS);
+        return generate_chunk(
+            model, max_intensity, chunk_events, seed, chunk, mergers, n_over_max);
+    };
+
+    std::vector<Long64_t> tried;
+    if (n_threads == 1 || n_chunks <= 1)
+    {
+        for (unsigned int chunk = 0; chunk < n_chunks; ++chunk)
+        {
+            tried.push_back(generate(chunk));
+        }
+    }
+    else
+    {
+        ROOT::TThreadExecutor pool(n_threads);
+        tried = pool.Map(generate, ROOT::TSeqU(n_chunks));
+    }
+    // closing the mergers writes out the last of the queued baskets
+    mergers.clear();
+
+    Long64_t n_tried = 0;
+    for (Long64_t n : tried)
+    {
+        n_tried += n;
+    }
+    std::cout << "Generated " << n_events << " events in " << model.n_bins()
+              << " bins, with an acceptance of "
+              << (n_tried > 0 ? static_cast<double>(n_events) / n_tried : 0.0) << "\n";
+    if (n_over_max > 0)
+    {
+        std::cout << "WARNING: " << n_over_max
+                  << " proposals exceeded the maximum intensity, so the peaks of the "
+                     "distribution are slightly undersampled. Increase MAX_SAFETY\n";
+    }
+}
+
+ToyModel read_toy_model(const std::string &model_path)
+{
+    std::ifstream model_file(model_path);
+    if (!model_file.is_open())
+    {
+        std::cout << "Could not open model file: " << model_path << "\n";
+        exit(1);
+    }
+
+    ToyModel model;
+    std::string line;
+    while (std::getline(model_file, line))
+    {
+        std::istringstream fields(line);
+        std::string keyword;
+        if (!(fields >> keyword) || keyword[0] == '#')
+            continue;
+
+        bool valid = true;
+        if (keyword == "mass_range")
+            valid = static_cast<bool>(
+                fields >> model.mass_low >> model.mass_high >> model.bin_width);
+        else if (keyword == "t_range")
+            valid = static_cast<bool>(fields >> model.t_low >> model.t_high >> model.t_slope);
+        else if (keyword == "beam_energy")
+            valid = static_cast<bool>(fields >> model.e_low >> model.e_high);
+        else if (keyword == "resonance")
+        {
+            ToyResonance resonance;
+            valid = static_cast<bool>(
+                fields >> resonance.name >> resonance.mass >> resonance.width);
+            model.resonances.push_back(resonance);
+        }
+        else if (keyword == "wave")
+        {
+            std::string name;
+            ToyWave wave;
+            double re, im;
+            valid = static_cast<bool>(
+                fields >> name >> wave.l >> wave.m >> wave.lambda >> re >> im);
+            valid = valid && std::abs(wave.m) <= wave.l && std::abs(wave.lambda) <= 1;
+            wave.coupling = std::complex<double>(re, im);
+            wave.resonance = model.resonances.size();
+            for (size_t i = 0; i < model.resonances.size(); ++i)
+            {
+                if (model.resonances[i].name == name)
+                    wave.resonance = i;
+            }
+            if (wave.resonance == model.resonances.size())
+            {
+                std::cout << "Resonance " << name
+                          << " must be defined before its waves, in line: " << line << "\n";
+                exit(1);
+            }
+            model.waves.push_back(wave);
+        }
+        else
+            valid = false;
+
+        if (!valid)
+        {
+            std::cout << "Invalid line in model file: " << line << "\n";
+            exit(1);
+        }
+    }
+    if (model.waves.empty() || model.n_bins() == 0)
+    {
+        std::cout << "Model file needs at least one wave and one mass bin: " << model_path
+                  << "\n";
+        exit(1);
+    }
+    return model;
+}
+
+// "mass_1.100-1.125", like the directories in data/
+std::string bin_directory(const ToyModel &model, size_t bin)
+{
+    std::ostringstream name;
+    name << std::fixed << std::setprecision(3) << "mass_"
+         << model.mass_low + bin * model.bin_width << "-"
+         << model.mass_low + (bin + 1) * model.bin_width;
+    return name.str();
+}
+
+// Largest intensity found in a random scan of the phase space
+double scan_max_intensity(const ToyModel &model, unsigned int seed)
+{
+    std::seed_seq seeds{seed, 0xFFFFFFFFu};
+    std::mt19937_64 rng(seeds);
+    double max_intensity = 0.0;
+    for (Long64_t i = 0; i < MAX_SCAN_POINTS; ++i)
+    {
+        max_intensity = std::max(max_intensity, model.intensity(model.propose(rng)));
+    }
+    return max_intensity;
+}
+
+// Generate n_events accepted events with the random stream of this chunk, returning how
+// many proposals were needed
+Long64_t generate_chunk(
+    const ToyModel &model, double max_intensity, Long64_t n_events, unsigned int seed,
+    size_t chunk, std::vector<std::unique_ptr<ROOT::TBufferMerger>> &mergers,
+    std::atomic<Long64_t> &n_over_max)
+{
+    std::seed_seq seeds{seed, static_cast<unsigned int>(chunk)};
+    std::mt19937_64 rng(seeds);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<ToyTreeWriter> writers(mergers.size());
+    for (size_t bin = 0; bin < mergers.size(); ++bin)
+    {
+        writers[bin].open(*mergers[bin]);
+    }
+
+    Long64_t n_accepted = 0, n_tried = 0, n_over = 0;
+    while (n_accepted < n_events)
+    {
+        ToyEvent event = model.propose(rng);
+        ++n_tried;
+        double intensity = model.intensity(event);
+        if (intensity > max_intensity)
+            ++n_over;
+        if (uniform(rng) * max_intensity >= intensity)
+            continue;
+        size_t bin = std::min<size_t>(
+            (event.mass - model.mass_low) / model.bin_width, writers.size() - 1);
+        writers[bin].fill(event);
+        ++n_accepted;
+    }
+
+    for (auto &writer : writers)
+    {
+        writer.file->Write();
+    }
+    n_over_max += n_over;
+    return n_tried;
+}
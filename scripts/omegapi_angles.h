@@ -0,0 +1,261 @@
+/* Batched production and decay angles of gamma p -> omega pi0 p, omega -> pi+ pi- pi0
+
+For every event this computes the same angles as the omegapi amplitudes of halld_sim,
+which are what the anglesOmegaPiAmplitude.root files carry:
+    cos_theta, phi     direction of the omega in the helicity frame of the omega pi0
+                       resonance, whose z axis is opposite to the recoil and y axis the
+                       normal to the production plane (beam x z)
+    cos_theta_h, phi_h direction of the omega decay plane normal, pi+ x pi- in the omega
+                       rest frame, in the omega helicity frame (z along the omega, y along
+                       z_resonance x z_omega)
+    big_phi            angle between the beam polarization and the production plane
+All angles are in radians.
+
+Rather than boosting TLorentzVectors one event at a time, the four-vectors are stored
+as one array per component and the boosts, cross products, and projections run in a
+flat, branch free loop over the batch that the compiler can vectorize. The atan2 calls
+are split into their own loop, so they do not stop the rest from being vectorized. Note
+that the loop is only vectorized when sqrt does not have to set errno, so compile with
+-fno-math-errno, for example through ACLiC with
+    gSystem->SetFlagsOpt("-O3 -fno-math-errno"); .L scripts/benchmark_omegapi_angles.cc+
+
+The particles are loaded from the final state order of the AmpTools omegapi configs,
+    recoil, bachelor pi0, omega pi0, pi+, pi-
+which is what convert_fsroot_to_flat.cc writes when given the meson particles in that
+order, so the same columns work for FSRoot batches and flat trees.
+*/
+
+#ifndef OMEGAPI_ANGLES_H
+#define OMEGAPI_ANGLES_H
+
+#include <cmath>
+#include <vector>
+
+// one array per four-vector component
+struct FourVectorColumns
+{
+    std::vector<double> px, py, pz, e;
+
+    void resize(size_t n)
+    {
+        for (auto *column : {&px, &py, &pz, &e})
+        {
+            column->assign(n, 0.0);
+        }
+    }
+
+    void set(size_t i, double x, double y, double z, double energy)
+    {
+        px[i] = x;
+        py[i] = y;
+        pz[i] = z;
+        e[i] = energy;
+    }
+};
+
+struct OmegaPiBatch
+{
+    static const size_t SIZE = 1024;
+
+    size_t n = 0;
+    FourVectorColumns beam, recoil, bachelor, omega_pi0, pi_plus, pi_minus;
+    // results of compute_omegapi_angles
+    std::vector<double> cos_theta, phi, cos_theta_h, phi_h, big_phi;
+
+    OmegaPiBatch()
+    {
+        for (auto *particle : {&beam, &recoil, &bachelor, &omega_pi0, &pi_plus, &pi_minus})
+        {
+            particle->resize(SIZE);
+        }
+        for (auto *column : {&cos_theta, &phi, &cos_theta_h, &phi_h, &big_phi})
+        {
+            column->assign(SIZE, 0.0);
+        }
+        for (auto *column : {&phi_x, &phi_y, &phi_h_x, &phi_h_y, &big_phi_x, &big_phi_y})
+        {
+            column->assign(SIZE, 0.0);
+        }
+    }
+
+    // x and y projections handed from the vectorized loop to the atan2 loop
+    std::vector<double> phi_x, phi_y, phi_h_x, phi_h_y, big_phi_x, big_phi_y;
+};
+
+namespace omegapi_detail
+{
+// Boost (e, x, y, z) into the rest frame of a system with velocity (bx, by, bz)
+inline void boost_to_rest(
+    double bx, double by, double bz, double &e, double &x, double &y, double &z)
+{
+    double b2 = bx * bx + by * by + bz * bz;
+    double gamma = 1.0 / std::sqrt(1.0 - b2);
+    double bp = bx * x + by * y + bz * z;
+    // (gamma - 1) / b2, written without the branch for b2 = 0
+    double gamma2 = gamma * gamma / (gamma + 1.0);
+    double scale = gamma2 * bp - gamma * e;
+    x += scale * bx;
+    y += scale * by;
+    z += scale * bz;
+    e = gamma * (e - bp);
+}
+
+// read-only view of the columns of a FourVectorColumns
+struct ConstColumns
+{
+    const double *px, *py, *pz, *e;
+
+    explicit ConstColumns(const FourVectorColumns &columns)
+        : px(columns.px.data()), py(columns.py.data()), pz(columns.pz.data()),
+          e(columns.e.data())
+    {
+    }
+};
+
+inline void cross(
+    double ax, double ay, double az, double bx, double by, double bz, double &cx,
+    double &cy, double &cz)
+{
+    cx = ay * bz - az * by;
+    cy = az * bx - ax * bz;
+    cz = ax * by - ay * bx;
+}
+
+inline void normalize(double &x, double &y, double &z)
+{
+    // the tiny offset leaves a zero vector at zero instead of dividing by zero, and is
+    // added rather than a std::max so the loops stay branch free
+    double inverse = 1.0 / std::sqrt(x * x + y * y + z * z + 1e-300);
+    x *= inverse;
+    y *= inverse;
+    z *= inverse;
+}
+} // namespace omegapi_detail
+
+// Compute the angles of every event in the batch. polarization_angle is the lab angle
+// of the beam polarization plane in degrees, as in the AmpTools config files
+void compute_omegapi_angles(OmegaPiBatch &batch, double polarization_angle)
+{
+    using namespace omegapi_detail;
+    const double eps_x = std::cos(polarization_angle * M_PI / 180.0);
+    const double eps_y = std::sin(polarization_angle * M_PI / 180.0);
+
+    // plain pointers, so the compiler knows the loop bound and columns don't change
+    const size_t n = batch.n;
+    ConstColumns beam(batch.beam), recoil(batch.recoil), bachelor(batch.bachelor),
+        omega_pi0(batch.omega_pi0), pi_plus(batch.pi_plus), pi_minus(batch.pi_minus);
+    double *cos_theta = batch.cos_theta.data(), *cos_theta_h = batch.cos_theta_h.data();
+    double *phi_x = batch.phi_x.data(), *phi_y = batch.phi_y.data(),
+           *phi_h_x = batch.phi_h_x.data(), *phi_h_y = batch.phi_h_y.data(),
+           *big_phi_x = batch.big_phi_x.data(), *big_phi_y = batch.big_phi_y.data();
+    double *phi = batch.phi.data(), *phi_h = batch.phi_h.data(),
+           *big_phi = batch.big_phi.data();
+
+    // every column is its own allocation, so there are too many input / output pairs
+    // for the compilers' runtime overlap checks. Tell them the iterations are independent
+#if defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#elif defined(__GNUC__)
+#pragma GCC ivdep
+#endif
+    for (size_t i = 0; i < n; ++i)
+    {
+        // omega and resonance four-vectors in the lab
+        double w_e = omega_pi0.e[i] + pi_plus.e[i] + pi_minus.e[i];
+        double w_x = omega_pi0.px[i] + pi_plus.px[i] + pi_minus.px[i];
+        double w_y = omega_pi0.py[i] + pi_plus.py[i] + pi_minus.py[i];
+        double w_z = omega_pi0.pz[i] + pi_plus.pz[i] + pi_minus.pz[i];
+        double x_e = w_e + bachelor.e[i];
+        double x_x = w_x + bachelor.px[i];
+        double x_y = w_y + bachelor.py[i];
+        double x_z = w_z + bachelor.pz[i];
+
+        // The production plane normal is unchanged by the boosts along the beam and
+        // along the resonance, so the lab beam x (-recoil) can be used in every frame
+        double b_x = beam.px[i], b_y = beam.py[i], b_z = beam.pz[i];
+        double y_x, y_y, y_z;
+        cross(b_x, b_y, b_z, -recoil.px[i], -recoil.py[i],
+              -recoil.pz[i], y_x, y_y, y_z);
+        normalize(y_x, y_y, y_z);
+
+        // polarization angle: atan2(y . eps, beam_unit . (eps x y))
+        double bu_x = b_x, bu_y = b_y, bu_z = b_z;
+        normalize(bu_x, bu_y, bu_z);
+        double ey_x, ey_y, ey_z;
+        cross(eps_x, eps_y, 0.0, y_x, y_y, y_z, ey_x, ey_y, ey_z);
+        big_phi_y[i] = y_x * eps_x + y_y * eps_y;
+        big_phi_x[i] = bu_x * ey_x + bu_y * ey_y + bu_z * ey_z;
+
+        // boost the recoil and omega into the resonance rest frame
+        double v_x = x_x / x_e, v_y = x_y / x_e, v_z = x_z / x_e;
+        double r_e = recoil.e[i], r_x = recoil.px[i],
+               r_y = recoil.py[i], r_z = recoil.pz[i];
+        boost_to_rest(v_x, v_y, v_z, r_e, r_x, r_y, r_z);
+        double wr_e = w_e, wr_x = w_x, wr_y = w_y, wr_z = w_z;
+        boost_to_rest(v_x, v_y, v_z, wr_e, wr_x, wr_y, wr_z);
+
+        // helicity frame of the resonance
+        double z_x = -r_x, z_y = -r_y, z_z = -r_z;
+        normalize(z_x, z_y, z_z);
+        double xa_x, xa_y, xa_z;
+        cross(y_x, y_y, y_z, z_x, z_y, z_z, xa_x, xa_y, xa_z);
+
+        double wu_x = wr_x, wu_y = wr_y, wu_z = wr_z;
+        normalize(wu_x, wu_y, wu_z);
+        cos_theta[i] = wu_x * z_x + wu_y * z_y + wu_z * z_z;
+        phi_y[i] = wu_x * y_x + wu_y * y_y + wu_z * y_z;
+        phi_x[i] = wu_x * xa_x + wu_y * xa_y + wu_z * xa_z;
+
+        // pi+ and pi- in the omega rest frame, going through the resonance frame
+        double wv_x = wr_x / wr_e, wv_y = wr_y / wr_e, wv_z = wr_z / wr_e;
+        double pp_e = pi_plus.e[i], pp_x = pi_plus.px[i],
+               pp_y = pi_plus.py[i], pp_z = pi_plus.pz[i];
+        boost_to_rest(v_x, v_y, v_z, pp_e, pp_x, pp_y, pp_z);
+        boost_to_rest(wv_x, wv_y, wv_z, pp_e, pp_x, pp_y, pp_z);
+        double pm_e = pi_minus.e[i], pm_x = pi_minus.px[i],
+               pm_y = pi_minus.py[i], pm_z = pi_minus.pz[i];
+        boost_to_rest(v_x, v_y, v_z, pm_e, pm_x, pm_y, pm_z);
+        boost_to_rest(wv_x, wv_y, wv_z, pm_e, pm_x, pm_y, pm_z);
+
+        // helicity frame of the omega
+        double yh_x, yh_y, yh_z;
+        cross(z_x, z_y, z_z, wu_x, wu_y, wu_z, yh_x, yh_y, yh_z);
+        normalize(yh_x, yh_y, yh_z);
+        double xh_x, xh_y, xh_z;
+        cross(yh_x, yh_y, yh_z, wu_x, wu_y, wu_z, xh_x, xh_y, xh_z);
+
+        double n_x, n_y, n_z;
+        cross(pp_x, pp_y, pp_z, pm_x, pm_y, pm_z, n_x, n_y, n_z);
+        normalize(n_x, n_y, n_z);
+        cos_theta_h[i] = n_x * wu_x + n_y * wu_y + n_z * wu_z;
+        phi_h_y[i] = n_x * yh_x + n_y * yh_y + n_z * yh_z;
+        phi_h_x[i] = n_x * xh_x + n_y * xh_y + n_z * xh_z;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        phi[i] = std::atan2(phi_y[i], phi_x[i]);
+        phi_h[i] = std::atan2(phi_h_y[i], phi_h_x[i]);
+        big_phi[i] = std::atan2(big_phi_y[i], big_phi_x[i]);
+    }
+}
+
+// Load slot i of an omegapi batch from the beam and the final state four-vectors
+// (px, py, pz, E per particle) of another batch, in the AmpTools omegapi order
+template <typename Batch>
+void load_omegapi(OmegaPiBatch &batch, size_t i, const Batch &source, size_t j)
+{
+    batch.beam.set(
+        i, source.beam_px[j], source.beam_py[j], source.beam_pz[j], source.beam_en[j]);
+    FourVectorColumns *particles[] = {
+        &batch.recoil, &batch.bachelor, &batch.omega_pi0, &batch.pi_plus,
+        &batch.pi_minus};
+    for (size_t p = 0; p < 5; ++p)
+    {
+        particles[p]->set(
+            i, source.final_state[4 * p][j], source.final_state[4 * p + 1][j],
+            source.final_state[4 * p + 2][j], source.final_state[4 * p + 3][j]);
+    }
+}
+
+#endif // OMEGAPI_ANGLES_H
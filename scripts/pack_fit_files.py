@@ -0,0 +1,267 @@
+"""Pack many small AmpTools .fit files into one indexed .fitpack archive, and back.
+
+Opening tens of thousands of small files on shared storage is dominated by metadata
+operations, not by reading them. An archive stores all the files in one, optionally
+zlib compressed, file with an index at its end, so that extract_fit_results.cc (and
+convert_to_csv.py) can read them without touching the filesystem for every fit. See
+fit_archive.h for the layout. For example:
+
+    python pack_fit_files.py pack -i "data/*/rand/*.fit" -o data/rand.fitpack -z
+    python convert_to_csv.py -i data/rand.fitpack -o rand_fits.csv
+
+The members are named by their path relative to --base (by default the common
+directory of all files), so a member of the archive above is addressed like
+data/rand.fitpack/mass_1.100-1.125/rand/omegapi_3.fit in a file list, which keeps the
+bin directories of the original files. The files are packed in the same order that
+convert_to_csv.py sorts them, and the archive as a whole stands for all of its members
+in that order.
+"""
+
+import argparse
+import glob
+import os
+import struct
+import zlib
+from typing import List, Tuple
+
+from convert_to_csv import sort_input_files
+
+MAGIC = b"PFIT"
+VERSION = 1
+HEADER = "<4sIQQ"  # magic, version, number of members, offset of the index
+INDEX_ENTRY = "<QQQI"  # offset, stored size, size, compression
+NO_COMPRESSION, ZLIB = 0, 1
+
+
+def main(args: dict) -> None:
+    if args["command"] == "pack":
+        files = find_files(args["input"])
+        if args["sorted"]:
+            files = sort_input_files(files, args["sort_index"])
+        base = args["base"] or os.path.commonpath(
+            [os.path.dirname(os.path.abspath(file)) for file in files]
+        )
+        names = [os.path.relpath(os.path.abspath(file), base) for file in files]
+        if any(name.startswith("..") for name in names):
+            raise ValueError(f"All files must be inside of the base directory {base}")
+        size = pack(args["output"], files, names, args["compress"])
+        print(f"Packed {len(files)} files into {args['output']} ({size} bytes)")
+    elif args["command"] == "unpack":
+        index = read_index(args["archive"])
+        # checked before writing anything, so that a bad archive leaves no files behind
+        paths = [member_path(args["output"], name) for name, _ in index]
+        with open(args["archive"], "rb") as archive:
+            for path, (_, entry) in zip(paths, index):
+                os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+                with open(path, "wb") as file:
+                    file.write(read_member(archive, entry))
+        print(f"Unpacked {len(index)} files into {args['output']}")
+    else:
+        for name, (_, stored_size, size, compression) in read_index(args["archive"]):
+            print(
+                f"{size:>12} {stored_size:>12} {'zlib' if compression else '-':>5} {name}"
+            )
+
+    return
+
+
+def find_files(inputs: List[str]) -> List[str]:
+    """Expand the input files, wildcards, and list files into a list of .fit files
+
+    Args:
+        inputs (List[str]): files, wildcard patterns, or a text file listing files
+
+    Returns:
+        List[str]: every .fit file, in the order they were found
+    """
+    if (
+        len(inputs) == 1
+        and not inputs[0].endswith(".fit")
+        and os.path.isfile(inputs[0])
+    ):
+        with open(inputs[0], "r") as file:
+            inputs = [line.strip() for line in file if line.strip()]
+    files = []
+    for entry in inputs:
+        matches = sorted(glob.glob(entry)) if glob.has_magic(entry) else [entry]
+        if not matches or not os.path.isfile(matches[0]):
+            raise FileNotFoundError(f"The file {entry} does not exist")
+        files.extend(matches)
+    if not all(file.endswith(".fit") for file in files):
+        raise ValueError("Only .fit files can be packed")
+    return files
+
+
+def member_path(output: str, name: str) -> str:
+    """The path that a member is unpacked to, which must be inside of the output
+
+    Args:
+        output (str): directory to unpack into
+        name (str): name of the member in the archive
+
+    Raises:
+        ValueError: when the name is absolute, has a ".." component, or leads outside
+            of the output directory, like through a symbolic link
+
+    Returns:
+        str: the path of the member's file
+    """
+    parts = name.replace("\\", "/").split("/")
+    path = os.path.join(output, name)
+    root = os.path.realpath(output)
+    if (
+        os.path.isabs(name)
+        or ".." in parts
+        or os.path.commonpath([root, os.path.realpath(path)]) != root
+    ):
+        raise ValueError(f"The member {name} would be unpacked outside of {output}")
+    return path
+
+
+def pack(path: str, files: List[str], names: List[str], compress: bool) -> int:
+    """Write an archive of files, whose members have the given names
+
+    Args:
+        path (str): archive to write, which should end in .fitpack
+        files (List[str]): files to pack, in the order they are stored
+        names (List[str]): name of every file in the archive
+        compress (bool): zlib compress every file that gets smaller by it
+
+    Returns:
+        int: size of the archive in bytes
+    """
+    if len(set(names)) != len(names):
+        raise ValueError("Two files would have the same name in the archive")
+    entries = []
+    with open(path, "wb") as archive:
+        archive.write(struct.pack(HEADER, MAGIC, VERSION, len(files), 0))
+        for file in files:
+            with open(file, "rb") as member:
+                data = member.read()
+            stored, compression = data, NO_COMPRESSION
+            if compress:
+                compressed = zlib.compress(data, 6)
+                if len(compressed) < len(data):
+                    stored, compression = compressed, ZLIB
+            entries.append((archive.tell(), len(stored), len(data), compression))
+            archive.write(stored)
+
+        index_offset = archive.tell()
+        for name, entry in zip(names, entries):
+            encoded = name.encode()
+            archive.write(struct.pack("<I", len(encoded)) + encoded)
+            archive.write(struct.pack(INDEX_ENTRY, *entry))
+        size = archive.tell()
+        archive.seek(0)
+        archive.write(struct.pack(HEADER, MAGIC, VERSION, len(files), index_offset))
+    return size
+
+
+def read_index(path: str) -> List[Tuple[str, tuple]]:
+    """Read the index of an archive
+
+    Args:
+        path (str): .fitpack archive
+
+    Returns:
+        List[Tuple[str, tuple]]: the name of every member and its (offset, stored
+            size, size, compression), in the order they are stored
+    """
+    with open(path, "rb") as archive:
+        magic, version, n_members, index_offset = struct.unpack(
+            HEADER, archive.read(struct.calcsize(HEADER))
+        )
+        if magic != MAGIC:
+            raise ValueError(f"{path} is not a .fitpack archive")
+        if version != VERSION:
+            raise ValueError(f"Unsupported .fitpack version {version}")
+        archive.seek(index_offset)
+        buffer = archive.read()
+
+    index, offset = [], 0
+    for _ in range(n_members):
+        (length,) = struct.unpack_from("<I", buffer, offset)
+        offset += 4 + length
+        name = buffer[offset - length : offset].decode()
+        index.append((name, struct.unpack_from(INDEX_ENTRY, buffer, offset)))
+        offset += struct.calcsize(INDEX_ENTRY)
+    return index
+
+
+def read_member(archive, entry: tuple) -> bytes:
+    """Read the original bytes of a member from an open archive"""
+    offset, stored_size, size, compression = entry
+    archive.seek(offset)
+    data = archive.read(stored_size)
+    return zlib.decompress(data) if compression == ZLIB else data
+
+
+def parse_args() -> dict:
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter
+    )
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    pack_parser = commands.add_parser("pack", help="Pack .fit files into an archive")
+    pack_parser.add_argument(
+        "-i",
+        "--input",
+        nargs="+",
+        required=True,
+        help=(
+            "Input .fit file(s). Also accepts path(s) with a wildcard '*', or a file"
+            " containing a list of files"
+        ),
+    )
+    pack_parser.add_argument(
+        "-o", "--output", required=True, help="File name of the .fitpack archive"
+    )
+    pack_parser.add_argument(
+        "-z",
+        "--compress",
+        action="store_true",
+        help="zlib compress the files, which are usually text. Defaults to False",
+    )
+    pack_parser.add_argument(
+        "--base",
+        default="",
+        help=(
+            "Directory the member names are relative to. Defaults to the common"
+            " directory of all files"
+        ),
+    )
+    pack_parser.add_argument(
+        "-s",
+        "--sorted",
+        type=bool,
+        default=True,
+        help=(
+            "Pack the files sorted by the last number in their path, like"
+            " convert_to_csv.py. Defaults to True"
+        ),
+    )
+    pack_parser.add_argument(
+        "--sort-index",
+        type=int,
+        default=-1,
+        help="Index of the number in the path to sort on. Defaults to -1 (the last)",
+    )
+
+    unpack_parser = commands.add_parser(
+        "unpack", help="Extract all files of an archive"
+    )
+    unpack_parser.add_argument("archive", help=".fitpack archive to unpack")
+    unpack_parser.add_argument(
+        "-o", "--output", default=".", help="Directory to unpack into. Defaults to ."
+    )
+
+    list_parser = commands.add_parser(
+        "list", help="List the size, stored size, compression, and name of every file"
+    )
+    list_parser.add_argument("archive", help=".fitpack archive to list")
+    return vars(parser.parse_args())
+
+
+if __name__ == "__main__":
+    args = parse_args()
+    main(args)
@@ -0,0 +1,373 @@
+/* Phase timers and counters for the extraction macros
+
+Profiling is switched on with the PYAMPPLOTS_PROFILE environment variable:
+    PYAMPPLOTS_PROFILE=1           print a summary when the macro finishes
+    PYAMPPLOTS_PROFILE=trace.json  also write every traced phase to trace.json
+for example
+    PYAMPPLOTS_PROFILE=trace.json root -l -b -q 'scripts/extract_bin_info.cc(...)'
+The trace uses the Trace Event Format, so it can be opened in https://ui.perfetto.dev
+or chrome://tracing, with one row per thread.
+
+For every phase the summary lists the number of calls and the summed wall and CPU time
+of the threads that ran it, so phases that run on several threads at once can add up to
+more than the wall time of the macro. The "startup" row is the time from the start of
+the process to the first profiled phase, which is mostly the ROOT (and AmpTools)
+startup. Counters such as the files, events, and bytes read are summed over all threads.
+
+Allocations are only counted when the alloc_counter.c shim is preloaded, since a macro
+can't replace malloc itself:
+    gcc -O2 -shared -fPIC -o alloc_counter.so scripts/alloc_counter.c
+    LD_PRELOAD=$PWD/alloc_counter.so PYAMPPLOTS_PROFILE=1 root -l -b -q ...
+The allocations of a phase are those of the thread that ran it, so threads working at
+the same time (like the reader of file_prefetcher.h) don't add to each other's phases.
+The total in the summary counts every allocation of the process.
+
+When PYAMPPLOTS_PROFILE is not set, timers and counters only check a flag, so they are
+cheap enough for per-file and per-batch work. Don't put them inside per-event loops.
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <dlfcn.h>  // for finding the counters of alloc_counter.c
+#include <time.h>   // for the thread CPU clock
+#include <unistd.h> // for the clock ticks of /proc/self/stat
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace profiler
+{
+struct PhaseStats
+{
+    long long calls = 0;
+    double wall = 0.0;
+    double cpu = 0.0;
+    unsigned long long allocations = 0;
+};
+
+// one finished traced phase, with times in microseconds since the profiler started
+struct TraceEvent
+{
+    std::string name;
+    std::string label;
+    double start;
+    double duration;
+    int thread;
+};
+
+namespace detail
+{
+using clock = std::chrono::steady_clock;
+
+struct State
+{
+    bool enabled = false;
+    std::string trace_path;
+    clock::time_point start;
+    double startup = -1.0; // seconds, negative when unknown or already reported
+    const unsigned long long *allocation_calls = nullptr;
+    const unsigned long long *allocation_bytes = nullptr;
+    unsigned long long (*thread_allocation_calls)() = nullptr;
+    unsigned long long allocations_at_start = 0;
+
+    std::mutex mutex;
+    std::vector<std::string> phase_order;
+    std::map<std::string, PhaseStats> phases;
+    std::map<std::string, long long> counters;
+    std::vector<TraceEvent> trace;
+};
+
+// Seconds since this process started, from /proc (Linux only). Negative if unknown
+inline double process_age()
+{
+    std::ifstream stat("/proc/self/stat"), uptime("/proc/uptime");
+    std::string line;
+    double seconds_up;
+    if (!std::getline(stat, line) || !(uptime >> seconds_up))
+        return -1.0;
+    // the start time is field 22, and the 20th after the command name, which is in
+    // parentheses and may itself contain spaces
+    std::istringstream fields(line.substr(line.rfind(')') + 1));
+    std::string field;
+    for (int i = 0; i < 20; ++i)
+    {
+        fields >> field;
+    }
+    return seconds_up - std::stod(field) / sysconf(_SC_CLK_TCK);
+}
+
+inline unsigned long long load_counter(const unsigned long long *counter)
+{
+    return counter ? __atomic_load_n(counter, __ATOMIC_RELAXED) : 0;
+}
+
+// Created on first use and never destroyed, so phases that end during exit are safe
+inline State &state()
+{
+    static State *instance = []
+    {
+        State *s = new State();
+        s->start = clock::now();
+        const char *setting = std::getenv("PYAMPPLOTS_PROFILE");
+        std::string value = setting ? setting : "";
+        s->enabled = !value.empty() && value != "0";
+        if (!s->enabled)
+            return s;
+        if (value != "1")
+            s->trace_path = value;
+        s->startup = process_age();
+        s->allocation_calls = static_cast<const unsigned long long *>(
+            dlsym(RTLD_DEFAULT, "alloc_counter_calls"));
+        s->allocation_bytes = static_cast<const unsigned long long *>(
+            dlsym(RTLD_DEFAULT, "alloc_counter_bytes"));
+        s->thread_allocation_calls = reinterpret_cast<unsigned long long (*)()>(
+            dlsym(RTLD_DEFAULT, "alloc_counter_thread_calls"));
+        s->allocations_at_start = load_counter(s->allocation_calls);
+        return s;
+    }();
+    return *instance;
+}
+
+// Allocations of the calling thread so far, or 0 without the alloc_counter.c shim
+inline unsigned long long thread_allocations()
+{
+    const State &s = state();
+    return s.thread_allocation_calls ? s.thread_allocation_calls() : 0;
+}
+
+inline double thread_cpu_seconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+// small sequential thread ids, which read better in a trace viewer than native ones
+inline int thread_index()
+{
+    static std::atomic<int> next{0};
+    thread_local int index = next++;
+    return index;
+}
+
+inline std::string json_escape(const std::string &text)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            escaped += c;
+    }
+    return escaped;
+}
+} // namespace detail
+
+inline bool enabled()
+{
+    return detail::state().enabled;
+}
+
+// Add n to a named counter
+inline void count(const char *name, long long n)
+{
+    if (!enabled())
+        return;
+    detail::State &s = detail::state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.counters[name] += n;
+}
+
+// Times a phase from construction until stop() or destruction, and can be restarted to
+// add more time to the same call. Traced phases also become an event in the trace
+// file, so only trace phases that run a few times per file
+class ScopedPhase
+{
+public:
+    // the label is only copied when tracing, so disabled phases never allocate
+    explicit ScopedPhase(
+        const char *name, bool traced = true, const std::string &label = "")
+        : name(name), traced(traced), label(traced && enabled() ? label : "")
+    {
+        restart();
+    }
+    ScopedPhase(const ScopedPhase &) = delete;
+    ScopedPhase &operator=(const ScopedPhase &) = delete;
+    ~ScopedPhase() { stop(); }
+
+    void restart()
+    {
+        if (!enabled() || running)
+            return;
+        running = true;
+        wall_start = detail::clock::now();
+        cpu_start = detail::thread_cpu_seconds();
+        allocations_start = detail::thread_allocations();
+    }
+
+    void stop()
+    {
+        if (!running)
+            return;
+        running = false;
+        detail::clock::time_point wall_end = detail::clock::now();
+        double cpu = detail::thread_cpu_seconds() - cpu_start;
+        unsigned long long allocations = detail::thread_allocations() - allocations_start;
+
+        detail::State &s = detail::state();
+        double wall = std::chrono::duration<double>(wall_end - wall_start).count();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (!s.phases.count(name))
+            s.phase_order.push_back(name);
+        PhaseStats &stats = s.phases[name];
+        // a restarted phase is still one call
+        stats.calls += counted ? 0 : 1;
+        stats.wall += wall;
+        stats.cpu += cpu;
+        stats.allocations += allocations;
+        counted = true;
+        if (traced)
+        {
+            double start =
+                std::chrono::duration<double, std::micro>(wall_start - s.start).count();
+            s.trace.push_back({name, label, start, 1e6 * wall, detail::thread_index()});
+        }
+    }
+
+private:
+    const char *name;
+    bool traced;
+    std::string label;
+    bool running = false;
+    bool counted = false;
+    detail::clock::time_point wall_start;
+    double cpu_start = 0.0;
+    unsigned long long allocations_start = 0;
+};
+
+// Print the summary table, write the trace file if one was requested, and start over,
+// so a ROOT session running several macros gets one report per macro
+inline void report()
+{
+    if (!enabled())
+        return;
+    detail::State &s = detail::state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    bool counting_allocations = s.allocation_calls && s.thread_allocation_calls;
+
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(4) << "\n==== Profile ====\n"
+              << std::left << std::setw(20) << "phase" << std::right << std::setw(10)
+              << "calls" << std::setw(14) << "wall [s]" << std::setw(14) << "cpu [s]"
+              << std::setw(14) << "allocations" << "\n";
+    if (s.startup >= 0.0)
+    {
+        std::cout << std::left << std::setw(20) << "startup" << std::right
+                  << std::setw(10) << 1 << std::setw(14) << s.startup << std::setw(14)
+                  << "-" << std::setw(14) << "-" << "\n";
+    }
+    for (const auto &name : s.phase_order)
+    {
+        const PhaseStats &stats = s.phases[name];
+        std::cout << std::left << std::setw(20) << name << std::right << std::setw(10)
+                  << stats.calls << std::setw(14) << stats.wall << std::setw(14)
+                  << stats.cpu << std::setw(14);
+        if (counting_allocations)
+            std::cout << stats.allocations << "\n";
+        else
+            std::cout << "-" << "\n";
+    }
+    for (const auto &counter : s.counters)
+    {
+        std::cout << "counter " << counter.first << ": " << counter.second << "\n";
+    }
+    if (counting_allocations)
+    {
+        std::cout << "allocations: "
+                  << detail::load_counter(s.allocation_calls) - s.allocations_at_start
+                  << " (" << detail::load_counter(s.allocation_bytes) / 1e6
+                  << " MB allocated in total)\n";
+    }
+    else
+    {
+        std::cout << "allocations: not counted, preload alloc_counter.so to count them\n";
+    }
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+
+    if (!s.trace_path.empty())
+    {
+        // shift everything so the process starts at 0 and the startup fits before it
+        double offset = s.startup > 0.0 ? 1e6 * s.startup : 0.0;
+        std::ofstream trace(s.trace_path);
+        trace << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        if (s.startup > 0.0)
+        {
+            trace << "{\"name\": \"startup\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, "
+                  << "\"ts\": 0, \"dur\": " << offset << "},\n";
+        }
+        for (const auto &event : s.trace)
+        {
+            trace << std::fixed << std::setprecision(3) << "{\"name\": \""
+                  << detail::json_escape(event.name) << "\", \"ph\": \"X\", \"pid\": 1, "
+                  << "\"tid\": " << event.thread << ", \"ts\": " << offset + event.start
+                  << ", \"dur\": " << event.duration;
+            if (!event.label.empty())
+                trace << ", \"args\": {\"label\": \""
+                      << detail::json_escape(event.label) << "\"}";
+            trace << "},\n";
+        }
+        // counters as one final counter event, so they show up in the viewer too
+        trace << "{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": "
+              << offset + std::chrono::duration<double, std::micro>(
+                              detail::clock::now() - s.start)
+                              .count()
+              << ", \"args\": {";
+        for (auto it = s.counters.begin(); it != s.counters.end(); ++it)
+        {
+            trace << (it == s.counters.begin() ? "" : ", ") << "\""
+                  << detail::json_escape(it->first) << "\": " << it->second;
+        }
+        trace << "}}\n]}\n";
+        std::cout << "Trace written to " << s.trace_path << "\n";
+    }
+
+    s.phase_order.clear();
+    s.phases.clear();
+    s.counters.clear();
+    s.trace.clear();
+    s.startup = -1.0;
+    s.start = detail::clock::now();
+    s.allocations_at_start = detail::load_counter(s.allocation_calls);
+}
+
+// Times a whole macro as one phase and reports when it goes out of scope, which
+// covers every return path of the macro
+class Session
+{
+public:
+    explicit Session(const char *name) : phase(name) {}
+    ~Session()
+    {
+        phase.stop();
+        report();
+    }
+
+private:
+    ScopedPhase phase;
+};
+} // namespace profiler
+
+#endif // PROFILER_H
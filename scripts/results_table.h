@@ -0,0 +1,842 @@
+/* In-memory columnar table of extraction results, and the sinks that write it out
+
+Every extractor fills one ResultsTable, with one row per fit file or bin, and the table
+is then handed to a sink that writes it in some format. New output formats are then a
+new sink, instead of another copy of each extractor's header and row loops.
+
+The table is a struct of arrays. Every column has a name, a type (Float64, Int64, or
+Text), and a validity bit per row, so a cell that was never set is null and is written
+as an empty csv field. Columns are stored in chunks of CHUNK_ROWS rows that are only
+allocated when a value of that chunk is first set, so appending rows costs nothing
+until they are filled, setting a number never allocates, and a column that a file
+doesn't have doesn't take any memory for the rows of that file. Text values are
+appended to one buffer per column. Columns are written in the order they were
+registered, unless a column is inserted after a given one. The table also holds
+key-value metadata, like the extractor that filled it.
+
+The columnar file sink writes the table as it is held in memory, everything
+little-endian:
+    char[4]   magic "PAPT"
+    uint32    version (1)
+    uint64    number of rows, n_rows
+    uint32    number of columns, n_columns
+    uint32    number of metadata entries, n_metadata
+    n_metadata x {uint32 length, char[length] key, uint32 length, char[length] value}
+    n_columns  x {uint32 length, char[length] name, uint32 type (0 Float64, 1 Int64,
+                  2 Text)}
+    n_columns  x {uint8 validity[n_rows / 8 rounded up to a multiple of 8],
+                  Float64: double[n_rows], Int64: int64[n_rows], or
+                  Text: uint64 offsets[n_rows + 1], char[offsets[n_rows]] padded to a
+                  multiple of 8}
+The validity bits are in row order, least significant bit first, and the invalid cells
+hold 0. Every block starts at a multiple of 8 bytes from the start of the column blocks,
+so numpy can view them without copying. See read_results_table in analysis/utils.py.
+
+The SQLite sink adds the table as a "campaign" to a database that holds any number of
+them, so the results of many wave sets, binnings, and systematic variations can be kept
+in one file and queried without reading everything. An output like
+    results.sqlite:omegapi_v2_tbin1
+writes the campaign omegapi_v2_tbin1 into results.sqlite, replacing an earlier campaign
+of that name. Without a name, the campaign is named after the extractor. The tables are
+    campaigns   (id, name, extractor, created)
+    metadata    (campaign_id, key, value)
+    columns     (id, campaign_id, position, name, type)
+    bins        (id, campaign_id, row, label, t_low, t_high, e_low, e_high, m_low,
+                 m_high)
+    fits        (bin_id, likelihood, eMatrixStatus, lastMinuitCommandStatus)
+    cell_values (bin_id, column_id, value)
+Every row of the table is a row of bins, whose label is its "file" column, and whose
+edges are filled when the table has them. Rows with a likelihood (fit results) also get
+a row of fits. Every non-null cell is a row of cell_values, so campaigns with different
+columns fit in the same tables. The bins are indexed by their edges and the fits by
+their likelihood, for example
+    SELECT label, likelihood FROM bins JOIN fits ON fits.bin_id = bins.id
+    WHERE campaign_id = 3 AND m_low >= 1.2 ORDER BY likelihood LIMIT 10
+and read_campaign in analysis/utils.py reads a whole campaign back into a DataFrame.
+The sink needs sqlite3.h, and is only available when it is found. ROOT macros load
+libsqlite3 themselves, while compiled programs need to link it.
+*/
+
+#ifndef RESULTS_TABLE_H
+#define RESULTS_TABLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if __has_include(<sqlite3.h>)
+#include <ctime>
+#include <sqlite3.h>
+#define RESULTS_TABLE_SQLITE
+#ifdef __CLING__
+#pragma cling load("libsqlite3")
+#endif
+#endif
+
+#include "profiler.h"
+
+enum class ColumnType : std::uint32_t
+{
+    Float64 = 0,
+    Int64 = 1,
+    Text = 2,
+};
+
+class ResultsTable
+{
+public:
+    static constexpr size_t CHUNK_ROWS = 1024;
+    static constexpr size_t NO_COLUMN = static_cast<size_t>(-1);
+
+    // The index of the column with this name, which is added if it doesn't exist yet.
+    // New columns go after the column `after`, or at the end. Exits if the column
+    // exists with another type
+    size_t add_column(
+        const std::string &name, ColumnType type = ColumnType::Float64,
+        size_t after = NO_COLUMN)
+    {
+        auto found = column_ids.find(name);
+        if (found != column_ids.end())
+        {
+            if (columns[found->second].type != type)
+            {
+                std::cout << "Column " << name << " already exists with another type\n";
+                exit(1);
+            }
+            return found->second;
+        }
+
+        size_t index = columns.size();
+        column_ids.emplace(name, index);
+        columns.emplace_back();
+        columns.back().name = name;
+        columns.back().type = type;
+        columns.back().resize_chunks(n_chunks());
+        if (after == NO_COLUMN)
+            order.push_back(index);
+        else
+            order.insert(std::find(order.begin(), order.end(), after) + 1, index);
+        return index;
+    }
+
+    // The index of the column with this name, or NO_COLUMN
+    size_t find_column(const std::string &name) const
+    {
+        auto found = column_ids.find(name);
+        return found == column_ids.end() ? NO_COLUMN : found->second;
+    }
+
+    // The index of a column that must exist, exiting if it doesn't
+    size_t column(const std::string &name) const
+    {
+        size_t index = find_column(name);
+        if (index == NO_COLUMN)
+        {
+            std::cout << "The results table has no column " << name << "\n";
+            exit(1);
+        }
+        return index;
+    }
+
+    // Add n rows whose cells are all null, and return the index of the first
+    size_t append_rows(size_t n)
+    {
+        size_t first = rows;
+        rows += n;
+        for (Column &c : columns)
+        {
+            c.resize_chunks(n_chunks());
+        }
+        return first;
+    }
+
+    void set_float(size_t column, size_t row, double value)
+    {
+        Column &c = cell_column(column, row, ColumnType::Float64);
+        c.floats[row / CHUNK_ROWS][row % CHUNK_ROWS] = value;
+    }
+
+    void set_int(size_t column, size_t row, std::int64_t value)
+    {
+        Column &c = cell_column(column, row, ColumnType::Int64);
+        c.integers[row / CHUNK_ROWS][row % CHUNK_ROWS] = value;
+    }
+
+    // Setting a text cell again leaves its old value unused in the text buffer
+    void set_text(size_t column, size_t row, std::string_view value)
+    {
+        Column &c = cell_column(column, row, ColumnType::Text);
+        c.text_spans[row / CHUNK_ROWS][row % CHUNK_ROWS] = {c.text.size(), value.size()};
+        c.text.append(value);
+    }
+
+    bool is_valid(size_t column, size_t row) const
+    {
+        const std::vector<std::uint64_t> &bits = columns[column].validity[row / CHUNK_ROWS];
+        size_t i = row % CHUNK_ROWS;
+        return !bits.empty() && (bits[i / 64] >> (i % 64) & 1);
+    }
+
+    // The values of valid cells. Null cells read as 0 or an empty string
+    double get_float(size_t column, size_t row) const
+    {
+        const std::vector<double> &chunk = columns[column].floats[row / CHUNK_ROWS];
+        return chunk.empty() ? 0.0 : chunk[row % CHUNK_ROWS];
+    }
+
+    std::int64_t get_int(size_t column, size_t row) const
+    {
+        const std::vector<std::int64_t> &chunk = columns[column].integers[row / CHUNK_ROWS];
+        return chunk.empty() ? 0 : chunk[row % CHUNK_ROWS];
+    }
+
+    std::string_view get_text(size_t column, size_t row) const
+    {
+        const Column &c = columns[column];
+        const std::vector<TextSpan> &chunk = c.text_spans[row / CHUNK_ROWS];
+        if (chunk.empty())
+            return {};
+        const TextSpan &span = chunk[row % CHUNK_ROWS];
+        return std::string_view(c.text).substr(span.begin, span.size);
+    }
+
+    // The CHUNK_ROWS values of a numeric chunk, or nullptr if none of them were set
+    const double *float_chunk(size_t column, size_t chunk) const
+    {
+        const std::vector<double> &values = columns[column].floats[chunk];
+        return values.empty() ? nullptr : values.data();
+    }
+
+    const std::int64_t *int_chunk(size_t column, size_t chunk) const
+    {
+        const std::vector<std::int64_t> &values = columns[column].integers[chunk];
+        return values.empty() ? nullptr : values.data();
+    }
+
+    // Copy a whole numeric column into a buffer of n_rows() values, like a numpy array
+    // handed over from Python, with one copy per chunk. Null cells are 0
+    void copy_floats(size_t column, double *out) const
+    {
+        copy_chunks(columns[column].floats, out);
+    }
+
+    void copy_ints(size_t column, std::int64_t *out) const
+    {
+        copy_chunks(columns[column].integers, out);
+    }
+
+    // Copy the validity of a column into a buffer of n_rows() bytes, 1 for valid cells
+    void copy_validity(size_t column, std::uint8_t *out) const
+    {
+        for (size_t row = 0; row < rows; ++row)
+        {
+            out[row] = is_valid(column, row);
+        }
+    }
+
+    // Set a cell to a cell of a column of the same type in another table, leaving it
+    // null if that cell is null
+    void copy_cell(
+        size_t column, size_t row, const ResultsTable &source, size_t source_column,
+        size_t source_row)
+    {
+        if (!source.is_valid(source_column, source_row))
+            return;
+        switch (source.column_type(source_column))
+        {
+        case ColumnType::Float64:
+            set_float(column, row, source.get_float(source_column, source_row));
+            break;
+        case ColumnType::Int64:
+            set_int(column, row, source.get_int(source_column, source_row));
+            break;
+        case ColumnType::Text:
+            set_text(column, row, source.get_text(source_column, source_row));
+            break;
+        }
+    }
+
+    void set_metadata(const std::string &key, const std::string &value)
+    {
+        for (auto &entry : metadata)
+        {
+            if (entry.first == key)
+            {
+                entry.second = value;
+                return;
+            }
+        }
+        metadata.emplace_back(key, value);
+    }
+
+    const std::vector<std::pair<std::string, std::string>> &get_metadata() const
+    {
+        return metadata;
+    }
+
+    size_t n_rows() const { return rows; }
+    size_t n_columns() const { return columns.size(); }
+    size_t n_chunks() const { return (rows + CHUNK_ROWS - 1) / CHUNK_ROWS; }
+    const std::string &column_name(size_t column) const { return columns[column].name; }
+    ColumnType column_type(size_t column) const { return columns[column].type; }
+
+    // column indices in the order they are written
+    const std::vector<size_t> &column_order() const { return order; }
+
+private:
+    struct TextSpan
+    {
+        std::uint64_t begin;
+        std::uint64_t size;
+    };
+
+    // every per-chunk vector is empty until a cell of its chunk is set, and only the
+    // vector of the column's own type is ever used
+    struct Column
+    {
+        std::string name;
+        ColumnType type;
+        std::vector<std::vector<std::uint64_t>> validity;
+        std::vector<std::vector<double>> floats;
+        std::vector<std::vector<std::int64_t>> integers;
+        std::vector<std::vector<TextSpan>> text_spans;
+        std::string text;
+
+        void resize_chunks(size_t n)
+        {
+            validity.resize(n);
+            switch (type)
+            {
+            case ColumnType::Float64:
+                floats.resize(n);
+                break;
+            case ColumnType::Int64:
+                integers.resize(n);
+                break;
+            case ColumnType::Text:
+                text_spans.resize(n);
+                break;
+            }
+        }
+    };
+
+    std::vector<Column> columns;
+    std::map<std::string, size_t> column_ids;
+    std::vector<size_t> order;
+    std::vector<std::pair<std::string, std::string>> metadata;
+    size_t rows = 0;
+
+    template <typename T>
+    void copy_chunks(const std::vector<std::vector<T>> &chunks, T *out) const
+    {
+        for (size_t chunk = 0; chunk < n_chunks(); ++chunk)
+        {
+            size_t first = chunk * CHUNK_ROWS;
+            size_t n = std::min(CHUNK_ROWS, rows - first);
+            if (chunks[chunk].empty())
+                std::fill(out + first, out + first + n, T(0));
+            else
+                std::copy(chunks[chunk].begin(), chunks[chunk].begin() + n, out + first);
+        }
+    }
+
+    // The column of a cell that is about to be set, with its chunk allocated and the
+    // cell marked valid
+    Column &cell_column(size_t column, size_t row, ColumnType type)
+    {
+        Column &c = columns[column];
+        if (c.type != type || row >= rows)
+        {
+            std::cout << "Invalid cell (" << c.name << ", " << row << ") of the results"
+                      << " table\n";
+            exit(1);
+        }
+        size_t chunk = row / CHUNK_ROWS;
+        if (c.validity[chunk].empty())
+        {
+            c.validity[chunk].assign(CHUNK_ROWS / 64, 0);
+            switch (type)
+            {
+            case ColumnType::Float64:
+                c.floats[chunk].assign(CHUNK_ROWS, 0.0);
+                break;
+            case ColumnType::Int64:
+                c.integers[chunk].assign(CHUNK_ROWS, 0);
+                break;
+            case ColumnType::Text:
+                c.text_spans[chunk].assign(CHUNK_ROWS, TextSpan{0, 0});
+                break;
+            }
+        }
+        size_t i = row % CHUNK_ROWS;
+        c.validity[chunk][i / 64] |= std::uint64_t(1) << (i % 64);
+        return c;
+    }
+};
+
+// Writes a whole table to some output
+class TableSink
+{
+public:
+    virtual ~TableSink() = default;
+    virtual void write(const ResultsTable &table) = 0;
+};
+
+// One header row with the column names, then one line per row. Null cells are left
+// empty, which pandas reads as NaN
+class CsvSink : public TableSink
+{
+public:
+    explicit CsvSink(const std::string &file_name) : file_name(file_name) {}
+
+    void write(const ResultsTable &table) override
+    {
+        std::ofstream csv_file(file_name);
+        const std::vector<size_t> &order = table.column_order();
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            csv_file << (i == 0 ? "" : ",") << table.column_name(order[i]);
+        }
+        csv_file << "\n";
+
+        for (size_t row = 0; row < table.n_rows(); ++row)
+        {
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                if (i > 0)
+                    csv_file << ",";
+                size_t column = order[i];
+                if (!table.is_valid(column, row))
+                    continue;
+                switch (table.column_type(column))
+                {
+                case ColumnType::Float64:
+                    csv_file << table.get_float(column, row);
+                    break;
+                case ColumnType::Int64:
+                    csv_file << table.get_int(column, row);
+                    break;
+                case ColumnType::Text:
+                    csv_file << table.get_text(column, row);
+                    break;
+                }
+            }
+            csv_file << "\n";
+        }
+        csv_file.close();
+    }
+
+private:
+    std::string file_name;
+};
+
+// The binary columnar layout described at the top of this file
+class ColumnarFileSink : public TableSink
+{
+public:
+    explicit ColumnarFileSink(const std::string &file_name) : file_name(file_name) {}
+
+    void write(const ResultsTable &table) override
+    {
+        out.open(file_name, std::ios::binary);
+        size_t n_rows = table.n_rows();
+        out.write("PAPT", 4);
+        write_u32(1);
+        write_u64(n_rows);
+        write_u32(table.n_columns());
+        write_u32(table.get_metadata().size());
+        for (const auto &entry : table.get_metadata())
+        {
+            write_string(entry.first);
+            write_string(entry.second);
+        }
+        for (size_t column : table.column_order())
+        {
+            write_string(table.column_name(column));
+            write_u32(static_cast<std::uint32_t>(table.column_type(column)));
+        }
+
+        position = 0;
+        std::vector<std::uint8_t> validity(padded(n_rows / 8 + (n_rows % 8 != 0)), 0);
+        for (size_t column : table.column_order())
+        {
+            std::fill(validity.begin(), validity.end(), 0);
+            for (size_t row = 0; row < n_rows; ++row)
+            {
+                if (table.is_valid(column, row))
+                    validity[row / 8] |= 1 << (row % 8);
+            }
+            write_block(validity.data(), validity.size());
+
+            switch (table.column_type(column))
+            {
+            case ColumnType::Float64:
+                write_chunks<double>(table, column, &ResultsTable::float_chunk);
+                break;
+            case ColumnType::Int64:
+                write_chunks<std::int64_t>(table, column, &ResultsTable::int_chunk);
+                break;
+            case ColumnType::Text:
+                write_text(table, column);
+                break;
+            }
+        }
+        out.close();
+    }
+
+private:
+    std::string file_name;
+    std::ofstream out;
+    std::uint64_t position = 0; // bytes written since the start of the column blocks
+
+    static std::uint64_t padded(std::uint64_t size) { return (size + 7) / 8 * 8; }
+
+    void write_u32(std::uint32_t value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void write_u64(std::uint64_t value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void write_string(const std::string &value)
+    {
+        write_u32(value.size());
+        out.write(value.data(), value.size());
+    }
+
+    void write_block(const void *data, size_t size)
+    {
+        out.write(static_cast<const char *>(data), size);
+        position += size;
+    }
+
+    // a whole column, with the chunks that were never set written as zeros
+    template <typename T>
+    void write_chunks(
+        const ResultsTable &table, size_t column,
+        const T *(ResultsTable::*chunk_values)(size_t, size_t) const)
+    {
+        const std::vector<T> zeros(ResultsTable::CHUNK_ROWS, T(0));
+        for (size_t chunk = 0; chunk < table.n_chunks(); ++chunk)
+        {
+            const T *values = (table.*chunk_values)(column, chunk);
+            size_t n = std::min(
+                ResultsTable::CHUNK_ROWS, table.n_rows() - chunk * ResultsTable::CHUNK_ROWS);
+            write_block(values ? values : zeros.data(), n * sizeof(T));
+        }
+    }
+
+    void write_text(const ResultsTable &table, size_t column)
+    {
+        std::uint64_t offset = 0;
+        write_block(&offset, sizeof(offset));
+        for (size_t row = 0; row < table.n_rows(); ++row)
+        {
+            offset += table.get_text(column, row).size();
+            write_block(&offset, sizeof(offset));
+        }
+        for (size_t row = 0; row < table.n_rows(); ++row)
+        {
+            std::string_view text = table.get_text(column, row);
+            write_block(text.data(), text.size());
+        }
+        const char padding[8] = {};
+        write_block(padding, padded(position) - position);
+    }
+};
+
+#ifdef RESULTS_TABLE_SQLITE
+// Adds the table as one campaign of a SQLite database, see the top of this file
+class SqliteSink : public TableSink
+{
+public:
+    SqliteSink(const std::string &file_name, const std::string &campaign)
+        : file_name(file_name), campaign(campaign)
+    {
+    }
+
+    ~SqliteSink() override
+    {
+        for (sqlite3_stmt *statement : statements)
+        {
+            sqlite3_finalize(statement);
+        }
+        sqlite3_close(db);
+    }
+
+    void write(const ResultsTable &table) override
+    {
+        check(sqlite3_open(file_name.c_str(), &db));
+        execute("PRAGMA journal_mode = WAL");
+        execute("PRAGMA synchronous = NORMAL");
+        execute("PRAGMA cache_size = -262144"); // 256 MB
+        create_tables();
+
+        std::string extractor;
+        for (const auto &entry : table.get_metadata())
+        {
+            if (entry.first == "extractor")
+                extractor = entry.second;
+        }
+        std::string name = campaign.empty() ? extractor : campaign;
+
+        // the campaign, its metadata, and its columns. An earlier campaign of the same
+        // name is removed table by table, since its bins and columns are id ranges
+        execute("BEGIN");
+        const char *removals[] = {
+            "DELETE FROM cell_values WHERE bin_id BETWEEN (SELECT min(id) FROM bins WHERE "
+            "campaign_id = ?1) AND (SELECT max(id) FROM bins WHERE campaign_id = ?1)",
+            "DELETE FROM fits WHERE bin_id BETWEEN (SELECT min(id) FROM bins WHERE "
+            "campaign_id = ?1) AND (SELECT max(id) FROM bins WHERE campaign_id = ?1)",
+            "DELETE FROM bins WHERE campaign_id = ?1",
+            "DELETE FROM columns WHERE campaign_id = ?1",
+            "DELETE FROM metadata WHERE campaign_id = ?1",
+            "DELETE FROM campaigns WHERE id = ?1",
+        };
+        sqlite3_stmt *find = prepare("SELECT id FROM campaigns WHERE name = ?");
+        bind_text(find, 1, name);
+        if (sqlite3_step(find) == SQLITE_ROW)
+        {
+            sqlite3_int64 old_id = sqlite3_column_int64(find, 0);
+            for (const char *removal : removals)
+            {
+                sqlite3_stmt *remove = prepare(removal);
+                sqlite3_bind_int64(remove, 1, old_id);
+                step(remove);
+            }
+        }
+        sqlite3_reset(find);
+        sqlite3_stmt *add_campaign = prepare(
+            "INSERT INTO campaigns (name, extractor, created) VALUES (?, ?, ?)");
+        bind_text(add_campaign, 1, name);
+        bind_text(add_campaign, 2, extractor);
+        sqlite3_bind_int64(add_campaign, 3, std::time(nullptr));
+        step(add_campaign);
+        sqlite3_int64 campaign_id = sqlite3_last_insert_rowid(db);
+
+        sqlite3_stmt *add_metadata =
+            prepare("INSERT INTO metadata (campaign_id, key, value) VALUES (?, ?, ?)");
+        for (const auto &entry : table.get_metadata())
+        {
+            sqlite3_bind_int64(add_metadata, 1, campaign_id);
+            bind_text(add_metadata, 2, entry.first);
+            bind_text(add_metadata, 3, entry.second);
+            step(add_metadata);
+        }
+
+        sqlite3_stmt *add_column = prepare(
+            "INSERT INTO columns (campaign_id, position, name, type) VALUES (?, ?, ?, ?)");
+        std::vector<sqlite3_int64> column_ids(table.n_columns());
+        const std::vector<size_t> &order = table.column_order();
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            sqlite3_bind_int64(add_column, 1, campaign_id);
+            sqlite3_bind_int64(add_column, 2, i);
+            bind_text(add_column, 3, table.column_name(order[i]));
+            sqlite3_bind_int(add_column, 4, static_cast<int>(table.column_type(order[i])));
+            step(add_column);
+            column_ids[order[i]] = sqlite3_last_insert_rowid(db);
+        }
+
+        // the bin and fit columns, which are NO_COLUMN when the table doesn't have them
+        size_t label = table.find_column("file");
+        const char *edge_names[] = {"t_low", "t_high", "e_low", "e_high", "m_low", "m_high"};
+        std::vector<size_t> edges;
+        for (const char *edge : edge_names)
+        {
+            edges.push_back(table.find_column(edge));
+        }
+        std::vector<size_t> fit_columns = {
+            table.find_column("likelihood"), table.find_column("eMatrixStatus"),
+            table.find_column("lastMinuitCommandStatus")};
+
+        // every row, in the same transaction, so the bin ids of a campaign are one range
+        // and readers never see part of a campaign
+        sqlite3_stmt *add_bin = prepare(
+            "INSERT INTO bins (campaign_id, row, label, t_low, t_high, e_low, e_high, "
+            "m_low, m_high) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        sqlite3_stmt *add_fit = prepare(
+            "INSERT INTO fits (bin_id, likelihood, eMatrixStatus, "
+            "lastMinuitCommandStatus) VALUES (?, ?, ?, ?)");
+        sqlite3_stmt *add_value =
+            prepare("INSERT INTO cell_values (bin_id, column_id, value) VALUES (?, ?, ?)");
+        for (size_t row = 0; row < table.n_rows(); ++row)
+        {
+            sqlite3_bind_int64(add_bin, 1, campaign_id);
+            sqlite3_bind_int64(add_bin, 2, row);
+            bind_cell(add_bin, 3, table, label, row);
+            for (size_t i = 0; i < edges.size(); ++i)
+            {
+                bind_cell(add_bin, 4 + i, table, edges[i], row);
+            }
+            step(add_bin);
+            sqlite3_int64 bin_id = sqlite3_last_insert_rowid(db);
+
+            if (fit_columns[0] != ResultsTable::NO_COLUMN &&
+                table.is_valid(fit_columns[0], row))
+            {
+                sqlite3_bind_int64(add_fit, 1, bin_id);
+                for (size_t i = 0; i < fit_columns.size(); ++i)
+                {
+                    bind_cell(add_fit, 2 + i, table, fit_columns[i], row);
+                }
+                step(add_fit);
+            }
+
+            for (size_t column : order)
+            {
+                if (column == label || !table.is_valid(column, row))
+                    continue;
+                sqlite3_bind_int64(add_value, 1, bin_id);
+                sqlite3_bind_int64(add_value, 2, column_ids[column]);
+                bind_cell(add_value, 3, table, column, row);
+                step(add_value);
+            }
+        }
+        execute("COMMIT");
+    }
+
+private:
+    std::string file_name;
+    std::string campaign;
+    sqlite3 *db = nullptr;
+    std::vector<sqlite3_stmt *> statements; // finalized with the sink
+
+    void create_tables()
+    {
+        execute(R"(
+            CREATE TABLE IF NOT EXISTS campaigns (
+                id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL, extractor TEXT,
+                created INTEGER);
+            CREATE TABLE IF NOT EXISTS metadata (
+                campaign_id INTEGER NOT NULL REFERENCES campaigns, key TEXT, value TEXT);
+            CREATE TABLE IF NOT EXISTS columns (
+                id INTEGER PRIMARY KEY, campaign_id INTEGER NOT NULL REFERENCES campaigns,
+                position INTEGER, name TEXT, type INTEGER);
+            CREATE TABLE IF NOT EXISTS bins (
+                id INTEGER PRIMARY KEY, campaign_id INTEGER NOT NULL REFERENCES campaigns,
+                row INTEGER, label TEXT, t_low REAL, t_high REAL, e_low REAL,
+                e_high REAL, m_low REAL, m_high REAL);
+            CREATE TABLE IF NOT EXISTS fits (
+                bin_id INTEGER PRIMARY KEY REFERENCES bins, likelihood REAL,
+                eMatrixStatus INTEGER, lastMinuitCommandStatus INTEGER);
+            CREATE TABLE IF NOT EXISTS cell_values (
+                bin_id INTEGER NOT NULL REFERENCES bins,
+                column_id INTEGER NOT NULL REFERENCES columns, value,
+                PRIMARY KEY (bin_id, column_id)) WITHOUT ROWID;
+            CREATE INDEX IF NOT EXISTS metadata_campaign ON metadata (campaign_id);
+            CREATE INDEX IF NOT EXISTS columns_campaign ON columns (campaign_id, name);
+            CREATE INDEX IF NOT EXISTS bins_campaign ON bins (campaign_id, row);
+            CREATE INDEX IF NOT EXISTS bins_mass ON bins (m_low, m_high);
+            CREATE INDEX IF NOT EXISTS bins_t ON bins (t_low, t_high);
+            CREATE INDEX IF NOT EXISTS bins_e ON bins (e_low, e_high);
+            CREATE INDEX IF NOT EXISTS fits_likelihood ON fits (likelihood);
+        )");
+    }
+
+    void check(int status)
+    {
+        if (status == SQLITE_OK || status == SQLITE_DONE)
+            return;
+        std::cout << "SQLite error in " << file_name << ": " << sqlite3_errmsg(db) << "\n";
+        exit(1);
+    }
+
+    void execute(const char *sql) { check(sqlite3_exec(db, sql, nullptr, nullptr, nullptr)); }
+
+    sqlite3_stmt *prepare(const char *sql)
+    {
+        sqlite3_stmt *statement = nullptr;
+        check(sqlite3_prepare_v2(db, sql, -1, &statement, nullptr));
+        statements.push_back(statement);
+        return statement;
+    }
+
+    void step(sqlite3_stmt *statement)
+    {
+        check(sqlite3_step(statement));
+        sqlite3_reset(statement);
+    }
+
+    void bind_text(sqlite3_stmt *statement, int index, std::string_view text)
+    {
+        sqlite3_bind_text(statement, index, text.data(), text.size(), SQLITE_TRANSIENT);
+    }
+
+    // a cell of the table, or NULL when it is null or the column doesn't exist
+    void bind_cell(
+        sqlite3_stmt *statement, int index, const ResultsTable &table, size_t column,
+        size_t row)
+    {
+        if (column == ResultsTable::NO_COLUMN || !table.is_valid(column, row))
+        {
+            sqlite3_bind_null(statement, index);
+            return;
+        }
+        switch (table.column_type(column))
+        {
+        case ColumnType::Float64:
+            sqlite3_bind_double(statement, index, table.get_float(column, row));
+            break;
+        case ColumnType::Int64:
+            sqlite3_bind_int64(statement, index, table.get_int(column, row));
+            break;
+        case ColumnType::Text:
+        {
+            // the text stays in the table until the statement is done with it
+            std::string_view text = table.get_text(column, row);
+            sqlite3_bind_text(statement, index, text.data(), text.size(), SQLITE_STATIC);
+            break;
+        }
+        }
+    }
+};
+#endif // RESULTS_TABLE_SQLITE
+
+// The sink for an output file, chosen by its extension: ".papt" for the columnar file,
+// ".sqlite" or ".db" (optionally followed by ":campaign") for SQLite, and csv for
+// anything else
+std::unique_ptr<TableSink> make_sink(const std::string &file_name)
+{
+    auto has_extension = [&](const std::string &name, const std::string &extension)
+    {
+        return name.size() >= extension.size() &&
+               name.compare(name.size() - extension.size(), extension.size(), extension) ==
+                   0;
+    };
+    if (has_extension(file_name, ".papt"))
+        return std::make_unique<ColumnarFileSink>(file_name);
+
+    size_t colon = file_name.rfind(':');
+    std::string database = file_name.substr(0, colon);
+    if (has_extension(database, ".sqlite") || has_extension(database, ".db"))
+    {
+#ifdef RESULTS_TABLE_SQLITE
+        std::string campaign = colon == std::string::npos ? "" : file_name.substr(colon + 1);
+        return std::make_unique<SqliteSink>(database, campaign);
+#else
+        std::cout << "SQLite output needs sqlite3.h, which was not found\n";
+        exit(1);
+#endif
+    }
+    return std::make_unique<CsvSink>(file_name);
+}
+
+// Write the table to the file, in the format of its extension
+void write_results(const ResultsTable &table, const std::string &file_name)
+{
+    profiler::ScopedPhase phase("write");
+    make_sink(file_name)->write(table);
+}
+
+#endif // RESULTS_TABLE_H
@@ -0,0 +1,333 @@
+"""Run an extraction macro over shards of the input list in separate ROOT processes.
+
+convert_to_csv.py normally runs one ROOT process over the whole list, so a single
+malformed file that makes AmpTools (or ROOT) abort loses the entire run, and the
+extraction is limited to one process. With --workers, the (sorted) list is instead
+split into shards that are extracted by up to that many ROOT processes at once.
+
+When a worker fails, the file it was working on is quarantined and the rest of its shard
+is extracted again. The file is found from the last "Analyzing File" line the macro
+printed, as long as it wasn't followed by the matching "Done File" line, or otherwise by
+splitting the shard in halves until the failing file is the only one left. A macro that
+prints these lines and fails before its first file, while expanding an archive of the
+shard, has that archive quarantined. Quarantined files are listed, along with the end of
+their worker's output, in a "<output>.quarantine.txt" file next to the output.
+
+A failure that isn't caused by a file, like AmpTools not being loaded, the macro not
+compiling, or a crash while writing the csv, stops the whole run with a WorkerError
+instead. It is recognized when a macro that prints every file fails outside of all of
+them (or exits without writing its csv) twice for the same shard, when two files found
+by splitting failed with the same output, or when every file would be quarantined.
+
+Every shard's csv keeps the order of its part of the list, so the shards are combined
+with a streaming k-way merge on the position of each row's file in the sorted list,
+i.e. on the sort_input_files key. Apart from the quarantined files, the merged csv is
+the same as that of a single process: for .fit files the workers run in union schema
+mode, and the header of a serial run is rebuilt from the columns each row has.
+"""
+
+import heapq
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+from collections import deque
+from concurrent.futures import FIRST_COMPLETED, ThreadPoolExecutor, wait
+from typing import Callable, Dict, Iterator, List, Optional, Tuple
+
+# shards per worker, so that workers that finish early pick up another shard
+SHARDS_PER_WORKER = 4
+
+# lines of a failed worker's output that are kept in the quarantine file
+QUARANTINE_LOG_LINES = 20
+
+# printed by extract_fit_results.cc (and flushed) before and after it parses a file
+ANALYZING_FILE = "Analyzing File: "
+DONE_FILE = "Done File: "
+
+# printed by fit_archive.h when an archive can't be read
+BROKEN_ARCHIVE = "Can't read the archive "
+
+
+class WorkerError(RuntimeError):
+    """A worker failed for a reason that isn't one of its files"""
+
+
+def run_sharded(
+    entries: List[str],
+    make_command: Callable[[str, str], List[str]],
+    output: str,
+    workers: int,
+    varying_columns: bool = False,
+    union_schema: bool = False,
+    announces_files: bool = False,
+    verbose: bool = False,
+) -> List[str]:
+    """Extract the entries in shards, and merge the shards into one csv
+
+    Args:
+        entries (List[str]): lines of the input list, in the order of the final csv
+        make_command (Callable[[str, str], List[str]]): the ROOT command that extracts
+            the list file of a shard (first argument) into a csv (second argument)
+        output (str): csv file to write
+        workers (int): number of ROOT processes to run at once
+        varying_columns (bool, optional): whether rows can have different columns, like
+            fits of different models, which the workers write in union schema mode.
+            Defaults to False, where every shard has the same header.
+        union_schema (bool, optional): with varying_columns, keep the columns of every
+            row, rather than those of the first one. Defaults to False.
+        announces_files (bool, optional): whether the macro prints "Analyzing File"
+            before and "Done File" after every file, so a failure outside of them isn't
+            caused by a file. Defaults to False, where failing shards are split to find
+            the file.
+        verbose (bool, optional): print the output of every worker. Defaults to False.
+
+    Raises:
+        WorkerError: when the workers fail for a reason that isn't one of the files
+
+    Returns:
+        List[str]: the quarantined entries, or members of .fitpack archives
+    """
+    n_shards = max(1, min(len(entries), workers * SHARDS_PER_WORKER))
+    # striped, so that every shard has files from all over the (sorted) list
+    pending = deque(entries[i::n_shards] for i in range(n_shards))
+    finished, quarantined, signatures = [], [], []
+    # shards that failed outside of their files once, which might have been transient
+    retried = set()
+    work_dir = tempfile.mkdtemp(prefix="sharded_extraction_")
+    print(
+        f"Extracting {len(entries)} entries in {n_shards} shards with {workers} workers"
+    )
+
+    try:
+        with ThreadPoolExecutor(workers) as pool:
+            running = {}
+            while pending or running:
+                while pending and len(running) < workers:
+                    shard = pending.popleft()
+                    number = len(finished) + len(running) + len(quarantined)
+                    list_path = os.path.join(
+                        work_dir, f"shard_{id(shard)}_{number}.txt"
+                    )
+                    csv_path = list_path[:-4] + ".csv"
+                    with open(list_path, "w") as list_file:
+                        list_file.write("\n".join(shard))
+                    future = pool.submit(
+                        _run_worker, make_command(list_path, csv_path), verbose
+                    )
+                    running[future] = (shard, csv_path)
+
+                done, _ = wait(running, return_when=FIRST_COMPLETED)
+                for future in done:
+                    shard, csv_path = running.pop(future)
+                    returncode, log = future.result()
+                    if returncode == 0 and os.path.isfile(csv_path):
+                        finished.append(csv_path)
+                        continue
+                    bad, retry = _isolate_failure(shard, log, announces_files)
+                    tail = log[-QUARANTINE_LOG_LINES:]
+                    if bad is None and retry is None:
+                        if tuple(shard) in retried:
+                            raise WorkerError(
+                                "A worker failed twice outside of its files:\n"
+                                + "".join(tail)
+                            )
+                        retried.add(tuple(shard))
+                        print(
+                            "A worker failed outside of its files, so it is run again"
+                        )
+                        # a copy, which gets its own list and csv, and is run next so
+                        # that a failure of every worker stops the run soon
+                        pending.appendleft(list(shard))
+                        continue
+                    # a file that was only found by splitting is just the last one
+                    # left, so a failure of the setup would blame every file in turn
+                    if bad is not None and not announces_files:
+                        signature = _failure_signature(tail, bad, work_dir)
+                        for other, other_signature in signatures:
+                            if signature == other_signature:
+                                raise WorkerError(
+                                    f"Both {other} and {bad} failed the same way, which"
+                                    " is not a problem of either file:\n"
+                                    + "".join(tail)
+                                )
+                        signatures.append((bad, signature))
+                    if bad is not None:
+                        print(f"Quarantined {bad} after its worker failed")
+                        quarantined.append((bad, tail))
+                    pending.extend(part for part in retry if part)
+
+        if not finished:
+            raise WorkerError(
+                "Every file was quarantined, so there is nothing to merge"
+            )
+        merge_shards(finished, entries, output, varying_columns, union_schema)
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    if quarantined:
+        quarantine_path = f"{output}.quarantine.txt"
+        with open(quarantine_path, "w") as quarantine_file:
+            for bad, log in quarantined:
+                quarantine_file.write(f"{bad}\n")
+                quarantine_file.writelines(f"    {line}" for line in log)
+        print(f"{len(quarantined)} quarantined files are listed in {quarantine_path}")
+    return [bad for bad, _ in quarantined]
+
+
+def merge_shards(
+    shard_csvs: List[str],
+    entries: List[str],
+    output: str,
+    varying_columns: bool,
+    union_schema: bool,
+) -> None:
+    """k-way merge the csv files of the shards into one csv, in the order of entries
+
+    Args:
+        shard_csvs (List[str]): csv files written by the workers
+        entries (List[str]): lines of the input list, in the order of the final csv
+        output (str): csv file to write
+        varying_columns (bool): whether rows can have different columns, see
+            run_sharded
+        union_schema (bool): with varying_columns, keep the columns of every row
+    """
+    position = {entry: i for i, entry in enumerate(entries)}
+
+    def merged_rows() -> Iterator[Tuple[List[str], List[str]]]:
+        # each shard is already in order, so only the heads of the shards are compared
+        shards = [_read_shard(path, position) for path in shard_csvs]
+        for _, header, cells in heapq.merge(*shards, key=lambda row: row[0]):
+            yield header, cells
+
+    # the header only depends on the columns of the rows, which needs a first pass
+    header = []
+    if not varying_columns:
+        for path in shard_csvs:
+            with open(path, "r") as shard_file:
+                header = shard_file.readline().rstrip("\n").split(",")
+            break
+    else:
+        previous_columns = None
+        for shard_header, cells in merged_rows():
+            columns = [
+                column
+                for column, cell in zip(shard_header, cells)
+                if cell or column == "file"
+            ]
+            if columns == previous_columns:
+                continue
+            previous_columns = columns
+            if not header:
+                header = columns
+                if not union_schema:
+                    break
+                continue
+            # new columns go right after the column before them, like in the macro
+            previous = "file"
+            for column in columns:
+                if column not in header:
+                    header.insert(header.index(previous) + 1, column)
+                previous = column
+
+    with open(output, "w") as output_file:
+        output_file.write(",".join(header) + "\n")
+        if not header:
+            return
+        for shard_header, cells in merged_rows():
+            if shard_header != header:
+                values = dict(zip(shard_header, cells))
+                cells = [values.get(column, "") for column in header]
+            output_file.write(",".join(cells) + "\n")
+
+
+def _read_shard(
+    path: str, position: Dict[str, int]
+) -> Iterator[Tuple[Tuple[int, int], List[str], List[str]]]:
+    """The (merge key, header, cells) of every row of a shard's csv
+
+    The key is the position of the row's file in the input list, then its row number,
+    which orders the members of an archive that was given as one entry.
+    """
+    with open(path, "r") as shard_file:
+        header = shard_file.readline().rstrip("\n").split(",")
+        file_column = header.index("file")
+        for row, line in enumerate(shard_file):
+            cells = line.rstrip("\n").split(",")
+            file = cells[file_column]
+            entry = file if file in position else _archive_of(file)
+            yield (position[entry], row), header, cells
+
+
+def _run_worker(command: List[str], verbose: bool) -> Tuple[int, List[str]]:
+    """Run one ROOT process, and return its exit code and output lines"""
+    proc = subprocess.run(
+        command,
+        stdin=subprocess.DEVNULL,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT,
+        text=True,
+        errors="replace",
+    )
+    log = proc.stdout.splitlines(keepends=True)
+    if verbose:
+        print("".join(log), end="")
+    return proc.returncode, log
+
+
+def _isolate_failure(
+    shard: List[str], log: List[str], announces_files: bool
+) -> Tuple[Optional[str], Optional[List[List[str]]]]:
+    """Find the file that made a worker fail
+
+    Returns:
+        Tuple[Optional[str], Optional[List[List[str]]]]: the file to quarantine, or
+            None if it isn't known yet, and the shards to extract again. Both are None
+            when no file is to blame
+    """
+    analyzed = _announced(log, ANALYZING_FILE)
+    # a file that is done didn't fail, even if it is the last one
+    if len(analyzed) > len(_announced(log, DONE_FILE)):
+        bad = analyzed[-1]
+        if bad in shard:
+            return bad, [[entry for entry in shard if entry != bad]]
+        # a member of an archive, whose other members are extracted on their own
+        archive = _archive_of(bad)
+        if archive in shard:
+            # imported here, since pack_fit_files imports convert_to_csv, which imports
+            # this module
+            from pack_fit_files import read_index
+
+            members = [f"{archive}/{name}" for name, _ in read_index(archive)]
+            rest = [entry for entry in shard if entry != archive]
+            return bad, [rest, [member for member in members if member != bad]]
+    if announces_files:
+        archives = [entry for entry in shard if entry.endswith(".fitpack")]
+        if analyzed or not archives:
+            return None, None
+        # failed while expanding the archives, which report the broken one
+        broken = _announced(log, BROKEN_ARCHIVE)
+        named = [a for a in archives if any(b.startswith(f"{a}:") for b in broken)]
+        bad = (named or archives)[0]
+        return bad, [[entry for entry in shard if entry != bad]]
+    if len(shard) == 1:
+        return shard[0], []
+    half = len(shard) // 2
+    return None, [shard[:half], shard[half:]]
+
+
+def _announced(log: List[str], prefix: str) -> List[str]:
+    """The rest of every line of the output that starts with prefix"""
+    return [line[len(prefix) :].strip() for line in log if line.startswith(prefix)]
+
+
+def _failure_signature(tail: List[str], bad: str, work_dir: str) -> str:
+    """The end of a failed worker's output, without the paths that differ by shard"""
+    text = re.sub(re.escape(work_dir) + r"/[^\s\"',)]*", "", "".join(tail))
+    return text.replace(bad, "")
+
+
+def _archive_of(file: str) -> str:
+    """The .fitpack archive of an archive member, or the file itself"""
+    return re.sub(r"(\.fitpack)/.*", r"\1", file)